@@ -0,0 +1,285 @@
+#include "compressed_volume.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "parallel.h"
+
+const int CompressedVolume::brick_rows;
+const int CompressedVolume::group_size;
+
+/// Map small negative and positive residuals to small codes
+static inline uint16_t zigzag(uint16_t residual) {
+  return (uint16_t)(residual << 1) ^ (uint16_t)-(residual >> 15);
+}
+
+static inline uint16_t unzigzag(uint16_t code) {
+  return (code >> 1) ^ (uint16_t)-(code & 1);
+}
+
+/// Number of bits used to store the codes of a group whose largest code is
+/// 'max_code'. Only byte and nibble sizes are used, so that groups are
+/// unpacked without bit manipulations across bytes.
+static int getGroupBits(uint16_t max_code) {
+  if (max_code == 0)
+    return 0;
+  if (max_code < (1 << 4))
+    return 4;
+  if (max_code < (1 << 8))
+    return 8;
+  return 16;
+}
+
+CompressedVolume::CompressedVolume(int width, int height, int depth,
+                                   size_t cache_budget)
+    : width(width), height(height), depth(depth), cache_budget(cache_budget),
+      layers(std::max(depth, 0)), compressed_size(0) {
+  size_t layer_bytes = std::max<size_t>(1, (size_t)width * height * sizeof(uint16_t));
+  // Threads working on a layer usually access its neighbors too
+  max_cached_layers =
+      std::max<size_t>(3 * getNbThreads(), cache_budget / layer_bytes);
+}
+
+std::shared_ptr<CompressedVolume> CompressedVolume::clone() const {
+  std::shared_ptr<CompressedVolume> result = std::make_shared<CompressedVolume>(
+      width, height, depth, cache_budget);
+  // Layers are never modified once compressed, the clone shares them
+  std::lock_guard<std::mutex> lock(mutex);
+  result->layers = layers;
+  result->compressed_size = compressed_size.load();
+  return result;
+}
+
+void CompressedVolume::checkLayer(int layer) const {
+  if (layer < 0 || layer >= depth)
+    throw std::out_of_range(
+        "Layer " + std::to_string(layer) +
+        " is outside of volume (depth=" + std::to_string(depth) + ")");
+}
+
+void CompressedVolume::writeLayer(const uint16_t *layer_data, int layer) {
+  checkLayer(layer);
+  std::shared_ptr<Layer> compressed = std::make_shared<Layer>();
+  int nb_bricks = (height + brick_rows - 1) / brick_rows;
+  compressed->brick_offsets.resize(nb_bricks);
+  for (int brick = 0; brick < nb_bricks; brick++) {
+    int first_row = brick * brick_rows;
+    compressed->brick_offsets[brick] = compressed->bytes.size();
+    compressBrick(layer_data + (size_t)first_row * width, width,
+                  std::min(brick_rows, height - first_row), &compressed->bytes);
+  }
+  compressed->bytes.shrink_to_fit();
+  size_t new_size = compressed->bytes.size() +
+                    compressed->brick_offsets.size() * sizeof(uint32_t);
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<const Layer> &current = layers[layer];
+  size_t old_size = current ? current->bytes.size() +
+                                  current->brick_offsets.size() * sizeof(uint32_t)
+                            : 0;
+  current = compressed;
+  compressed_size += new_size;
+  compressed_size -= old_size;
+  // The decompressed layer is now outdated
+  auto it = cached_layers.find(layer);
+  if (it != cached_layers.end()) {
+    lru.erase(it->second);
+    cached_layers.erase(it);
+  }
+}
+
+size_t CompressedVolume::getCompressedLayerSize(const uint16_t *values,
+                                               int width, int height) {
+  std::vector<uint8_t> bytes;
+  int nb_bricks = (height + brick_rows - 1) / brick_rows;
+  for (int brick = 0; brick < nb_bricks; brick++) {
+    int first_row = brick * brick_rows;
+    compressBrick(values + (size_t)first_row * width, width,
+                  std::min(brick_rows, height - first_row), &bytes);
+  }
+  return bytes.size() + nb_bricks * sizeof(uint32_t);
+}
+
+std::shared_ptr<const VolumeSlab> CompressedVolume::getSlab(int layer) {
+  checkLayer(layer);
+  std::shared_ptr<VolumeSlab> slab(new VolumeSlab());
+  std::shared_ptr<const Layer> compressed;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cached_layers.find(layer);
+    if (it != cached_layers.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      return *it->second;
+    }
+    compressed = layers[layer];
+    // The memory of evicted layers is reused, it is overwritten below
+    if (!free_storage.empty()) {
+      slab->storage.swap(free_storage.back());
+      free_storage.pop_back();
+    }
+  }
+  slab->first_layer = layer;
+  slab->nb_layers = 1;
+  slab->layer_size = width * height;
+  slab->storage.resize(slab->layer_size);
+  slab->values = slab->storage.data();
+  if (!compressed) {
+    std::fill(slab->storage.begin(), slab->storage.end(), 0);
+  } else {
+    for (size_t brick = 0; brick < compressed->brick_offsets.size(); brick++) {
+      int first_row = brick * brick_rows;
+      decompressBrick(compressed->bytes.data() + compressed->brick_offsets[brick],
+                      width, std::min(brick_rows, height - first_row),
+                      slab->storage.data() + (size_t)first_row * width);
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  // Another thread may have decompressed the layer in the meantime
+  auto it = cached_layers.find(layer);
+  if (it != cached_layers.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    return *it->second;
+  }
+  // The layer written in the meantime must not be replaced by the values
+  // decompressed from its previous version
+  if (layers[layer] != compressed)
+    return slab;
+  lru.push_front(slab);
+  cached_layers[layer] = lru.begin();
+  while (lru.size() > max_cached_layers) {
+    std::shared_ptr<VolumeSlab> &evicted = lru.back();
+    cached_layers.erase(evicted->first_layer);
+    // Layers still used elsewhere keep their memory
+    if (evicted.use_count() == 1)
+      free_storage.push_back(std::move(evicted->storage));
+    lru.pop_back();
+  }
+  return slab;
+}
+
+uint16_t CompressedVolume::getValue(int col, int row, int layer) {
+  checkLayer(layer);
+  std::shared_ptr<const Layer> compressed;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cached_layers.find(layer);
+    if (it != cached_layers.end())
+      return (*it->second)->getLayer(layer)[col + row * width];
+    compressed = layers[layer];
+  }
+  if (!compressed)
+    return 0;
+  int brick = row / brick_rows;
+  int first_row = brick * brick_rows;
+  std::vector<uint16_t> values((size_t)brick_rows * width);
+  decompressBrick(compressed->bytes.data() + compressed->brick_offsets[brick],
+                  width, std::min(brick_rows, height - first_row),
+                  values.data());
+  return values[(row - first_row) * width + col];
+}
+
+size_t CompressedVolume::getCompressedSize() const { return compressed_size; }
+
+size_t CompressedVolume::getCacheBudget() const { return cache_budget; }
+
+void CompressedVolume::compressBrick(const uint16_t *values, int width,
+                                     int nb_rows, std::vector<uint8_t> *out) {
+  // The first row is predicted from the left neighbors, the other rows from
+  // the row above so that they are decompressed without dependencies
+  // between columns
+  size_t nb_values = (size_t)width * nb_rows;
+  std::vector<uint16_t> codes(nb_values);
+  uint16_t previous = 0;
+  for (int col = 0; col < width; col++) {
+    codes[col] = zigzag(values[col] - previous);
+    previous = values[col];
+  }
+  for (size_t idx = width; idx < nb_values; idx++)
+    codes[idx] = zigzag(values[idx] - values[idx - width]);
+
+  for (size_t group_start = 0; group_start < nb_values;
+       group_start += group_size) {
+    int nb_codes = std::min<size_t>(group_size, nb_values - group_start);
+    const uint16_t *group = &codes[group_start];
+    uint16_t max_code = 0;
+    for (int i = 0; i < nb_codes; i++)
+      max_code = std::max(max_code, group[i]);
+    int bits = getGroupBits(max_code);
+    out->push_back(bits);
+    // Incomplete groups are padded with 0
+    for (int i = 0; i < group_size * bits / 8; i++) {
+      switch (bits) {
+      case 4: {
+        uint8_t low = 2 * i < nb_codes ? group[2 * i] : 0;
+        uint8_t high = 2 * i + 1 < nb_codes ? group[2 * i + 1] : 0;
+        out->push_back(low | high << 4);
+        break;
+      }
+      case 8:
+        out->push_back(i < nb_codes ? group[i] : 0);
+        break;
+      case 16: {
+        uint16_t code = i / 2 < nb_codes ? group[i / 2] : 0;
+        out->push_back(i % 2 == 0 ? code & 0xff : code >> 8);
+        break;
+      }
+      }
+    }
+  }
+}
+
+const uint8_t *CompressedVolume::decompressBrick(const uint8_t *data,
+                                                 int width, int nb_rows,
+                                                 uint16_t *values) {
+  // Groups are decoded in local arrays of fixed size, so that compilers
+  // vectorize the loops without checking if the arrays overlap
+  size_t nb_values = (size_t)width * nb_rows;
+  uint16_t codes[group_size];
+  uint16_t above[group_size];
+  uint16_t previous = 0;
+  for (size_t group_start = 0; group_start < nb_values;
+       group_start += group_size) {
+    int nb_codes = std::min<size_t>(group_size, nb_values - group_start);
+    int bits = *data++;
+    switch (bits) {
+    case 0:
+      memset(codes, 0, sizeof(codes));
+      break;
+    case 4:
+      for (int i = 0; i < group_size / 2; i++) {
+        codes[2 * i] = data[i] & 0xf;
+        codes[2 * i + 1] = data[i] >> 4;
+      }
+      break;
+    case 8:
+      for (int i = 0; i < group_size; i++)
+        codes[i] = data[i];
+      break;
+    default:
+      for (int i = 0; i < group_size; i++)
+        codes[i] = data[2 * i] | data[2 * i + 1] << 8;
+      break;
+    }
+    data += group_size * bits / 8;
+    uint16_t *group = values + group_start;
+    if (group_start >= (size_t)width && width >= group_size &&
+        nb_codes == group_size) {
+      // The whole group is predicted from values already decoded
+      memcpy(above, group - width, sizeof(above));
+      for (int i = 0; i < group_size; i++)
+        codes[i] = above[i] + unzigzag(codes[i]);
+      memcpy(group, codes, sizeof(codes));
+      continue;
+    }
+    for (int i = 0; i < nb_codes; i++) {
+      size_t idx = group_start + i;
+      if (idx < (size_t)width)
+        previous += unzigzag(codes[i]);
+      else
+        previous = values[idx - width] + unzigzag(codes[i]);
+      values[idx] = previous;
+    }
+  }
+  return data;
+}
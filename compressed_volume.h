@@ -0,0 +1,112 @@
+#ifndef COMPRESSED_VOLUME_H
+#define COMPRESSED_VOLUME_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "slab_cache.h"
+
+/// Stores the layers of a volume in memory with a lossless compression and
+/// keeps the most recently used layers decompressed.
+///
+/// Each layer is split in bricks of 'brick_rows' rows compressed
+/// independently: values are predicted from the value above (from the left
+/// neighbor in the first row of the brick), and the residuals are packed by
+/// groups of 'group_size' on 0, 4, 8 or 16 bits depending on the largest
+/// residual of the group. Uniform regions then take a byte per group and
+/// noisy CT data usually compresses about 2 times. Decompression is made of
+/// loops without dependencies between columns, which compilers vectorize.
+///
+/// Layers are handed out as single-layer slabs, like SlabCache. Layers are
+/// decompressed outside of the lock, so that threads working on different
+/// layers do not wait for each other. The compressed layers are immutable
+/// and replaced as a whole under the lock: a layer being decompressed while
+/// it is written gives the previous values and is not cached.
+///
+/// All the methods are thread-safe. Different layers may be written at the
+/// same time.
+class CompressedVolume {
+public:
+  /// Number of rows of a brick
+  static const int brick_rows = 16;
+  /// Number of values sharing the same number of bits
+  static const int group_size = 32;
+
+  /// 'cache_budget' is the memory used for the decompressed layers [bytes]
+  CompressedVolume(int width, int height, int depth, size_t cache_budget);
+
+  CompressedVolume(const CompressedVolume &other) = delete;
+  CompressedVolume &operator=(const CompressedVolume &other) = delete;
+
+  /// Return a copy of the compressed layers, with an empty cache
+  std::shared_ptr<CompressedVolume> clone() const;
+
+  /// Compress the values of a layer
+  void writeLayer(const uint16_t *layer_data, int layer);
+
+  /// Return the slab holding the given layer, decompressing it if it is not
+  /// in the cache. Layers which have never been written are filled with 0.
+  std::shared_ptr<const VolumeSlab> getSlab(int layer);
+
+  /// Return a single value, only its brick is decompressed if its layer is
+  /// not in the cache
+  uint16_t getValue(int col, int row, int layer);
+
+  /// Memory used by the compressed layers [bytes]
+  size_t getCompressedSize() const;
+
+  /// Maximal memory used by the decompressed layers [bytes]
+  size_t getCacheBudget() const;
+
+  /// Size of a layer of 'width' x 'height' values once compressed, offsets of
+  /// the bricks included [bytes]
+  static size_t getCompressedLayerSize(const uint16_t *values, int width,
+                                       int height);
+
+  /// Compress the 'nb_rows' rows of 'width' values and append the result to
+  /// 'out'
+  static void compressBrick(const uint16_t *values, int width, int nb_rows,
+                            std::vector<uint8_t> *out);
+  /// Decompress a brick written by compressBrick, return the position
+  /// following it
+  static const uint8_t *decompressBrick(const uint8_t *data, int width,
+                                        int nb_rows, uint16_t *values);
+
+private:
+  /// The compressed bricks of a layer
+  struct Layer {
+    /// The brick b starts at bytes[brick_offsets[b]]
+    std::vector<uint32_t> brick_offsets;
+    std::vector<uint8_t> bytes;
+  };
+
+  /// Throws std::out_of_range if the layer is outside of the volume
+  void checkLayer(int layer) const;
+
+  int width;
+  int height;
+  int depth;
+  size_t cache_budget;
+  size_t max_cached_layers;
+
+  /// Shared with the clones and the threads decompressing them, protected by
+  /// 'mutex'
+  std::vector<std::shared_ptr<const Layer>> layers;
+  std::atomic<size_t> compressed_size;
+
+  mutable std::mutex mutex;
+  /// Decompressed layers, most recently used first
+  std::list<std::shared_ptr<VolumeSlab>> lru;
+  /// Access to the slabs of 'lru' by layer
+  std::unordered_map<int, std::list<std::shared_ptr<VolumeSlab>>::iterator>
+      cached_layers;
+  /// Memory of the evicted layers, reused to decompress other layers
+  std::vector<std::vector<uint16_t>> free_storage;
+};
+
+#endif // COMPRESSED_VOLUME_H
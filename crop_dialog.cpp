@@ -0,0 +1,45 @@
+#include "crop_dialog.h"
+
+#include <QVBoxLayout>
+
+CropDialog::CropDialog(QWidget *parent) : QDialog(parent), updating(false) {
+  setWindowTitle("Crop box");
+  QVBoxLayout *layout = new QVBoxLayout(this);
+  const char *axes[3] = {"X", "Y", "Z"};
+  for (int axis = 0; axis < 3; axis++) {
+    min_sliders[axis] = new DoubleSlider(QString(axes[axis]) + " min", 0, 1);
+    max_sliders[axis] = new DoubleSlider(QString(axes[axis]) + " max", 0, 1);
+    layout->addWidget(min_sliders[axis]);
+    layout->addWidget(max_sliders[axis]);
+    connect(min_sliders[axis], SIGNAL(valueChanged(double)), this,
+            SLOT(onSliderChanged(double)));
+    connect(max_sliders[axis], SIGNAL(valueChanged(double)), this,
+            SLOT(onSliderChanged(double)));
+  }
+  setCropBox(GLWidget::CropBox());
+}
+
+GLWidget::CropBox CropDialog::getCropBox() {
+  GLWidget::CropBox crop_box;
+  for (int axis = 0; axis < 3; axis++) {
+    crop_box.min[axis] = min_sliders[axis]->value();
+    crop_box.max[axis] = max_sliders[axis]->value();
+  }
+  return crop_box;
+}
+
+void CropDialog::setCropBox(const GLWidget::CropBox &crop_box) {
+  updating = true;
+  for (int axis = 0; axis < 3; axis++) {
+    min_sliders[axis]->setValue(crop_box.min[axis]);
+    max_sliders[axis]->setValue(crop_box.max[axis]);
+  }
+  updating = false;
+  emit cropBoxChanged(getCropBox());
+}
+
+void CropDialog::onSliderChanged(double new_value) {
+  (void)new_value;
+  if (!updating)
+    emit cropBoxChanged(getCropBox());
+}
@@ -0,0 +1,33 @@
+#ifndef CROP_DIALOG_H
+#define CROP_DIALOG_H
+
+#include <QDialog>
+
+#include "double_slider.h"
+#include "glwidget.h"
+
+/// A dialog to choose the crop box of the 3D view, with the minimum and
+/// maximum of each axis expressed as ratios of the extent of the volume
+class CropDialog : public QDialog {
+  Q_OBJECT
+public:
+  CropDialog(QWidget *parent = 0);
+
+  GLWidget::CropBox getCropBox();
+  void setCropBox(const GLWidget::CropBox &crop_box);
+
+public slots:
+  void onSliderChanged(double new_value);
+
+signals:
+  void cropBoxChanged(const GLWidget::CropBox &crop_box);
+
+private:
+  /// Sliders for the minimum and maximum along x, y and z
+  DoubleSlider *min_sliders[3];
+  DoubleSlider *max_sliders[3];
+  /// Avoid sending a crop box per slider while setting all of them
+  bool updating;
+};
+
+#endif // CROP_DIALOG_H
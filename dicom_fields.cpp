@@ -0,0 +1,43 @@
+#include "dicom_fields.h"
+
+#include <iostream>
+
+template <>
+double getField<double>(DcmItem *item, const DcmTagKey &tag_key,
+                        unsigned long pos) {
+  double value;
+  OFCondition status = item->findAndGetFloat64(tag_key, value, pos);
+  if (status.bad())
+    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
+              << std::endl;
+  return value;
+}
+template <>
+short int getField<short int>(DcmItem *item, const DcmTagKey &tag_key,
+                              unsigned long pos) {
+  short int value;
+  OFCondition status = item->findAndGetSint16(tag_key, value, pos);
+  if (status.bad())
+    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
+              << std::endl;
+  return value;
+}
+template <>
+int getField<int>(DcmItem *item, const DcmTagKey &tag_key, unsigned long pos) {
+  int value;
+  OFCondition status = item->findAndGetSint32(tag_key, value, pos);
+  if (status.bad())
+    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
+              << std::endl;
+  return value;
+}
+template <>
+std::string getField<std::string>(DcmItem *item, const DcmTagKey &tag_key,
+                                  unsigned long pos) {
+  OFString value;
+  OFCondition status = item->findAndGetOFStringArray(tag_key, value, pos);
+  if (status.bad())
+    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
+              << std::endl;
+  return value.c_str();
+}
@@ -0,0 +1,41 @@
+#ifndef DICOM_FIELDS_H
+#define DICOM_FIELDS_H
+
+#include <string>
+#include <vector>
+
+#include <dcmtk/dcmdata/dctk.h>
+
+/// Read the value at position 'pos' of an element, errors are reported on
+/// std::cerr
+template <typename T>
+T getField(DcmItem *item, const DcmTagKey &tag_key, unsigned long pos = 0);
+template <typename T>
+T getField(DcmItem *item, unsigned int g, unsigned int e,
+           unsigned long pos = 0) {
+  return getField<T>(item, DcmTagKey(g, e), pos);
+}
+
+template <>
+double getField<double>(DcmItem *item, const DcmTagKey &tag_key,
+                        unsigned long pos);
+template <>
+short int getField<short int>(DcmItem *item, const DcmTagKey &tag_key,
+                              unsigned long pos);
+template <>
+int getField<int>(DcmItem *item, const DcmTagKey &tag_key, unsigned long pos);
+template <>
+std::string getField<std::string>(DcmItem *item, const DcmTagKey &tag_key,
+                                  unsigned long pos);
+
+template <typename T>
+std::vector<T> getFieldVector(DcmItem *item, const DcmTagKey &tag_key,
+                              int fixed_size) {
+  std::vector<T> result(fixed_size);
+  for (int i = 0; i < fixed_size; i++) {
+    result[i] = getField<T>(item, tag_key, i);
+  }
+  return result;
+}
+
+#endif // DICOM_FIELDS_H
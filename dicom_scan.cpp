@@ -0,0 +1,101 @@
+#include "dicom_scan.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dicom_fields.h"
+#include "parallel.h"
+
+/// Read an unsigned short element, return false if it is missing
+static bool getUint16(DcmDataset *dataset, const DcmTagKey &tag_key,
+                      int *value) {
+  Uint16 result;
+  if (dataset->findAndGetUint16(tag_key, result).bad())
+    return false;
+  *value = result;
+  return true;
+}
+
+/// Read an element whose value representation depends on the pixel
+/// representation, return false if it is missing
+static bool getPixelValue(DcmDataset *dataset, const DcmTagKey &tag_key,
+                          bool is_signed, double *value) {
+  if (is_signed) {
+    Sint16 result;
+    if (dataset->findAndGetSint16(tag_key, result).bad())
+      return false;
+    *value = result;
+    return true;
+  }
+  int result;
+  if (!getUint16(dataset, tag_key, &result))
+    return false;
+  *value = result;
+  return true;
+}
+
+DicomHeader scanDicomHeader(const std::string &path) {
+  DicomHeader header;
+  header.rows = 0;
+  header.columns = 0;
+  header.min_value = 0;
+  header.max_value = 0;
+  header.info.path = path;
+  // Parsing stops at the pixel data, which is neither read nor skipped
+  DcmFileFormat file;
+  OFCondition status = file.loadFileUntilTag(
+      path.c_str(), EXS_Unknown, EGL_noChange, DCM_MaxReadLength,
+      ERM_autoDetect, DCM_PixelData);
+  if (status.bad()) {
+    header.error = std::string("Failed to read file: ") + status.text();
+    return header;
+  }
+  DcmDataset *dataset = file.getDataset();
+  if (!getUint16(dataset, DCM_Rows, &header.rows) ||
+      !getUint16(dataset, DCM_Columns, &header.columns) ||
+      header.rows <= 0 || header.columns <= 0) {
+    header.error = "No image size";
+    return header;
+  }
+  if (!dataset->tagExists(DCM_ImagePositionPatient) ||
+      !dataset->tagExists(DCM_PixelSpacing)) {
+    header.error = "No image position or pixel spacing";
+    return header;
+  }
+  header.study_uid = getField<std::string>(dataset, DCM_StudyInstanceUID);
+  header.series_uid = getField<std::string>(dataset, DCM_SeriesInstanceUID);
+  header.series_description =
+      getField<std::string>(dataset, DCM_SeriesDescription);
+  header.patient_name = getField<std::string>(dataset, DCM_PatientName);
+  header.info = DicomSliceInfo::fromDataset(dataset, path);
+
+  int bits_stored = 16;
+  int pixel_representation = 0;
+  getUint16(dataset, DCM_BitsStored, &bits_stored);
+  getUint16(dataset, DCM_PixelRepresentation, &pixel_representation);
+  bool is_signed = pixel_representation == 1;
+  double stored_min, stored_max;
+  if (!getPixelValue(dataset, DCM_SmallestImagePixelValue, is_signed,
+                     &stored_min) ||
+      !getPixelValue(dataset, DCM_LargestImagePixelValue, is_signed,
+                     &stored_max)) {
+    double nb_values = std::ldexp(1.0, bits_stored);
+    stored_min = is_signed ? -nb_values / 2 : 0;
+    stored_max = stored_min + nb_values - 1;
+  }
+  double slope = header.info.slope != 0 ? header.info.slope : 1;
+  header.min_value = std::min(stored_min * slope, stored_max * slope) +
+                     header.info.intercept;
+  header.max_value = std::max(stored_min * slope, stored_max * slope) +
+                     header.info.intercept;
+  return header;
+}
+
+std::vector<DicomHeader> scanDicomHeaders(const std::vector<std::string> &paths) {
+  std::vector<DicomHeader> headers(paths.size());
+  parallelFor(0, (int)paths.size(), [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++)
+      headers[i] = scanDicomHeader(paths[i]);
+  });
+  return headers;
+}
@@ -0,0 +1,41 @@
+#ifndef DICOM_SCAN_H
+#define DICOM_SCAN_H
+
+#include <string>
+#include <vector>
+
+#include "dicom_slice_info.h"
+
+/// The properties of a Dicom file needed to validate a collection, read
+/// without loading its pixel data
+struct DicomHeader {
+  /// Empty if the header has been read, the reason of the failure otherwise
+  std::string error;
+
+  std::string study_uid;
+  std::string series_uid;
+  std::string series_description;
+  std::string patient_name;
+
+  /// Size of the image [pixels]
+  int rows;
+  int columns;
+
+  /// Range of the values of the image once rescaled, taken from the smallest
+  /// and largest pixel values if the file provides them, from the range
+  /// allowed by the bits stored otherwise
+  double min_value;
+  double max_value;
+
+  DicomSliceInfo info;
+};
+
+/// Read the elements of a file preceding its pixel data, the file is not
+/// read further
+DicomHeader scanDicomHeader(const std::string &path);
+
+/// Read the headers of several files in parallel, the headers are in the
+/// same order as the paths
+std::vector<DicomHeader> scanDicomHeaders(const std::vector<std::string> &paths);
+
+#endif // DICOM_SCAN_H
@@ -0,0 +1,20 @@
+#include "dicom_slice_info.h"
+
+#include "dicom_fields.h"
+
+DicomSliceInfo DicomSliceInfo::fromDataset(DcmDataset *dataset,
+                                           const std::string &path) {
+  DicomSliceInfo info;
+  info.path = path;
+  info.instance_number = getField<int>(dataset, 0x20, 0x13);
+  info.acquisition_number = getField<int>(dataset, 0x20, 0x12);
+  info.image_position =
+      getFieldVector<double>(dataset, DcmTagKey(0x20, 0x32), 3);
+  info.pixel_spacing = getFieldVector<double>(dataset, DcmTagKey(0x28, 0x30), 2);
+  info.window_center = getField<double>(dataset, 0x28, 0x1050);
+  info.window_width = getField<double>(dataset, 0x28, 0x1051);
+  info.slope = getField<double>(dataset, 0x28, 0x1053);
+  info.intercept = getField<double>(dataset, 0x28, 0x1052);
+  info.transfer_syntax = dataset->getOriginalXfer();
+  return info;
+}
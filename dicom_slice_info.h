@@ -0,0 +1,36 @@
+#ifndef DICOM_SLICE_INFO_H
+#define DICOM_SLICE_INFO_H
+
+#include <string>
+#include <vector>
+
+#include <dcmtk/dcmdata/dctk.h>
+
+/// The properties of a slice of a collection which are kept once its voxels
+/// have been loaded, the dataset itself can be reloaded from 'path' on demand
+struct DicomSliceInfo {
+  /// The file the slice has been read from
+  std::string path;
+
+  int instance_number;
+  int acquisition_number;
+
+  /// [x,y,z] position of the first voxel transmitted in mm
+  std::vector<double> image_position;
+  /// [row_spacing, col_spacing] in mm
+  std::vector<double> pixel_spacing;
+
+  double window_center;
+  double window_width;
+  double slope;
+  double intercept;
+
+  /// The transfer syntax of the file
+  E_TransferSyntax transfer_syntax;
+
+  /// Extract the properties of the slice from its dataset
+  static DicomSliceInfo fromDataset(DcmDataset *dataset,
+                                    const std::string &path);
+};
+
+#endif // DICOM_SLICE_INFO_H
@@ -1,20 +1,48 @@
 #include "dicom_viewer.h"
 
+#include <atomic>
 #include <iostream>
 #include <set>
+#include <stdexcept>
 
 #include <QFileDialog>
+#include <QActionGroup>
+#include <QInputDialog>
 #include <QMenuBar>
 #include <QMessageBox>
+#include <QStatusBar>
+#include <QTimer>
 
 #include <dcmtk/dcmdata/dcrledrg.h>
 #include <dcmtk/dcmjpeg/djdecode.h>
 
+#include "parallel.h"
+#include "series_index.h"
+#include "task_graph.h"
+#include "verbose.h"
+
+#include <unistd.h>
+
+/// By default, volumes larger than a quarter of the physical memory are
+/// stored out-of-core
+static size_t getDefaultVolumeMemoryBudget() {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGE_SIZE);
+  if (pages <= 0 || page_size <= 0)
+    return (size_t)1 << 30;
+  return (size_t)pages * page_size / 4;
+}
+
 DicomViewer::DicomViewer(QWidget *parent)
-    : QMainWindow(parent), image(nullptr), img_data(nullptr), pixel_width(-1),
+    : QMainWindow(parent), last_slice(0), img_data(nullptr), pixel_width(-1),
       pixel_height(-1), slice_spacing(0),
       collection_min(std::numeric_limits<double>::max()),
-      collection_max(std::numeric_limits<double>::lowest()) {
+      collection_max(std::numeric_limits<double>::lowest()),
+      volume_memory_budget(getDefaultVolumeMemoryBudget()),
+      compress_volumes(false), interactive(true), volume_manager(2 * volume_memory_budget),
+      active_series(-1),
+      series_group(nullptr), resampling_mode(-1), resampling_spacing(0),
+      segments_group(nullptr) {
   // Setting layout
   widget = new QWidget();
   setCentralWidget(widget);
@@ -26,6 +54,7 @@ DicomViewer::DicomViewer(QWidget *parent)
   window_center_slider = new DoubleSlider("Window center", -1000.0, 1000.0);
   window_width_slider = new DoubleSlider("Window width", 1.0, 5000.0);
   gl_widget = new GLWidget();
+  gl_widget->setVolumeMemoryBudget(volume_memory_budget);
 
   hide_2d_image = new CheckBox("test", "Hide 2D image");
   hide_3d_image = new CheckBox("test", "Hide 3D image");
@@ -36,14 +65,16 @@ DicomViewer::DicomViewer(QWidget *parent)
 
   contours_mode = new CheckBox("test", "Contours Mode");
   color_mode = new CheckBox("test", "Color Mode");
+  lighting_mode = new CheckBox("test", "Lighting");
+  depth_sorting = new CheckBox("test", "Depth sorting");
   
   layout->addWidget(alpha_slider, 0, 0, 1, 3);
   layout->addWidget(slice_slider, 1, 0, 1, 3);
   layout->addWidget(window_center_slider, 2, 0, 1, 3);
   layout->addWidget(window_width_slider, 3, 0, 1, 3);
 
-  layout->addWidget(img_label, 4, 1, 7, 1);
-  layout->addWidget(gl_widget, 4, 2, 7, 1);
+  layout->addWidget(img_label, 4, 1, 9, 1);
+  layout->addWidget(gl_widget, 4, 2, 9, 1);
 
   layout->addWidget(hide_2d_image, 4, 0, 1, 1);
   layout->addWidget(hide_3d_image, 5, 0, 1, 1);
@@ -54,6 +85,8 @@ DicomViewer::DicomViewer(QWidget *parent)
 
   layout->addWidget(contours_mode, 9, 0, 1, 1);
   layout->addWidget(color_mode, 10, 0, 1, 1);
+  layout->addWidget(lighting_mode, 11, 0, 1, 1);
+  layout->addWidget(depth_sorting, 12, 0, 1, 1);
 
 
   widget->setLayout(layout);
@@ -63,6 +96,9 @@ DicomViewer::DicomViewer(QWidget *parent)
   open_collection_action->setShortcut(QKeySequence::Open);
   QObject::connect(open_collection_action, SIGNAL(triggered()), this,
                    SLOT(openDicomCollection()));
+  QAction *open_directory_action = file_menu->addAction("Open &directory");
+  QObject::connect(open_directory_action, SIGNAL(triggered()), this,
+                   SLOT(openDicomDirectory()));
   QAction *save_action = file_menu->addAction("&Save");
   save_action->setShortcut(QKeySequence::Save);
   QObject::connect(save_action, SIGNAL(triggered()), this, SLOT(save()));
@@ -71,10 +107,91 @@ DicomViewer::DicomViewer(QWidget *parent)
   saveXYZ_action->setShortcut(QKeySequence::SaveAs);
   QObject::connect(saveXYZ_action, SIGNAL(triggered()), gl_widget, SLOT(saveXYZ()));
 
+  QAction *auto_window_action = file_menu->addAction("&Auto window");
+  QObject::connect(auto_window_action, SIGNAL(triggered()), this,
+                   SLOT(applyAutoWindow()));
+
+  QAction *compress_action = file_menu->addAction("&Compress volumes");
+  compress_action->setCheckable(true);
+  compress_action->setChecked(compress_volumes);
+  QObject::connect(compress_action, SIGNAL(toggled(bool)), this,
+                   SLOT(onCompressVolumesToggled(bool)));
+
+  QAction *publish_action = file_menu->addAction("&Publish to local consumers");
+  publish_action->setCheckable(true);
+  QObject::connect(publish_action, SIGNAL(toggled(bool)), this,
+                   SLOT(onPublishStreamToggled(bool)));
+
   QAction *help_action = file_menu->addAction("&Help");
   help_action->setShortcut(QKeySequence::HelpContents);
   QObject::connect(help_action, SIGNAL(triggered()), this, SLOT(showStats()));
 
+  // The series opened, the menu is filled when series are added
+  series_menu = menuBar()->addMenu("S&eries");
+  updateSeriesMenu();
+
+  // Filters applied to the volume before extracting the points
+  QMenu *filter_menu = menuBar()->addMenu("F&ilter");
+  QActionGroup *filter_group = new QActionGroup(this);
+  const std::vector<std::pair<const char *, VolumeFilter>> filters = {
+      {"&None", VolumeFilter::NONE},
+      {"&Gaussian", VolumeFilter::GAUSSIAN},
+      {"&Median 3x3x3", VolumeFilter::MEDIAN},
+      {"&Bilateral", VolumeFilter::BILATERAL}};
+  for (const auto &entry : filters) {
+    QAction *filter_action = filter_menu->addAction(entry.first);
+    filter_action->setCheckable(true);
+    filter_action->setChecked(entry.second == VolumeFilter::NONE);
+    filter_action->setData((int)entry.second);
+    filter_group->addAction(filter_action);
+  }
+  QObject::connect(filter_group, SIGNAL(triggered(QAction *)), this,
+                   SLOT(onFilterSelected(QAction *)));
+
+  // Resampling of the volume on cubic voxels
+  QMenu *resampling_menu = menuBar()->addMenu("&Resample");
+  QActionGroup *resampling_group = new QActionGroup(this);
+  const std::vector<std::pair<const char *, int>> resamplings = {
+      {"&None", -1},
+      {"&Trilinear", (int)Interpolation::TRILINEAR},
+      {"&Cubic", (int)Interpolation::CUBIC}};
+  for (const auto &entry : resamplings) {
+    QAction *resampling_action = resampling_menu->addAction(entry.first);
+    resampling_action->setCheckable(true);
+    resampling_action->setChecked(entry.second == resampling_mode);
+    resampling_action->setData(entry.second);
+    resampling_group->addAction(resampling_action);
+  }
+  QObject::connect(resampling_group, SIGNAL(triggered(QAction *)), this,
+                   SLOT(onResamplingSelected(QAction *)));
+  resampling_menu->addSeparator();
+  QAction *spacing_action = resampling_menu->addAction("Voxel &size...");
+  QObject::connect(spacing_action, SIGNAL(triggered()), this,
+                   SLOT(chooseResamplingSpacing()));
+
+  // Region of the volume shown in the 3D view
+  crop_dialog = new CropDialog(this);
+  QObject::connect(crop_dialog, SIGNAL(cropBoxChanged(GLWidget::CropBox)),
+                   this, SLOT(onCropBoxChanged(GLWidget::CropBox)));
+  QMenu *crop_menu = menuBar()->addMenu("&Crop");
+  QAction *crop_box_action = crop_menu->addAction("Crop &box...");
+  QObject::connect(crop_box_action, SIGNAL(triggered()), this,
+                   SLOT(showCropDialog()));
+  QAction *reset_crop_action = crop_menu->addAction("&Reset crop box");
+  QObject::connect(reset_crop_action, SIGNAL(triggered()), this,
+                   SLOT(resetCropBox()));
+  crop_menu->addSeparator();
+  QAction *clip_action = crop_menu->addAction("Clip from &view");
+  QObject::connect(clip_action, SIGNAL(triggered()), this,
+                   SLOT(addClipPlane()));
+  QAction *clear_clip_action = crop_menu->addAction("&Clear clip planes");
+  QObject::connect(clear_clip_action, SIGNAL(triggered()), this,
+                   SLOT(clearClipPlanes()));
+
+  // Segments shown in color mode, the menu lists them to toggle them
+  transfer_function_menu = menuBar()->addMenu("&Transfer function");
+  updateTransferFunctionMenu();
+
   // Sliders connection
   connect(alpha_slider, SIGNAL(valueChanged(double)), gl_widget,
           SLOT(setAlpha(double)));
@@ -104,11 +221,33 @@ DicomViewer::DicomViewer(QWidget *parent)
   //Color connection
   connect(color_mode, SIGNAL(stateChanged(int)), gl_widget,
           SLOT(onColorModeChange(int)));
+  connect(color_mode, SIGNAL(stateChanged(int)), this,
+          SLOT(onColorModeChange(int)));
+
+  //Lighting connection
+  connect(lighting_mode, SIGNAL(stateChanged(int)), gl_widget,
+          SLOT(onLightingModeChange(int)));
+
+  //Transparency connection
+  connect(depth_sorting, SIGNAL(stateChanged(int)), gl_widget,
+          SLOT(onDepthSortingChange(int)));
+
+  // Picking connection
+  probe.hit = false;
+  connect(gl_widget, SIGNAL(voxelPicked(GLWidget::PickResult)), this,
+          SLOT(onVoxelPicked(GLWidget::PickResult)));
 
   // Codec registration
   DcmRLEDecoderRegistration::registerCodecs();
   DJDecoderRegistration::registerCodecs();
 
+  // Slices are reloaded from the files of the collection, possibly on the
+  // prefetching thread of the cache: the loader only uses the path copied
+  // when the slice was requested
+  size_t slice_cache_budget = 512 * 1024 * 1024;
+  slice_cache.reset(new SliceCache(&DicomViewer::decodeDicomFile,
+                                   slice_cache_budget));
+
   // Update basic display elements
   updateInstanceLimits();
   updateSliceSlider();
@@ -126,135 +265,252 @@ void DicomViewer::openDicomCollection() {
   // If no file has been selected, don't change anything
   if (files.size() == 0)
     return;
-  // TODO: this code section clearly exhibits that it would be way better to
-  // encapsulate the DicomCollection in a class with several attributes, to load
-  // it and then to have a collection = std::move(new_collection)
-
-  // First reading all the collection properties in temporary variables to
-  // avoid modification of the current data if provided files are invalid
-  std::map<int, std::unique_ptr<DcmFileFormat>> new_files;
-  std::string new_patient;
-  double new_collection_min = std::numeric_limits<double>::max();
-  double new_collection_max = std::numeric_limits<double>::lowest();
-  double new_pixel_width(-1);
-  double new_pixel_height(-1);
-  for (int file_idx = 0; file_idx < files.size(); file_idx++) {
-    const QString &file = files[file_idx];
-    std::string path = file.toStdString();
-    std::unique_ptr<DcmFileFormat> dcm_file(new DcmFileFormat());
-    OFCondition status;
-    status = dcm_file->loadFile(path.c_str());
-    if (status.bad()) {
-      QMessageBox::critical(this, "Failed to open file", path.c_str());
-      return;
+
+  std::vector<std::string> paths;
+  for (int file_idx = 0; file_idx < files.size(); file_idx++)
+    paths.push_back(files[file_idx].toStdString());
+  openDicomFiles(paths);
+}
+
+bool DicomViewer::openDicomFiles(const std::vector<std::string> &paths) {
+  // Only the headers are read to validate the collection, the pixel data is
+  // loaded once the volume of a series is built
+  std::vector<DicomHeader> headers = scanDicomHeaders(paths);
+  for (const DicomHeader &header : headers) {
+    if (!header.error.empty()) {
+      showError("Failed to open file", header.info.path + ": " + header.error);
+      return false;
+    }
+  }
+  return openSeries(headers, false);
+}
+
+void DicomViewer::setInteractive(bool enabled) { interactive = enabled; }
+
+void DicomViewer::showError(const std::string &title,
+                            const std::string &message) {
+  if (interactive)
+    QMessageBox::critical(this, title.c_str(), message.c_str());
+  else
+    std::cerr << title << ": " << message << std::endl;
+}
+
+void DicomViewer::showWarning(const std::string &title,
+                              const std::string &message) {
+  if (interactive)
+    QMessageBox::warning(this, title.c_str(), message.c_str());
+  else
+    std::cerr << title << ": " << message << std::endl;
+}
+
+std::shared_ptr<const VolumicData> DicomViewer::getActiveVolume() {
+  if (active_series < 0)
+    return nullptr;
+  return volume_manager.getVolume(active_series);
+}
+
+void DicomViewer::openDicomDirectory() {
+  QString directory =
+      QFileDialog::getExistingDirectory(this, "Select directory to open");
+  if (directory.isEmpty())
+    return;
+  // Headers of the files already indexed are not read again
+  SeriesIndex index(directory.toStdString());
+  std::vector<DicomHeader> headers = index.update();
+  if (isVerbose())
+    std::cout << "Directory index: " << headers.size() << " Dicom files, "
+              << index.getNbScanned() << " files read" << std::endl;
+  if (headers.empty()) {
+    showWarning("Empty directory", "No Dicom image found in the directory");
+    return;
+  }
+  openSeries(headers, true);
+}
+
+bool DicomViewer::openSeries(const std::vector<DicomHeader> &headers,
+                             bool skip_invalid) {
+  // Files are grouped by study and series, each series is then checked
+  // separately
+  std::map<std::pair<std::string, std::string>,
+           std::vector<const DicomHeader *>>
+      headers_by_series;
+  for (const DicomHeader &header : headers)
+    headers_by_series[{header.study_uid, header.series_uid}].push_back(&header);
+  std::vector<std::unique_ptr<DicomSeries>> new_series;
+  // The problems of all the series are reported at once
+  std::vector<std::string> errors, warnings;
+  for (const auto &entry : headers_by_series) {
+    const DicomHeader &first = *entry.second.front();
+    std::string name = first.series_description.empty()
+                           ? entry.first.second
+                           : first.series_description;
+    std::string warning;
+    try {
+      new_series.push_back(readSeries(entry.first.second, entry.second,
+                                      &warning));
+    } catch (const std::runtime_error &error) {
+      if (!skip_invalid) {
+        showError("Inconsistent collection", error.what());
+        return false;
+      }
+      errors.push_back(name + ": " + error.what());
     }
-    DcmDataset *file_ds = dcm_file->getDataset();
-    // Checking patient
-    std::string file_patient = getPatientName(file_ds);
-    if (new_patient == "") {
-      new_patient = file_patient;
-    } else if (new_patient != file_patient) {
+    if (!warning.empty())
+      warnings.push_back(name + ": " + warning);
+  }
+  if (!errors.empty()) {
+    std::string msg = std::to_string(errors.size()) + " of " +
+                      std::to_string(headers_by_series.size()) +
+                      " series skipped:";
+    for (const std::string &error : errors)
+      msg += "\n" + error;
+    showWarning("Invalid series", msg);
+  }
+  if (!warnings.empty()) {
+    std::string msg;
+    for (const std::string &warning : warnings)
+      msg += (msg.empty() ? "" : "\n") + warning;
+    showWarning("Missing instances", msg);
+  }
+
+  int last_id = -1;
+  for (auto &series : new_series)
+    last_id = volume_manager.addSeries(std::move(series));
+  if (last_id >= 0)
+    activateSeries(last_id);
+  return true;
+}
+
+std::unique_ptr<DicomSeries>
+DicomViewer::readSeries(const std::string &uid,
+                        const std::vector<const DicomHeader *> &headers,
+                        std::string *warning) {
+  std::unique_ptr<DicomSeries> series(new DicomSeries());
+  series->uid = uid;
+  series->collection_min = std::numeric_limits<double>::max();
+  series->collection_max = std::numeric_limits<double>::lowest();
+  series->pixel_width = -1;
+  series->pixel_height = -1;
+  std::map<int, DicomSliceInfo> &new_infos = series->slices;
+  for (size_t file_idx = 0; file_idx < headers.size(); file_idx++) {
+    const DicomHeader &header = *headers[file_idx];
+    // Checking patient and image size
+    if (file_idx == 0) {
+      series->patient_name = header.patient_name;
+      series->description = header.series_description;
+    } else if (series->patient_name != header.patient_name) {
       std::string msg =
-          "At least 2 patients are present in the file collection: '" +
-          new_patient + "' and '" + file_patient + "'";
-      QMessageBox::critical(this, "Invalid file collection", msg.c_str());
-      return;
+          "At least 2 patients are present in the series: '" +
+          series->patient_name + "' and '" + header.patient_name + "'";
+      throw std::runtime_error(msg);
+    } else if (header.rows != headers[0]->rows ||
+               header.columns != headers[0]->columns) {
+      std::string msg = "Multiple image sizes found: " +
+                        std::to_string(headers[0]->columns) + "x" +
+                        std::to_string(headers[0]->rows) + " and " +
+                        std::to_string(header.columns) + "x" +
+                        std::to_string(header.rows);
+      throw std::runtime_error(msg);
     }
 
-    int instance_number = getInstanceNumber(file_ds);
+    int instance_number = header.info.instance_number;
     // Checking that instance number is not duplicated
-    if (new_files.count(instance_number) > 0) {
+    if (new_infos.count(instance_number) > 0) {
       std::string msg = "Instance " + std::to_string(instance_number) +
                         " is already loaded, cancelling load";
-      QMessageBox::critical(this, "Duplicated instance idx", msg.c_str());
-      return;
-    }
-    // All the Dicom file should contain loadable images
-    DicomImage *img = loadDicomImage(file_ds);
-    if (img == nullptr) {
-      QMessageBox::critical(this, "Invalid file",
-                            ("Can't read image at file " + path).c_str());
-      return;
+      throw std::runtime_error(msg);
     }
     // Updating min and max of collection
-    double frame_min, frame_max;
-    getFrameMinMax(img, &frame_min, &frame_max);
-    new_collection_min = std::min(frame_min, new_collection_min);
-    new_collection_max = std::max(frame_max, new_collection_max);
-    new_files[instance_number] = std::move(dcm_file);
+    series->collection_min = std::min(header.min_value, series->collection_min);
+    series->collection_max = std::max(header.max_value, series->collection_max);
+    new_infos[instance_number] = header.info;
     // Updating/checking pixel_width
-    std::vector<double> pixel_spacing = getPixelSpacing(file_ds);
+    const std::vector<double> &pixel_spacing = header.info.pixel_spacing;
     double frame_pixel_height = pixel_spacing[0];
     double frame_pixel_width = pixel_spacing[1];
     if (file_idx == 0) {
-      new_pixel_width = frame_pixel_width;
-      new_pixel_height = frame_pixel_height;
-    } else if (new_pixel_width != frame_pixel_width ||
-               new_pixel_height != frame_pixel_height) {
+      series->pixel_width = frame_pixel_width;
+      series->pixel_height = frame_pixel_height;
+    } else if (series->pixel_width != frame_pixel_width ||
+               series->pixel_height != frame_pixel_height) {
       std::ostringstream msg_oss;
-      msg_oss << "Multiple pixel sizes found: " << new_pixel_width << "*"
-              << new_pixel_height << " and " << frame_pixel_width << "*"
+      msg_oss << "Multiple pixel sizes found: " << series->pixel_width << "*"
+              << series->pixel_height << " and " << frame_pixel_width << "*"
               << frame_pixel_height;
-      QMessageBox::critical(this, "Inconsistent collection",
-                            msg_oss.str().c_str());
-      return;
+      throw std::runtime_error(msg_oss.str());
     }
   }
   // Check slice_spacing consistency
   double new_slice_offset(0);
-  double new_slice_spacing(-1);
-  if (new_files.size() <= 1) {
-    new_slice_spacing = 0;
+  int new_min_instance = new_infos.begin()->first;
+  int new_max_instance = new_infos.rbegin()->first;
+  if (new_infos.size() <= 1) {
+    series->slice_spacing = 0;
   } else {
-    int new_min_instance = new_files.begin()->first;
-    int new_max_instance = new_files.rbegin()->first;
     // Deducing layer spacing and offset from extremum layers
-    std::vector<double> first_layer_position =
-        getImagePosition(new_files.begin()->second->getDataset());
-    std::vector<double> last_layer_position =
-        getImagePosition(new_files.rbegin()->second->getDataset());
-    new_slice_spacing = (last_layer_position[2] - first_layer_position[2]) /
-                        (new_max_instance - new_min_instance);
+    const std::vector<double> &first_layer_position =
+        new_infos.begin()->second.image_position;
+    const std::vector<double> &last_layer_position =
+        new_infos.rbegin()->second.image_position;
+    series->slice_spacing = (last_layer_position[2] - first_layer_position[2]) /
+                            (new_max_instance - new_min_instance);
     new_slice_offset =
-        first_layer_position[2] - new_min_instance * new_slice_spacing;
+        first_layer_position[2] - new_min_instance * series->slice_spacing;
     // Checking that all layers roughly respect the provided their expected
     // position
     double max_tol = 0.01; //[mm]
-    for (const auto &entry : new_files) {
-      double expected_z = new_slice_spacing * entry.first + new_slice_offset;
-      double received_z = getImagePosition(entry.second->getDataset())[2];
+    for (const auto &entry : new_infos) {
+      double expected_z = series->slice_spacing * entry.first + new_slice_offset;
+      double received_z = entry.second.image_position[2];
       double error_z = fabs(expected_z - received_z);
       if (error_z > max_tol) {
         std::string msg = "Slices are not regularly spaced, error: " +
                           std::to_string(error_z);
-        QMessageBox::critical(this, "Inconsistent collection", msg.c_str());
-        return;
+        throw std::runtime_error(msg);
       }
     }
   }
+  int expected_instances = new_max_instance - new_min_instance + 1;
+  if (new_infos.size() != (size_t)expected_instances) {
+    std::string msg = "Expecting " + std::to_string(expected_instances) +
+                      " instances, received " +
+                      std::to_string(new_infos.size()) + " instances";
+    if (warning)
+      *warning = msg;
+  }
+  return series;
+}
 
-  // Replacing current elements
-  active_files.clear();
-  for (auto &entry : new_files) {
-    active_files[entry.first] = std::move(entry.second);
+void DicomViewer::activateSeries(int id) {
+  DicomSeries *series = volume_manager.getSeries(id);
+  active_series = series ? id : -1;
+  // Replacing current elements, the slices decoded from the previous series
+  // are dropped first
+  image.reset();
+  slice_cache->clear();
+  if (series) {
+    active_files = series->slices;
+    patient_name = series->patient_name;
+    collection_min = series->collection_min;
+    collection_max = series->collection_max;
+    pixel_height = series->pixel_height;
+    pixel_width = series->pixel_width;
+    slice_spacing = series->slice_spacing;
+  } else {
+    active_files.clear();
+    volume_histogram.reset();
+    gl_widget->updateVolumicData(nullptr);
   }
-  patient_name = new_patient;
-  collection_min = new_collection_min;
-  collection_max = new_collection_max;
-  pixel_height = new_pixel_height;
-  pixel_width = new_pixel_width;
-  slice_spacing = new_slice_spacing;
 
   // Updating all the internal members based on the new data
   updateInstanceLimits();
-  int expected_instances = max_instance - min_instance + 1;
-  if (active_files.size() != (size_t)expected_instances) {
-    std::string msg = "Expecting " + std::to_string(expected_instances) +
-                      " instances, received " +
-                      std::to_string(active_files.size()) + " instances";
-    QMessageBox::warning(this, "Missing instances", msg.c_str());
-  }
   updateSliceSlider();
+  updateSeriesMenu();
+  if (!series) {
+    updateWindowSliders();
+    updateImage();
+    return;
+  }
   loadDicomImage();
   updateWindowSliders();
   applyDefaultWindow();
@@ -262,6 +518,42 @@ void DicomViewer::openDicomCollection() {
   updateVolumicData();
 }
 
+void DicomViewer::onSeriesSelected(QAction *action) {
+  int id = action->data().toInt();
+  if (id != active_series)
+    activateSeries(id);
+}
+
+void DicomViewer::closeActiveSeries() {
+  if (active_series < 0)
+    return;
+  volume_manager.removeSeries(active_series);
+  std::vector<int> ids = volume_manager.getSeriesIds();
+  activateSeries(ids.empty() ? -1 : ids.back());
+}
+
+void DicomViewer::updateSeriesMenu() {
+  // Actions are owned by the menu, the group is rebuilt with them
+  delete series_group;
+  series_menu->clear();
+  series_group = new QActionGroup(this);
+  for (int id : volume_manager.getSeriesIds()) {
+    QAction *series_action =
+        series_menu->addAction(volume_manager.getSeries(id)->getLabel().c_str());
+    series_action->setCheckable(true);
+    series_action->setChecked(id == active_series);
+    series_action->setData(id);
+    series_group->addAction(series_action);
+  }
+  QObject::connect(series_group, SIGNAL(triggered(QAction *)), this,
+                   SLOT(onSeriesSelected(QAction *)));
+  series_menu->addSeparator();
+  QAction *close_action = series_menu->addAction("&Close series");
+  close_action->setEnabled(active_series >= 0);
+  QObject::connect(close_action, SIGNAL(triggered()), this,
+                   SLOT(closeActiveSeries()));
+}
+
 void DicomViewer::save() {
   QString fileName = QFileDialog::getSaveFileName(
       this, tr("Save image to: "), "tmp.png", tr("Images (*.png *.xpm *.jpg)"));
@@ -269,6 +561,15 @@ void DicomViewer::save() {
     QMessageBox::critical(this, "Failed to save file", fileName);
 }
 
+void DicomViewer::applyAutoWindow() {
+  if (!volume_histogram || volume_histogram->empty())
+    return;
+  double center, width;
+  volume_histogram->getAutoWindow(0.005, 0.995, &center, &width);
+  window_center_slider->setValue(center);
+  window_width_slider->setValue(width);
+}
+
 void DicomViewer::showStats() {
   std::string html_endl("<br>");
   std::ostringstream msg_oss;
@@ -277,12 +578,22 @@ void DicomViewer::showStats() {
   msg_oss << "Nb loaded slices: " << active_files.size() << html_endl;
   msg_oss << "Values used: [" << collection_min << "," << collection_max << "]"
           << html_endl;
+  if (volume_histogram && !volume_histogram->empty()) {
+    msg_oss << "Stored values: [" << volume_histogram->getMin() << ","
+            << volume_histogram->getMax() << "]" << html_endl;
+    msg_oss << "Stored values percentiles (1%, 50%, 99%): "
+            << volume_histogram->getPercentile(0.01) << ", "
+            << volume_histogram->getPercentile(0.5) << ", "
+            << volume_histogram->getPercentile(0.99) << html_endl;
+  }
   msg_oss << "Pixel size: " << pixel_width << "*" << pixel_height << " [mm]"
           << html_endl;
   msg_oss << "Slices spacing: " << slice_spacing << " [mm]" << html_endl;
   msg_oss << html_endl;
   msg_oss << "<h1>Frame Properties</h1>";
-  DcmDataset *ds = getDataset();
+  // The dataset of the active slice is reloaded from its file
+  std::unique_ptr<DcmFileFormat> active_file = loadActiveFile();
+  DcmDataset *ds = active_file ? active_file->getDataset() : nullptr;
   if (ds != nullptr) {
     msg_oss << "Instance number: " << getInstanceNumber(ds) << html_endl;
     msg_oss << "Acquisition number: " << getAcquisitionNumber(ds) << html_endl;
@@ -321,27 +632,117 @@ void DicomViewer::showStats() {
   QMessageBox::information(this, "DCM file properties", msg_oss.str().c_str());
 }
 
+void DicomViewer::onCompressVolumesToggled(bool enabled) {
+  compress_volumes = enabled;
+}
+
+void DicomViewer::onPublishStreamToggled(bool enabled) {
+  if (!enabled) {
+    gl_widget->setStreamPublisher(nullptr);
+    statusBar()->clearMessage();
+    return;
+  }
+  try {
+    gl_widget->setStreamPublisher(std::make_shared<VolumeStreamPublisher>(
+        volume_stream::getDefaultSocketPath(),
+        volume_stream::getDefaultShmName()));
+  } catch (const std::runtime_error &error) {
+    QMessageBox::critical(this, "Failed to publish", error.what());
+    QAction *action = qobject_cast<QAction *>(sender());
+    if (action)
+      action->setChecked(false);
+    return;
+  }
+  statusBar()->showMessage(
+      ("Publishing on " + volume_stream::getDefaultSocketPath()).c_str());
+}
+
 void DicomViewer::onSliceChange(int new_slice) {
-  (void)new_slice;
   gl_widget->curr_slice = new_slice;
   gl_widget->updateDisplayPoints();
   gl_widget->update();
   loadDicomImage();
   updateImage();
+  // Decoding in advance the next slices in the scrolling direction
+  int direction = new_slice >= last_slice ? 1 : -1;
+  slice_cache->prefetch(new_slice, direction, min_instance, max_instance,
+                        [this](int instance, std::string *path) {
+                          auto it = active_files.find(instance);
+                          if (it == active_files.end())
+                            return false;
+                          *path = it->second.path;
+                          return true;
+                        });
+  last_slice = new_slice;
 }
 
 void DicomViewer::onWindowCenterChange(double new_window_center) {
   //(void)new_window_center;
   updateImage();
+  showPointsEstimate();
   gl_widget->setWinCenter(new_window_center);
 }
 
 void DicomViewer::onWindowWidthChange(double new_window_width) {
   //(void)new_window_width;
   updateImage();
+  showPointsEstimate();
   gl_widget->setWinWidth(new_window_width);
 }
 
+void DicomViewer::onFilterSelected(QAction *action) {
+  gl_widget->setFilter((VolumeFilter)action->data().toInt());
+  showPointsEstimate();
+}
+
+void DicomViewer::onResamplingSelected(QAction *action) {
+  resampling_mode = action->data().toInt();
+  updateResampling();
+}
+
+void DicomViewer::chooseResamplingSpacing() {
+  bool ok = false;
+  double spacing = QInputDialog::getDouble(
+      this, "Resampling", "Voxel size [mm] (0: smallest spacing)",
+      resampling_spacing, 0, 100, 2, &ok);
+  if (!ok)
+    return;
+  resampling_spacing = spacing;
+  updateResampling();
+}
+
+void DicomViewer::updateResampling() {
+  gl_widget->setResampling(resampling_mode >= 0,
+                           (Interpolation)std::max(resampling_mode, 0),
+                           resampling_spacing);
+  showPointsEstimate();
+}
+
+void DicomViewer::showCropDialog() {
+  crop_dialog->show();
+  crop_dialog->raise();
+  crop_dialog->activateWindow();
+}
+
+void DicomViewer::resetCropBox() {
+  crop_dialog->setCropBox(GLWidget::CropBox());
+}
+
+void DicomViewer::onCropBoxChanged(const GLWidget::CropBox &crop_box) {
+  gl_widget->setCropBox(crop_box);
+  showPointsEstimate();
+}
+
+void DicomViewer::addClipPlane() {
+  gl_widget->addClipPlaneFromView();
+  showPointsEstimate();
+}
+
+void DicomViewer::clearClipPlanes() {
+  gl_widget->clearClipPlanes();
+  showPointsEstimate();
+}
+
 void DicomViewer::on2dDisplayStateChange(int state) {
   if (state >= 1)
     img_label->setVisible(false);
@@ -358,11 +759,43 @@ void DicomViewer::on3dDisplayStateChange(int state) {
   updateVolumicData();
 }
 
-DcmDataset *DicomViewer::getDataset() {
+const DicomSliceInfo *DicomViewer::getSliceInfo() {
   int idx = slice_slider->value();
   if (active_files.count(idx) == 0)
     return nullptr;
-  return active_files.at(idx)->getDataset();
+  return &active_files.at(idx);
+}
+
+std::unique_ptr<DcmFileFormat> DicomViewer::loadActiveFile() {
+  const DicomSliceInfo *info = getSliceInfo();
+  if (info == nullptr)
+    return nullptr;
+  return loadDicomFile(info->path);
+}
+
+std::unique_ptr<DcmFileFormat>
+DicomViewer::loadDicomFile(const std::string &path) {
+  std::unique_ptr<DcmFileFormat> dcm_file(new DcmFileFormat());
+  OFCondition status = dcm_file->loadFile(path.c_str());
+  if (status.bad())
+    return nullptr;
+  return dcm_file;
+}
+
+std::shared_ptr<DicomImage>
+DicomViewer::decodeDicomFile(const std::string &path) {
+  std::unique_ptr<DcmFileFormat> dcm_file = loadDicomFile(path);
+  if (!dcm_file)
+    return nullptr;
+  DicomImage *img = decodeDicomImage(dcm_file->getDataset());
+  if (img == nullptr)
+    return nullptr;
+  // The dataset is released along with the image
+  DcmFileFormat *file = dcm_file.release();
+  return std::shared_ptr<DicomImage>(img, [file](DicomImage *img) {
+    delete img;
+    delete file;
+  });
 }
 
 void DicomViewer::updateInstanceLimits() {
@@ -395,22 +828,30 @@ void DicomViewer::updateWindowSliders() {
   window_width_slider->setLimits(1.0, collection_max - collection_min);
 }
 void DicomViewer::loadDicomImage() {
-  if (image != nullptr)
-    delete (image);
-  image = loadDicomImage(getDataset());
+  int idx = slice_slider->value();
+  auto it = active_files.find(idx);
+  if (it == active_files.end()) {
+    image.reset();
+    return;
+  }
+  image = slice_cache->get(idx, it->second.path);
+  if (image == nullptr)
+    showError("Dicom Image failure",
+              "Failed to decode instance " + std::to_string(idx));
 }
 
-DicomImage *DicomViewer::loadDicomImage(DcmDataset *dataset) {
+DicomImage *DicomViewer::decodeDicomImage(DcmDataset *dataset,
+                                          OFCondition *status) {
   if (dataset == nullptr) {
     return nullptr;
   }
   // Changing syntax to a common one
   E_TransferSyntax wished_ts = EXS_LittleEndianExplicit;
-  OFCondition status = dataset->chooseRepresentation(wished_ts, NULL);
-  if (status.bad()) {
-    QMessageBox::critical(this, "Dicom Image failure", status.text());
+  OFCondition repr_status = dataset->chooseRepresentation(wished_ts, NULL);
+  if (status)
+    *status = repr_status;
+  if (repr_status.bad())
     return nullptr;
-  }
   return new DicomImage(dataset, wished_ts);
 }
 
@@ -432,43 +873,257 @@ void DicomViewer::updateImage() {
 }
 
 void DicomViewer::updateVolumicData() {
-  // Building a buffer to store each layer data
-  int buffer_size = image->getWidth() * image->getHeight();
-  uint16_t buffer[buffer_size];
-  // Getting default window used
-  //double window_center = window_center_slider->value();
-  //double window_width = window_width_slider->value();
-  // Building a VolumicData object with appropriate dimensions
-  std::unique_ptr<VolumicData> new_data(new VolumicData(image->getWidth(), image->getHeight(), max_instance - min_instance + 1, getWindowMin(), getWindowMax(), getIntercept()));
+  if (active_series < 0)
+    return;
+  // The volume of the series is reused if it is still held by the manager
+  std::shared_ptr<const VolumicData> volume =
+      volume_manager.getVolume(active_series);
+  if (!volume) {
+    volume = buildVolumicData();
+    if (!volume)
+      return;
+    volume_manager.setVolume(active_series, volume);
+  }
+  volume_histogram = volume->histogram;
+  probe.hit = false;
+  // The view receives a copy sharing the voxels of the series
+  gl_widget->updateVolumicData(
+      std::unique_ptr<VolumicData>(new VolumicData(*volume)));
+  gl_widget->update();
+  showPointsEstimate();
+  if (isVerbose())
+    std::cout << "Volumes memory: "
+              << volume_manager.getMemoryUsed() / (1024 * 1024) << " MB"
+              << std::endl;
+}
 
-  for (const auto &entry : active_files) {
-    DicomImage *dicom = loadDicomImage(entry.second->getDataset());
-    //dicom->setWindow(window_center, window_width);
-    dicom->setNoVoiTransformation();
-    int bits_per_pixel = 16;
-    int layer = entry.first;
-    int status = dicom->getOutputData((void *)buffer, 2*buffer_size, bits_per_pixel);
-    delete (dicom);
-    if (!status) {
-      QMessageBox::critical(this, "Failed update volumic data",
-                            "getOutputData failed");
-      continue;
-    }
+/// Store in 'preview' the average of each block of 2x2 values of a layer
+/// 'width' values wide, given in the representation of the DICOM files
+static void setHalfResolutionLayer(const uint16_t *values, int width,
+                                   VolumicData *preview, int layer) {
+  std::vector<uint16_t> buffer((size_t)preview->width * preview->height);
+  for (int row = 0; row < preview->height; row++) {
+    const uint16_t *top = values + (size_t)2 * row * width;
+    const uint16_t *bottom = top + width;
+    uint16_t *out = &buffer[(size_t)row * preview->width];
+    for (int col = 0; col < preview->width; col++)
+      out[col] = (top[2 * col] + top[2 * col + 1] + bottom[2 * col] +
+                  bottom[2 * col + 1] + 2) / 4;
+  }
+  preview->setLayer(buffer.data(), layer);
+}
+
+bool DicomViewer::decodeLayer(const std::string &path, int layer_size,
+                              uint16_t *values) {
+  std::unique_ptr<DcmFileFormat> file = loadDicomFile(path);
+  if (!file)
+    return false;
+  std::unique_ptr<DicomImage> dicom(decodeDicomImage(file->getDataset()));
+  if (!dicom)
+    return false;
+  dicom->setNoVoiTransformation();
+  int bits_per_pixel = 16;
+  return dicom->getOutputData((void *)values, 2 * layer_size, bits_per_pixel);
+}
 
-    new_data->setLayer(buffer, layer - min_instance);
+std::shared_ptr<VolumicData> DicomViewer::buildVolumicData() {
+  int width = image->getWidth();
+  int height = image->getHeight();
+  int layer_size = width * height;
+  int depth = max_instance - min_instance + 1;
+  // Building a VolumicData object with appropriate dimensions, volumes which
+  // do not fit in the memory budget are stored in a cache file. The ratio of
+  // the compression depends on the series (about 1.8 on noisy CT series): it
+  // is measured on the middle layer, usually among the densest, and a margin
+  // covers the layers which compress less.
+  std::shared_ptr<VolumicData> new_data;
+  size_t volume_bytes = (size_t)layer_size * depth * sizeof(uint16_t);
+  size_t compressed_bytes = volume_bytes;
+  if (compress_volumes && !active_files.empty()) {
+    auto middle = active_files.begin();
+    std::advance(middle, active_files.size() / 2);
+    std::vector<uint16_t> values(layer_size);
+    if (decodeLayer(middle->second.path, layer_size, values.data()))
+      compressed_bytes = CompressedVolume::getCompressedLayerSize(
+                             values.data(), width, height) *
+                         depth * 5 / 4;
+    if (isVerbose())
+      std::cout << "Estimated compression ratio: "
+                << (double)volume_bytes / compressed_bytes << std::endl;
   }
+  if (compress_volumes && compressed_bytes <= volume_memory_budget) {
+    // A small cache of decompressed layers lets their memory be reused
+    const size_t cache_budget = 16 * 1024 * 1024;
+    std::shared_ptr<CompressedVolume> storage =
+        std::make_shared<CompressedVolume>(width, height, depth, cache_budget);
+    new_data.reset(new VolumicData(width, height, depth, getWindowMin(),
+                                   getWindowMax(), getIntercept(), storage));
+  } else if (volume_bytes > volume_memory_budget) {
+    try {
+      std::shared_ptr<SlabCache> cache = SlabCache::createTemporary(
+          layer_size, depth, volume_memory_budget);
+      new_data.reset(new VolumicData(width, height, depth, getWindowMin(),
+                                     getWindowMax(), getIntercept(), cache));
+    } catch (const std::runtime_error &error) {
+      showError("Failed update volumic data", error.what());
+      return nullptr;
+    }
+  } else {
+    new_data.reset(new VolumicData(width, height, depth, getWindowMin(),
+                                   getWindowMax(), getIntercept()));
+  }
+  // The geometry is set before the loading, views of the volume shown while
+  // it is loaded use it
   new_data->pixel_width = pixel_width;
   new_data->pixel_height = pixel_height;
   new_data->slice_spacing = slice_spacing;
-  gl_widget->updateVolumicData(std::move(new_data));
-  gl_widget->update();
+
+  // While the volume is loaded, a preview made of every preview_step-th
+  // layer at half resolution is shown in the 3D view. Its layers are loaded
+  // first and the preview grows as they arrive, so that the first image comes
+  // after decoding a fraction of the series. The preview is skipped if it
+  // would take a significant part of the memory budget.
+  const int preview_step = 4;
+  int preview_depth = (depth + preview_step - 1) / preview_step;
+  size_t preview_bytes =
+      (size_t)(width / 2) * (height / 2) * preview_depth * sizeof(uint16_t);
+  std::unique_ptr<VolumicData> preview;
+  if (width >= 2 && height >= 2 && preview_bytes <= volume_memory_budget / 4) {
+    preview.reset(new VolumicData(width / 2, height / 2, preview_depth,
+                                  getWindowMin(), getWindowMax(),
+                                  getIntercept()));
+    preview->pixel_width = 2 * pixel_width;
+    preview->pixel_height = 2 * pixel_height;
+    preview->slice_spacing = preview_step * slice_spacing;
+  }
+  // Layers of the preview without files are considered as loaded
+  std::unique_ptr<std::atomic<bool>[]> preview_loaded(
+      new std::atomic<bool>[preview_depth]);
+  for (int layer = 0; layer < preview_depth; layer++)
+    preview_loaded[layer] = true;
+
+  // Files are loaded by the workers, each file is released as soon as its
+  // layer has been imported. Files of the layers of the preview come first.
+  std::vector<std::string> paths;
+  std::vector<int> layers;
+  for (int pass = 0; pass < 2; pass++) {
+    for (const auto &entry : active_files) {
+      int layer = entry.first - min_instance;
+      if ((layer % preview_step == 0) != (pass == 0))
+        continue;
+      paths.push_back(entry.second.path);
+      layers.push_back(layer);
+      if (pass == 0)
+        preview_loaded[layer / preview_step] = false;
+    }
+  }
+  // The pipeline is a graph of tasks: each file is decoded by a task, then
+  // its values are stored by a task which adds them to the histogram of its
+  // thread, histograms are merged once all the layers are stored. Storing a
+  // layer follows its decoding on the same thread while the buffer is still
+  // in the caches, and other threads keep decoding meanwhile.
+  TaskGraph graph;
+  int nb_threads = graph.getNbThreads();
+  std::vector<VolumeHistogram> histograms(nb_threads, VolumeHistogram(depth));
+  std::vector<std::vector<uint16_t>> buffers(paths.size());
+  std::atomic<int> nb_failures(0);
+  std::atomic<int> nb_stored_layers(0);
+  std::vector<int> store_tasks;
+  for (size_t i = 0; i < paths.size(); i++) {
+    int decode_task = graph.addTask([&, i](int) {
+      buffers[i].resize(layer_size);
+      if (!decodeLayer(paths[i], layer_size, buffers[i].data())) {
+        nb_failures++;
+        buffers[i].clear();
+      }
+    });
+    store_tasks.push_back(graph.addTask(
+        [&, i](int thread_idx) {
+          bool in_preview = preview && layers[i] % preview_step == 0;
+          if (!buffers[i].empty()) {
+            new_data->setLayer(buffers[i].data(), layers[i],
+                               &histograms[thread_idx]);
+            if (in_preview)
+              setHalfResolutionLayer(buffers[i].data(), width, preview.get(),
+                                     layers[i] / preview_step);
+          }
+          std::vector<uint16_t>().swap(buffers[i]);
+          if (in_preview)
+            preview_loaded[layers[i] / preview_step] = true;
+          nb_stored_layers++;
+        },
+        {decode_task}));
+  }
+  graph.addTask(
+      [&](int) {
+        for (int thread_idx = 1; thread_idx < nb_threads; thread_idx++)
+          histograms[0].merge(histograms[thread_idx]);
+        new_data->histogram =
+            std::make_shared<const VolumeHistogram>(std::move(histograms[0]));
+      },
+      store_tasks);
+
+  // The slice shown in the 2D view is painted before the loading starts
+  img_label->repaint();
+  const int refresh_interval_ms = 250;
+  int nb_shown_layers = 0;
+  graph.start();
+  while (!graph.waitFor(refresh_interval_ms)) {
+    statusBar()->showMessage(("Loading layers: " +
+                              std::to_string(nb_stored_layers) + "/" +
+                              std::to_string(paths.size()))
+                                 .c_str());
+    statusBar()->repaint();
+    if (!preview)
+      continue;
+    // The preview is refined with the loaded layers following the ones shown
+    int nb_loaded_layers = nb_shown_layers;
+    while (nb_loaded_layers < preview_depth && preview_loaded[nb_loaded_layers])
+      nb_loaded_layers++;
+    if (nb_loaded_layers == nb_shown_layers)
+      continue;
+    nb_shown_layers = nb_loaded_layers;
+    // The view aliases the storage of the preview without owning it, the
+    // workers keep writing the preview without detaching it
+    gl_widget->updateVolumicData(preview->createPartialView(nb_shown_layers));
+    gl_widget->repaint();
+  }
+  // The view of the preview is dropped before the preview is released, the
+  // view is not repainted until it receives the volume
+  if (nb_shown_layers > 0)
+    gl_widget->updateVolumicData(nullptr);
+  statusBar()->clearMessage();
+  try {
+    graph.wait();
+  } catch (const std::exception &error) {
+    showError("Failed update volumic data", error.what());
+    return nullptr;
+  }
+  if (nb_failures > 0)
+    showError("Failed update volumic data", "getOutputData failed for " +
+                                                std::to_string(nb_failures) +
+                                                " layers");
+
+  return new_data;
+}
+
+void DicomViewer::showPointsEstimate() {
+  if (!volume_histogram)
+    return;
+  double window_center = window_center_slider->value();
+  double window_width = window_width_slider->value();
+  uint64_t estimate =
+      gl_widget->estimateDisplayPoints(window_center - window_width / 2,
+                                       window_center + window_width / 2);
+  statusBar()->showMessage(
+      ("Estimated points: " + std::to_string(estimate)).c_str());
 }
 
 std::string DicomViewer::getPatientName(DcmDataset *ds) {
   return getField<std::string>(ds, DCM_PatientName);
 }
 
-DicomImage *DicomViewer::getDicomImage() { return image; }
+DicomImage *DicomViewer::getDicomImage() { return image.get(); }
 
 QImage DicomViewer::getQImage() {
   DicomImage *dicom = getDicomImage();
@@ -480,14 +1135,18 @@ QImage DicomViewer::getQImage() {
   int status =
       dicom->getOutputData((void *)img_data, data_size, bits_per_pixel);
   if (!status) {
-    QMessageBox::critical(this, "Fatal error",
-                          "Failed to get output data when getting QImage");
+    showError("Fatal error", "Failed to get output data when getting QImage");
     return QImage();
   }
   int width = dicom->getWidth();
   int height = dicom->getHeight();
 
-  return QImage(img_data, width, height, QImage::Format_Grayscale8);
+  QImage result(img_data, width, height, QImage::Format_Grayscale8);
+  // The segments of the transfer function are shown like in the 3D view
+  if (color_mode->value())
+    colorizeImage(&result);
+  drawProbe(&result);
+  return result;
 }
 
 std::vector<double> DicomViewer::getPixelSpacing(DcmDataset *dataset) {
@@ -534,22 +1193,174 @@ void DicomViewer::loadJSONdata() {
   // If no file has been selected, don't change anything
   if (file.isEmpty())
     return;
+  std::shared_ptr<const TransferFunction> transfer_function;
+  try {
+    transfer_function = TransferFunction::loadJSON(file.toStdString());
+  } catch (const std::runtime_error &error) {
+    QMessageBox::critical(this, "Invalid transfer function", error.what());
+    return;
+  }
+  setTransferFunction(transfer_function);
+}
+
+void DicomViewer::resetTransferFunction() {
+  setTransferFunction(TransferFunction::createDefault());
+}
+
+void DicomViewer::onSegmentToggled(QAction *action) {
+  size_t index = action->data().toInt();
+  // Only the visibility changes, the actions of the menu are kept
+  setTransferFunction(gl_widget->getTransferFunction()->withVisibility(
+                          index, action->isChecked()),
+                      false);
+}
+
+void DicomViewer::onColorModeChange(int state) {
+  (void)state;
+  updateImage();
+}
+
+void DicomViewer::setTransferFunction(
+    std::shared_ptr<const TransferFunction> transfer_function,
+    bool segments_changed) {
+  gl_widget->setTransferFunction(transfer_function);
+  // The change comes from an action of the menu, which can't be deleted
+  // before its signal returns: the menu is rebuilt from the event loop
+  if (segments_changed)
+    QTimer::singleShot(0, this, SLOT(updateTransferFunctionMenu()));
+  else
+    updateSegmentActions();
+  updateImage();
+  showPointsEstimate();
+}
+
+void DicomViewer::updateTransferFunctionMenu() {
+  // Actions are owned by the menu, the group is rebuilt with them
+  delete segments_group;
+  transfer_function_menu->clear();
+  segments_group = new QActionGroup(this);
+  segments_group->setExclusive(false);
+  QAction *load_action = transfer_function_menu->addAction("&Load...");
+  QObject::connect(load_action, SIGNAL(triggered()), this,
+                   SLOT(loadJSONdata()));
+  QAction *default_action = transfer_function_menu->addAction("&Default");
+  QObject::connect(default_action, SIGNAL(triggered()), this,
+                   SLOT(resetTransferFunction()));
+  transfer_function_menu->addSeparator();
+  const std::vector<TransferFunction::Segment> &segments =
+      gl_widget->getTransferFunction()->getSegments();
+  for (size_t index = 0; index < segments.size(); index++) {
+    QAction *segment_action =
+        transfer_function_menu->addAction(segments[index].name.c_str());
+    segment_action->setCheckable(true);
+    segment_action->setChecked(segments[index].visible);
+    segment_action->setData((int)index);
+    segments_group->addAction(segment_action);
+  }
+  QObject::connect(segments_group, SIGNAL(triggered(QAction *)), this,
+                   SLOT(onSegmentToggled(QAction *)));
+}
+
+void DicomViewer::updateSegmentActions() {
+  const std::vector<TransferFunction::Segment> &segments =
+      gl_widget->getTransferFunction()->getSegments();
+  for (QAction *segment_action : segments_group->actions()) {
+    size_t index = segment_action->data().toInt();
+    if (index < segments.size())
+      segment_action->setChecked(segments[index].visible);
+  }
+}
+
+void DicomViewer::colorizeImage(QImage *img) {
+  std::shared_ptr<const VolumicData> volume =
+      volume_manager.getVolume(active_series);
+  int layer = slice_slider->value() - min_instance;
+  if (!volume || volume->width != img->width() ||
+      volume->height != img->height() || layer < 0 || layer >= volume->depth)
+    return;
+  // Pixels of visible segments are blended with the color of their segment
+  std::shared_ptr<const TransferFunction> transfer_function =
+      gl_widget->getTransferFunction();
+  const std::vector<uint8_t> &segments = *transfer_function->getTable();
+  std::shared_ptr<const VolumeSlab> slab = volume->getSlab(layer);
+  const uint16_t *values = slab->getLayer(layer);
+  *img = img->convertToFormat(QImage::Format_RGB32);
+  for (int row = 0; row < img->height(); row++) {
+    QRgb *pixels = (QRgb *)img->scanLine(row);
+    for (int col = 0; col < img->width(); col++) {
+      int segment = segments[values[row * volume->width + col]];
+      if (!transfer_function->isVisible(segment))
+        continue;
+      QVector3D color = transfer_function->getColor(segment, 0);
+      double ratio = 0.5 * transfer_function->getOpacity(segment);
+      int gray = qRed(pixels[col]);
+      pixels[col] = qRgb(gray + (color.x() * 255 - gray) * ratio,
+                         gray + (color.y() * 255 - gray) * ratio,
+                         gray + (color.z() * 255 - gray) * ratio);
+    }
+  }
+}
+
+void DicomViewer::onVoxelPicked(const GLWidget::PickResult &result) {
+  probe = result;
+  std::ostringstream msg_oss;
+  msg_oss << "Voxel (" << result.voxel[0] << ", " << result.voxel[1] << ", "
+          << result.voxel[2] << "), position (" << result.position.x()
+          << ", " << result.position.y() << ", " << result.position.z()
+          << ") [mm], value " << result.value;
+  std::shared_ptr<const TransferFunction> transfer_function =
+      gl_widget->getTransferFunction();
+  int segment_idx = result.segment - TransferFunction::first_segment;
+  if (segment_idx >= 0 &&
+      segment_idx < (int)transfer_function->getSegments().size())
+    msg_oss << ", segment "
+            << transfer_function->getSegments()[segment_idx].name;
+  statusBar()->showMessage(msg_oss.str().c_str());
+  // Moving to the slice updates the 2D view, otherwise it is updated here
+  int instance = result.voxel[2] + min_instance;
+  if (instance != slice_slider->value())
+    slice_slider->setValue(instance);
+  else if (image)
+    updateImage();
+}
+
+void DicomViewer::drawProbe(QImage *img) {
+  int layer = slice_slider->value() - min_instance;
+  if (!probe.hit || probe.voxel[2] != layer || probe.voxel[0] >= img->width() ||
+      probe.voxel[1] >= img->height())
+    return;
+  if (img->format() != QImage::Format_RGB32)
+    *img = img->convertToFormat(QImage::Format_RGB32);
+  const int radius = 5;
+  QRgb color = qRgb(255, 0, 0);
+  for (int i = -radius; i <= radius; i++) {
+    int col = probe.voxel[0] + i;
+    int row = probe.voxel[1] + i;
+    if (col >= 0 && col < img->width())
+      img->setPixel(col, probe.voxel[1], color);
+    if (row >= 0 && row < img->height())
+      img->setPixel(probe.voxel[0], row, color);
+  }
 }
 
 double DicomViewer::getSlope() {
-  return getField<double>(getDataset(), DcmTagKey(0x28, 0x1053));
+  const DicomSliceInfo *info = getSliceInfo();
+  return info ? info->slope : 1;
 }
 
 double DicomViewer::getIntercept() {
-  return getField<double>(getDataset(), DcmTagKey(0x28, 0x1052));
+  const DicomSliceInfo *info = getSliceInfo();
+  return info ? info->intercept : 0;
 }
 
 double DicomViewer::getWindowCenter() {
-  return getField<double>(getDataset(), DcmTagKey(0x28, 0x1050));
+  const DicomSliceInfo *info = getSliceInfo();
+  return info ? info->window_center : 0;
 }
 
 double DicomViewer::getWindowWidth() {
-  return getField<double>(getDataset(), DcmTagKey(0x28, 0x1051));
+  const DicomSliceInfo *info = getSliceInfo();
+  return info ? info->window_width : 1;
 }
 
 double DicomViewer::getWindowMin() {
@@ -568,43 +1379,3 @@ int DicomViewer::getInstanceNumber(DcmDataset *dataset) {
 int DicomViewer::getAcquisitionNumber(DcmDataset *dataset) {
   return getField<int>(dataset, 0x20, 0x12);
 }
-
-template <>
-double getField<double>(DcmItem *item, const DcmTagKey &tag_key,
-                        unsigned long pos) {
-  double value;
-  OFCondition status = item->findAndGetFloat64(tag_key, value, pos);
-  if (status.bad())
-    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
-              << std::endl;
-  return value;
-}
-template <>
-short int getField<short int>(DcmItem *item, const DcmTagKey &tag_key,
-                              unsigned long pos) {
-  short int value;
-  OFCondition status = item->findAndGetSint16(tag_key, value, pos);
-  if (status.bad())
-    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
-              << std::endl;
-  return value;
-}
-template <>
-int getField<int>(DcmItem *item, const DcmTagKey &tag_key, unsigned long pos) {
-  int value;
-  OFCondition status = item->findAndGetSint32(tag_key, value, pos);
-  if (status.bad())
-    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
-              << std::endl;
-  return value;
-}
-template <>
-std::string getField<std::string>(DcmItem *item, const DcmTagKey &tag_key,
-                                  unsigned long pos) {
-  OFString value;
-  OFCondition status = item->findAndGetOFStringArray(tag_key, value, pos);
-  if (status.bad())
-    std::cerr << "Error on tag: " << tag_key << " -> " << status.text()
-              << std::endl;
-  return value.c_str();
-}
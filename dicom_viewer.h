@@ -1,8 +1,10 @@
 #ifndef DICOM_VIEWER_H
 #define DICOM_VIEWER_H
 
+#include <QActionGroup>
 #include <QGridLayout>
 #include <QMainWindow>
+#include <QMenu>
 
 #include <map>
 #include <memory>
@@ -16,6 +18,13 @@
 #include "image_label.h"
 #include "int_slider.h"
 #include "checkbox.h"
+#include "crop_dialog.h"
+#include "dicom_scan.h"
+#include "dicom_fields.h"
+#include "dicom_slice_info.h"
+#include "slice_cache.h"
+#include "volume_histogram.h"
+#include "volume_manager.h"
 
 
 class DicomViewer : public QMainWindow {
@@ -26,17 +35,60 @@ public:
   ~DicomViewer();
   QSize sizeHint() const { return QSize(600, 400); }
 
+  /// Open the series of the given files, as if they were chosen by
+  /// openDicomCollection. Return false if a file or a series is invalid.
+  bool openDicomFiles(const std::vector<std::string> &paths);
+
+  /// The volume of the active series, nullptr if none is loaded
+  std::shared_ptr<const VolumicData> getActiveVolume();
+
+  /// When disabled, the errors met while opening and loading series are
+  /// printed on std::cerr instead of being shown in dialogs, so that the
+  /// viewer can be driven without display, see runLoadCheck
+  void setInteractive(bool enabled);
+
 public slots:
   void openDicomCollection();
+  /// Open all the series found in a directory tree
+  void openDicomDirectory();
   void showStats();
   void save();
+  void applyAutoWindow();
 
+  /// Enable the compression of the volumes built afterwards
+  void onCompressVolumesToggled(bool enabled);
+  /// Publish the volume and the display points to the local consumers, see
+  /// VolumeStreamPublisher
+  void onPublishStreamToggled(bool enabled);
   void onSliceChange(int new_slice);
   void onWindowCenterChange(double new_window_center);
   void onWindowWidthChange(double new_window_width);
 
+  void onSeriesSelected(QAction *action);
+  void closeActiveSeries();
+
+  void onFilterSelected(QAction *action);
+  void onResamplingSelected(QAction *action);
+  void chooseResamplingSpacing();
+
+  void showCropDialog();
+  void resetCropBox();
+  void onCropBoxChanged(const GLWidget::CropBox &crop_box);
+  void addClipPlane();
+  void clearClipPlanes();
+
   void on2dDisplayStateChange(int state);
+
+  /// Load a transfer function from a JSON file, see TransferFunction
+  void loadJSONdata();
+  void resetTransferFunction();
+  void onSegmentToggled(QAction *action);
+  /// Rebuild the entries of the transfer function menu
+  void updateTransferFunctionMenu();
+  void onColorModeChange(int state);
   void on3dDisplayStateChange(int state);
+  /// Show the voxel picked in the 3D view and move to its slice
+  void onVoxelPicked(const GLWidget::PickResult &result);
 
 private:
   QWidget *widget;
@@ -56,6 +108,8 @@ private:
 
   CheckBox *contours_mode;
   CheckBox *color_mode;
+  CheckBox *lighting_mode;
+  CheckBox *depth_sorting;
 
   /// The area in which the image is shown
   ImageLabel *img_label;
@@ -63,8 +117,9 @@ private:
   /// The container for display of volumic data
   GLWidget *gl_widget;
 
-  /// The files loaded by the DicomViewer, indexed by acquisition number
-  std::map<int, std::unique_ptr<DcmFileFormat>> active_files;
+  /// The properties of the slices loaded by the DicomViewer, indexed by
+  /// instance number
+  std::map<int, DicomSliceInfo> active_files;
 
   /// The lowest instance number among active files
   int min_instance;
@@ -72,7 +127,14 @@ private:
   int max_instance;
 
   /// The active Dicom image
-  DicomImage *image;
+  std::shared_ptr<DicomImage> image;
+
+  /// The decoded slices available for the 2D view
+  std::unique_ptr<SliceCache> slice_cache;
+
+  /// The slice shown before the last slice change, used to prefetch slices
+  /// in the scrolling direction
+  int last_slice;
 
   /// The 8-bits image to be shown on screen
   uchar *img_data;
@@ -94,9 +156,106 @@ private:
   /// Maximal value used among the whole collection
   double collection_max;
 
-  /// Retrieve access to the dataset of active slice
-  /// if dataset is not available return nullptr
-  DcmDataset *getDataset();
+  /// Histogram of the values of the whole collection, computed while building
+  /// the volumic data
+  std::shared_ptr<const VolumeHistogram> volume_histogram;
+
+  /// Maximal memory used to hold the volume [bytes], larger volumes are stored
+  /// out-of-core and paged in by slabs
+  size_t volume_memory_budget;
+
+  /// When enabled, volumes are stored compressed in memory, see
+  /// CompressedVolume
+  bool compress_volumes;
+  /// See setInteractive
+  bool interactive;
+
+  /// The series opened along with their volumes, the budget covers all the
+  /// volumes held
+  VolumeManager volume_manager;
+  /// Identifier of the series shown, -1 if there is none
+  int active_series;
+
+  QMenu *series_menu;
+  QActionGroup *series_group;
+
+  /// Interpolation used to resample the 3D view on cubic voxels, -1 if the
+  /// volume is not resampled, see Interpolation otherwise
+  int resampling_mode;
+  /// The size of the resampled voxels [mm], 0 to use the smallest spacing of
+  /// the volume
+  double resampling_spacing;
+
+  QMenu *transfer_function_menu;
+  /// The visibility toggles of the segments of the transfer function
+  QActionGroup *segments_group;
+
+  /// Send the transfer function to the 3D view and update the menu and the
+  /// 2D view accordingly. When only the visibility of the segments changed,
+  /// 'segments_changed' is false and the actions of the menu are updated in
+  /// place, otherwise the menu is rebuilt once control returns to the event
+  /// loop.
+  void setTransferFunction(
+      std::shared_ptr<const TransferFunction> transfer_function,
+      bool segments_changed = true);
+  /// Check the visibility toggles of the segments shown by the 3D view
+  void updateSegmentActions();
+  /// Blend the pixels of the active slice belonging to a segment with its
+  /// color, the volume of the series has to be built
+  void colorizeImage(QImage *img);
+
+  /// The last voxel picked in the 3D view, marked on the 2D view when its
+  /// slice is shown
+  GLWidget::PickResult probe;
+  /// Draw a cross on the probed pixel if it belongs to the active slice
+  void drawProbe(QImage *img);
+
+  /// Edits the crop box of the 3D view, kept between uses
+  CropDialog *crop_dialog;
+
+  /// Send resampling_mode and resampling_spacing to the 3D view
+  void updateResampling();
+
+  /// Show an error or a warning in a dialog, or print it if the viewer is
+  /// not interactive
+  void showError(const std::string &title, const std::string &message);
+  void showWarning(const std::string &title, const std::string &message);
+
+  /// Group the headers by series, check and add each series, then show the
+  /// last one. If 'skip_invalid' is false, no series is added if one of them
+  /// is invalid and false is returned. Otherwise the invalid series are
+  /// skipped and listed in a single message once all have been checked.
+  bool openSeries(const std::vector<DicomHeader> &headers, bool skip_invalid);
+
+  /// Check the headers of the files of a series and extract its properties.
+  /// Throws std::runtime_error if the series is inconsistent. Missing
+  /// instances don't prevent the series from being read, they are described
+  /// in 'warning' if provided.
+  std::unique_ptr<DicomSeries>
+  readSeries(const std::string &uid,
+             const std::vector<const DicomHeader *> &headers,
+             std::string *warning = nullptr);
+
+  /// Show the series with the given identifier, -1 to show no series
+  void activateSeries(int id);
+
+  /// Rebuild the entries of the series menu
+  void updateSeriesMenu();
+
+  /// Retrieve the properties of the active slice
+  /// if the slice is not available return nullptr
+  const DicomSliceInfo *getSliceInfo();
+
+  /// Reload the file of the active slice
+  /// if the file is not available return nullptr
+  std::unique_ptr<DcmFileFormat> loadActiveFile();
+
+  /// Load a file without any user interaction, return nullptr on failure
+  static std::unique_ptr<DcmFileFormat> loadDicomFile(const std::string &path);
+
+  /// Load a file and retrieve its image, the image owns the loaded file
+  /// return nullptr on failure
+  static std::shared_ptr<DicomImage> decodeDicomFile(const std::string &path);
 
   /// Update min_instance and max_instance based on 'active_files'
   void updateInstanceLimits();
@@ -107,13 +266,21 @@ private:
   /// Adjust the size of the window based on file content
   void updateWindowSliders();
 
-  /// Load the DicomImage from the active slice
+  /// Load the DicomImage from the active slice using the slice cache
   /// If there are no active slice available, set image to nullptr
   void loadDicomImage();
 
-  /// Retrive the image from the given dataset
-  /// On failure, return nullptr and shows a messagebox
-  DicomImage *loadDicomImage(DcmDataset *dataset);
+  /// Retrieve the image from the given dataset without any user interaction,
+  /// so that it can be used from worker threads
+  /// On failure, return nullptr and fill 'status' if provided
+  static DicomImage *decodeDicomImage(DcmDataset *dataset,
+                                      OFCondition *status = nullptr);
+
+  /// Decode the pixels of a file in the representation expected by
+  /// VolumicData::setLayer, without any user interaction. Return false on
+  /// failure.
+  static bool decodeLayer(const std::string &path, int layer_size,
+                          uint16_t *values);
 
   /// Import the default parameters from the DicomImage
   void applyDefaultWindow();
@@ -121,10 +288,20 @@ private:
   /// Update the image based on current status of the object
   void updateImage();
 
-  /// Update the volumic_data element based on active_files
+  /// Show the volume of the active series in the 3D view, building it only if
+  /// the volume manager does not hold it anymore
   void updateVolumicData();
 
-  void loadJSONdata();
+  /// Build the volume of the active series from active_files
+  /// Layers are decoded in parallel and the histogram of the collection is
+  /// computed in the same pass. A preview made of every 4th layer at half
+  /// resolution is loaded first and shown in the 3D view while it grows.
+  /// On failure, return nullptr and shows a messagebox
+  std::shared_ptr<VolumicData> buildVolumicData();
+
+  /// Show in the status bar the number of points the window of the sliders
+  /// would display, estimated from the histogram
+  void showPointsEstimate();
 
   /// Retrieve patient name from active file
   /// return 'FAIL' if no active file is found
@@ -170,34 +347,4 @@ private:
   int getAcquisitionNumber(DcmDataset *dataset);
 };
 
-template <typename T>
-T getField(DcmItem *item, const DcmTagKey &tag_key, unsigned long pos = 0);
-template <typename T>
-T getField(DcmItem *item, unsigned int g, unsigned int e,
-           unsigned long pos = 0) {
-  return getField<T>(item, DcmTagKey(g, e), pos);
-}
-
-template <>
-double getField<double>(DcmItem *item, const DcmTagKey &tag_key,
-                        unsigned long pos);
-template <>
-short int getField<short int>(DcmItem *item, const DcmTagKey &tag_key,
-                              unsigned long pos);
-template <>
-int getField<int>(DcmItem *item, const DcmTagKey &tag_key, unsigned long pos);
-template <>
-std::string getField<std::string>(DcmItem *item, const DcmTagKey &tag_key,
-                                  unsigned long pos);
-
-template <typename T>
-std::vector<T> getFieldVector(DcmItem *item, const DcmTagKey &tag_key,
-                              int fixed_size) {
-  std::vector<T> result(fixed_size);
-  for (int i = 0; i < fixed_size; i++) {
-    result[i] = getField<T>(item, tag_key, i);
-  }
-  return result;
-}
-
 #endif // DICOM_VIEWER_H
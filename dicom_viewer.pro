@@ -32,7 +32,35 @@ SOURCES += \
         volumic_data.cpp \
         glwidget.cpp \
         int_slider.cpp \
-        checkbox.cpp
+        checkbox.cpp \
+        volume_histogram.cpp \
+        slab_cache.cpp \
+        slice_cache.cpp \
+        dicom_slice_info.cpp \
+        sparse_volume.cpp \
+        volume_filters.cpp \
+        volume_resampling.cpp \
+        normal_volume.cpp \
+        volume_manager.cpp \
+        phantom.cpp \
+        offscreen_renderer.cpp \
+        render_check.cpp \
+        crop_dialog.cpp \
+        memory_arena.cpp \
+        dicom_scan.cpp \
+        series_index.cpp \
+        transfer_function.cpp \
+        occupancy_grid.cpp \
+        compressed_volume.cpp \
+        task_graph.cpp \
+        point_benchmark.cpp \
+        point_renderer.cpp \
+        volume_stream.cpp \
+        series_generator.cpp \
+        load_check.cpp \
+        dicom_fields.cpp \
+        verbose.cpp \
+        stream_check.cpp
 
 HEADERS += \
         dicom_viewer.h \
@@ -41,11 +69,41 @@ HEADERS += \
         volumic_data.h \
         glwidget.h \
         int_slider.h \
-        checkbox.h
+        checkbox.h \
+        parallel.h \
+        volume_histogram.h \
+        slab_cache.h \
+        slice_cache.h \
+        dicom_slice_info.h \
+        sparse_volume.h \
+        volume_filters.h \
+        volume_resampling.h \
+        normal_volume.h \
+        volume_manager.h \
+        phantom.h \
+        offscreen_renderer.h \
+        render_check.h \
+        crop_dialog.h \
+        memory_arena.h \
+        dicom_scan.h \
+        series_index.h \
+        transfer_function.h \
+        occupancy_grid.h \
+        compressed_volume.h \
+        task_graph.h \
+        point_benchmark.h \
+        point_renderer.h \
+        volume_stream.h \
+        series_generator.h \
+        load_check.h \
+        dicom_fields.h \
+        verbose.h \
+        stream_check.h
 
 LIBS += \
         -ldcmdata \
         -ldcmimage \
         -ldcmimgle \
         -lofstd \
-        -ldcmjpeg
+        -ldcmjpeg \
+        -lrt
@@ -4,15 +4,43 @@
 #include <QtGui>
 
 #include "glwidget.h"
+#include "parallel.h"
+#include "verbose.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <numeric>
 
 #include <fstream>
 using namespace std;
 
+/// Number of values mapped to the window at once by applyWindow
+static const int window_block = 16;
+
+/// Map 'n' stored values to their position in the window, in [0;1]. Values
+/// are processed by blocks of fixed size in local arrays so that compilers
+/// vectorize the loop, 'window' must hold n rounded up to window_block values.
+static void applyWindow(const uint16_t *values, int n, float win_min, float win_scale, float *window)
+{
+	uint16_t block_values[window_block] = {};
+	float block_window[window_block];
+	for (int start = 0; start < n; start += window_block)
+	{
+		memcpy(block_values, values + start, std::min(window_block, n - start) * sizeof(uint16_t));
+		for (int i = 0; i < window_block; i++)
+			block_window[i] = std::min(std::max((block_values[i] - win_min) * win_scale, 0.f), 1.f);
+		memcpy(window + start, block_window, sizeof(block_window));
+	}
+}
+
 GLWidget::GLWidget(QWidget *parent)
 	: QOpenGLWidget(parent), alpha(0.05), log2_zoom(0),
-	  view_type(ViewType::ORTHO), hide_empty_points(true)
+	  view_type(ViewType::ORTHO), hide_empty_points(true),
+	  resampling_enabled(false), resampling_interpolation(Interpolation::TRILINEAR),
+	  resampling_spacing(0), volume_memory_budget((size_t)1 << 30),
+	  filter(VolumeFilter::NONE)
 {
 	QSizePolicy size_policy;
 	size_policy.setVerticalPolicy(QSizePolicy::MinimumExpanding);
@@ -23,9 +51,26 @@ GLWidget::GLWidget(QWidget *parent)
 	hide_below = false;
 	highlight = false;
   	color_mode = false;
+	lighting = false;
+	depth_sorting = false;
+	display_grid = {{0, 0, 0}, {1, 1, 1}};
+	transfer_function = TransferFunction::createDefault();
+	renderer_points_valid = false;
+	renderer_index_axis = -1;
+	renderer_shading_valid = false;
 }
 
-GLWidget::~GLWidget() {}
+GLWidget::~GLWidget()
+{
+	// The resources of the renderer are released in their context when it
+	// is the one of the widget, otherwise Qt releases them with the context
+	if (point_renderer && point_renderer->getContext() == context())
+	{
+		makeCurrent();
+		point_renderer.reset();
+		doneCurrent();
+	}
+}
 
 float GLWidget::getAlpha() const { return alpha; }
 
@@ -55,6 +100,13 @@ void GLWidget::onColorModeChange(int state)
 	update();
 }
 
+void GLWidget::onLightingModeChange(int state)
+{
+	lighting = state >= 1;
+	updateDisplayPoints();
+	update();
+}
+
 void GLWidget::highlightActiveLayer(int state){
   	if(state == 0)
   	{
@@ -87,17 +139,29 @@ void GLWidget::hideLayersAbove(int state){
 }
 
 void GLWidget::saveXYZ() {
+	if (!volumic_data)
+		return;
+	// Points are streamed to the file while visiting the volume, so that the
+	// export does not require to hold all the points in memory
 	ofstream MyFile("points.xyz");
-	for (const DrawablePoint &p : display_points)
-	{
-		MyFile << p.pos.x() << " " << p.pos.y() << " " << p.pos.z() << "\n";
-	}
+	visitDisplayPoints([&](const DrawablePoint &p) {
+		if (transfer_function->isVisible(p.segment))
+			MyFile << p.pos.x() << " " << p.pos.y() << " " << p.pos.z() << "\n";
+	});
 	MyFile.close();
 }
 
 void GLWidget::updateVolumicData(std::unique_ptr<VolumicData> new_data)
 {
+	// The sparse volume may read the values of its source, it is dropped
+	// before the source
+	occupancy_grid.reset();
+	sparse_volume.reset();
+	normal_volume.reset();
+	resampled_data.reset();
+	filtered_data.reset();
 	volumic_data = std::move(new_data);
+	publishVolumicData();
 	updateDisplayPoints();
 	update();
 }
@@ -105,127 +169,746 @@ void GLWidget::updateVolumicData(std::unique_ptr<VolumicData> new_data)
 void GLWidget::updateDisplayPoints()
 {
 	display_points.clear();
+	segment_offsets.assign(2, 0);
+	for (SliceIndex &index : slice_indices)
+		index.valid = false;
+	renderer_points_valid = false;
+	renderer_index_axis = -1;
 	if (!volumic_data)
+	{
+		display_points.trim();
+		return;
+	}
+	prepareDisplayPoints();
+	int layer_start, layer_end;
+	getLayerRange(&layer_start, &layer_end);
+	int nb_layers = std::max(layer_end - layer_start, 0);
+	int nb_segments = getNbSegments();
+
+	// Upper bound of the points of each segment in each layer, so that each
+	// thread knows where to write the points of its layers. Points are
+	// grouped by segment, then by layer.
+	std::vector<size_t> offsets((size_t)nb_segments * nb_layers + 1, 0);
+	parallelFor(layer_start, layer_end, [&](int, int begin, int end) {
+		std::vector<size_t> counts(nb_segments);
+		for (int depth = begin; depth < end; depth++)
+		{
+			std::fill(counts.begin(), counts.end(), 0);
+			countLayerCandidates(depth, counts.data());
+			for (int segment = 0; segment < nb_segments; segment++)
+				offsets[(size_t)segment * nb_layers + depth - layer_start + 1] = counts[segment];
+		}
+	});
+	// The display set is bounded by the memory budget: beyond it, only one
+	// candidate out of keep_step is kept in each layer of each segment
+	size_t nb_candidates = std::accumulate(offsets.begin(), offsets.end(), (size_t)0);
+	size_t max_points = std::max<size_t>(volume_memory_budget / sizeof(DrawablePoint), 1);
+	size_t keep_step = std::max<size_t>((nb_candidates + max_points - 1) / max_points, 1);
+	if (keep_step > 1)
+		for (size_t &count : offsets)
+			count = (count + keep_step - 1) / keep_step;
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	display_points.resize(offsets.back());
+
+	// Threads fill disjoint ranges of the buffer for each segment, then the
+	// ranges are packed
+	int nb_threads = getNbThreads();
+	std::vector<size_t> range_starts((size_t)nb_threads * nb_segments, 0);
+	std::vector<size_t> range_sizes((size_t)nb_threads * nb_segments, 0);
+	parallelFor(layer_start, layer_end, [&](int thread_idx, int begin, int end) {
+		size_t *starts = &range_starts[(size_t)thread_idx * nb_segments];
+		size_t *sizes = &range_sizes[(size_t)thread_idx * nb_segments];
+		for (int segment = 0; segment < nb_segments; segment++)
+			starts[segment] = offsets[(size_t)segment * nb_layers + begin - layer_start];
+		DrawablePoint *out = display_points.data();
+		if (keep_step == 1)
+		{
+			visitLayerPoints(begin, end, [&](const DrawablePoint &p) {
+				out[starts[p.segment] + sizes[p.segment]++] = p;
+			});
+			return;
+		}
+		std::vector<size_t> skipped(nb_segments);
+		for (int depth = begin; depth < end; depth++)
+		{
+			std::fill(skipped.begin(), skipped.end(), keep_step - 1);
+			visitLayerPoints(depth, depth + 1, [&](const DrawablePoint &p) {
+				if (++skipped[p.segment] < keep_step)
+					return;
+				skipped[p.segment] = 0;
+				out[starts[p.segment] + sizes[p.segment]++] = p;
+			});
+		}
+	}, nb_threads);
+	size_t nb_points = 0;
+	segment_offsets.assign(nb_segments + 1, 0);
+	for (int segment = 0; segment < nb_segments; segment++)
+	{
+		segment_offsets[segment] = nb_points;
+		for (int thread_idx = 0; thread_idx < nb_threads; thread_idx++)
+		{
+			size_t range = (size_t)thread_idx * nb_segments + segment;
+			if (range_sizes[range] > 0 && range_starts[range] != nb_points)
+				memmove(display_points.data() + nb_points, display_points.data() + range_starts[range],
+					range_sizes[range] * sizeof(DrawablePoint));
+			nb_points += range_sizes[range];
+		}
+	}
+	segment_offsets[nb_segments] = nb_points;
+	display_points.resize(nb_points);
+	display_points.trim();
+	if (isVerbose())
+		std::cout << "Nb points: " << display_points.size() << " ("
+			<< display_points.getMemoryUsed() / 1024 << " kB), 1 candidate out of "
+			<< keep_step << " kept" << std::endl;
+	publishDisplayPoints();
+}
+
+void GLWidget::publishVolumicData()
+{
+	if (!stream_publisher || !volumic_data)
+		return;
+	try
+	{
+		stream_publisher->publishVolume(*volumic_data);
+	}
+	catch (const std::exception &error)
+	{
+		std::cerr << "Volume not published: " << error.what() << std::endl;
+	}
+}
+
+void GLWidget::publishDisplayPoints()
+{
+	if (!stream_publisher)
+		return;
+	// Points of hidden segments are skipped, the others are converted while
+	// they are written in the shared memory
+	int nb_segments = (int)segment_offsets.size() - 1;
+	size_t nb_points = 0;
+	for (int segment = 0; segment < nb_segments; segment++)
+		if (transfer_function->isVisible(segment))
+			nb_points += segment_offsets[segment + 1] - segment_offsets[segment];
+	volume_stream::FrameHeader *frame;
+	try
+	{
+		frame = stream_publisher->beginFrame(volume_stream::POINTS,
+			nb_points * sizeof(volume_stream::StreamPoint));
+	}
+	catch (const std::length_error &error)
+	{
+		std::cerr << "Points not published: " << error.what() << std::endl;
 		return;
-	int W = volumic_data->width;
-	int H = volumic_data->height;
-	int D = volumic_data->depth;
-	int col = 0;
-	int row = 0;
-	int depth = 0;
-	double x_factor = volumic_data->pixel_width;
-	double y_factor = volumic_data->pixel_height;
-	double z_factor = volumic_data->slice_spacing;
+	}
+	frame->count = nb_points;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		frame->sizes[axis] = display_grid.sizes[axis];
+		frame->spacing[axis] = display_grid.factors[axis];
+	}
+	getWinMinMax(&frame->win_min, &frame->win_max);
+	frame->intercept = volumic_data ? volumic_data->intercept : 0;
+	volume_stream::StreamPoint *out = (volume_stream::StreamPoint *)(frame + 1);
+	for (int segment = 0; segment < nb_segments; segment++)
+	{
+		if (!transfer_function->isVisible(segment))
+			continue;
+		float opacity = transfer_function->getOpacity(segment);
+		for (size_t idx = segment_offsets[segment]; idx < segment_offsets[segment + 1]; idx++)
+		{
+			const DrawablePoint &p = display_points[idx];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				out->position[axis] = p.pos[axis];
+				out->color[axis] = p.color[axis];
+			}
+			out->opacity = p.a * opacity;
+			out->normal = p.normal;
+			out->segment = p.segment;
+			out->reserved = 0;
+			out++;
+		}
+	}
+	stream_publisher->endFrame();
+}
+
+int GLWidget::getNbSegments() const
+{
+	if (!color_mode)
+		return TransferFunction::window_segment + 1;
+	return TransferFunction::first_segment + transfer_function->getSegments().size();
+}
+
+void GLWidget::countLayerCandidates(int depth, size_t *counts)
+{
+	int row_start, row_end, col_start, col_end;
+	getCropRange(1, display_grid.sizes[1], &row_start, &row_end);
+	getCropRange(0, display_grid.sizes[0], &col_start, &col_end);
+	const SparseVolume::Layer &layer = sparse_volume->getLayer(depth);
+	for (int row = row_start; row < row_end; row++)
+	{
+		for (uint32_t run_idx = layer.row_offsets[row]; run_idx < layer.row_offsets[row + 1]; run_idx++)
+		{
+			const SparseVolume::Run &run = layer.runs[run_idx];
+			int first = std::max(col_start, (int)run.col);
+			int last = std::min(col_end, run.col + run.length);
+			counts[run.segment] += std::max(last - first, 0);
+		}
+	}
+}
+
+template <typename Consumer>
+void GLWidget::visitDisplayPoints(Consumer &&consumer)
+{
+	prepareDisplayPoints();
+	int layer_start, layer_end;
+	getLayerRange(&layer_start, &layer_end);
+	visitLayerPoints(layer_start, layer_end, consumer);
+}
+
+void GLWidget::prepareDisplayPoints()
+{
+	// Dimensions and spacing are taken from the source which may have been
+	// resampled
+	VolumicData *source = getSourceVolume();
+	int W = source->width;
+	int H = source->height;
+	int D = source->depth;
+	double x_factor = source->pixel_width;
+	double y_factor = source->pixel_height;
+	double z_factor = source->slice_spacing;
 	double max_size =
 		std::max(std::max(x_factor * W, y_factor * H), z_factor * D);
 	double global_factor = 2.0 / max_size;
 	x_factor *= global_factor;
 	y_factor *= global_factor;
 	z_factor *= global_factor;
-	int idx_start = 0;
-	int idx_end = W * H * D;
-	if(!hide_below && !hide_above)
+	display_grid = {{W, H, D}, {x_factor, y_factor, z_factor}};
+	getSparseVolume();
+	// Normals are only computed if they are used
+	if (lighting)
+		getNormalVolume();
+}
+
+template <typename Consumer>
+void GLWidget::visitLayerPoints(int layer_start, int layer_end, Consumer &&consumer)
+{
+	int W = display_grid.sizes[0];
+	int H = display_grid.sizes[1];
+	int D = display_grid.sizes[2];
+	double x_factor = display_grid.factors[0];
+	double y_factor = display_grid.factors[1];
+	double z_factor = display_grid.factors[2];
+	int active_start, active_end;
+	getSliceLayers(curr_slice - 1, &active_start, &active_end);
+	int mode = color_mode ? 0 : 2;
+	// The crop box restricts the rows and columns visited, the layers are
+	// already restricted by getLayerRange
+	int row_start, row_end, col_start, col_end;
+	getCropRange(1, H, &row_start, &row_end);
+	getCropRange(0, W, &col_start, &col_end);
+
+	NormalVolume *normals = lighting ? normal_volume.get() : nullptr;
+	std::shared_ptr<const VolumeSlab> normal_slab;
+	const uint16_t *layer_normals = nullptr;
+	// Holds the values of the layer when they are read from the volume
+	std::shared_ptr<const VolumeSlab> value_slab;
+
+	// Invariants of the loops are computed once: the x coordinate of each
+	// column and the mapping of the stored values to the window. Stored values
+	// are integers, a voxel is then shown if its value is at least
+	// min_visible_value, which is exactly the condition c > 0.
+	std::vector<float> x_positions(W);
+	for (int col = 0; col < W; col++)
+		x_positions[col] = (col - W / 2.) * x_factor;
+	const double win_min = volumic_data->win_min;
+	const float win_scale = 1 / (volumic_data->win_max - win_min);
+	const int min_visible_value = hide_empty_points ? (int)std::min(std::max(std::floor(win_min) + 1, 0.), 65536.) : 0;
+	// Window positions of the voxels of a run
+	std::vector<float> run_window(W + window_block);
+
+	// Only the segmented voxels are visited
+	const SparseVolume &sparse = *sparse_volume;
+	// In contours mode, the segments of the 3x3 rows surrounding the active
+	// row are expanded, rows outside of the volume are nullptr
+	std::vector<uint8_t> neighborhood(contours_mode ? 9 * W : 0);
+	const uint8_t *neighbor_rows[9];
+	for (int depth = layer_start; depth < layer_end; depth++)
 	{
-		idx_start = 0;
-		idx_end = W * H * D;
+		const SparseVolume::Layer &layer = sparse.getLayer(depth);
+		if (layer.runs.empty())
+			continue;
+		const uint16_t *layer_values = sparse.getLayerValues(depth, &value_slab);
+		if (normals)
+		{
+			if (!normal_slab || !normal_slab->contains(depth))
+				normal_slab = normals->getSlab(depth);
+			layer_normals = normal_slab->getLayer(depth);
+		}
+		double z = (depth - D / 2.) * z_factor;
+		double layer_alpha = highlight && depth >= active_start && depth < active_end ? 1.0 : alpha;
+		for (int row = row_start; row < row_end; row++)
+		{
+			uint32_t runs_start = layer.row_offsets[row];
+			uint32_t runs_end = layer.row_offsets[row + 1];
+			if (runs_start == runs_end)
+				continue;
+			// Columns of the row inside the crop box and the clip planes
+			double y = (row - H / 2.) * y_factor;
+			int row_col_start = col_start;
+			int row_col_end = col_end;
+			for (const QVector4D &plane : clip_planes)
+				clipColumns(plane, y, z, W, x_factor, &row_col_start, &row_col_end);
+			if (row_col_start >= row_col_end)
+				continue;
+			if (contours_mode)
+			{
+				for (int i = 0; i < 9; i++)
+				{
+					int neighbor_layer = depth + i / 3 - 1;
+					int neighbor_row = row + i % 3 - 1;
+					neighbor_rows[i] = nullptr;
+					if (neighbor_layer < 0 || neighbor_row < 0 || neighbor_layer >= D || neighbor_row >= H)
+						continue;
+					sparse.getRowSegments(neighbor_row, neighbor_layer, &neighborhood[i * W]);
+					neighbor_rows[i] = &neighborhood[i * W];
+				}
+			}
+			const uint16_t *row_normals = layer_normals ? layer_normals + (size_t)row * W : nullptr;
+			for (uint32_t run_idx = runs_start; run_idx < runs_end; run_idx++)
+			{
+				const SparseVolume::Run &run = layer.runs[run_idx];
+				int segment = run.segment;
+				int first = std::max(row_col_start - run.col, 0);
+				int last = std::min(row_col_end - run.col, (int)run.length);
+				if (first >= last)
+					continue;
+				// The window is applied to the whole run first, in a pass without
+				// branches
+				const uint16_t *values = layer_values + run.first_value;
+				float *window = run_window.data();
+				applyWindow(values + first, last - first, win_min, win_scale, window);
+				// Only the window segment has a color depending on the value
+				bool gray = segment == TransferFunction::window_segment;
+				QVector3D run_color = transfer_function->getColor(segment, 0);
+				DrawablePoint p;
+				p.a = layer_alpha;
+				p.segment = segment;
+				p.pos.setY(y);
+				p.pos.setZ(z);
+				for (int i = first; i < last; i++)
+				{
+					if (values[i] < min_visible_value)
+						continue;
+					int col = run.col + i;
+					if (contours_mode && !connectivity(mode, col, neighbor_rows, segment))
+						continue;
+					float c = window[i - first];
+					p.color = gray ? QVector3D(c, c, c) : run_color;
+					p.normal = row_normals ? row_normals[col] : NormalVolume::no_normal;
+					p.pos.setX(x_positions[col]);
+					consumer(p);
+				}
+			}
+		}
 	}
-	else if(hide_below && !hide_above)
+}
+
+size_t GLWidget::countDisplayPoints(double *checksum)
+{
+	size_t nb_points = 0;
+	double sum = 0;
+	if (volumic_data)
+		visitDisplayPoints([&](const DrawablePoint &p) {
+			nb_points++;
+			sum += p.pos.x() + p.color.x() + p.a;
+		});
+	*checksum = sum;
+	return nb_points;
+}
+
+void GLWidget::getCropRange(int axis, int size, int *start, int *end) const
+{
+	*start = std::max((int)std::floor(crop_box.min[axis] * size), 0);
+	*end = std::min((int)std::ceil(crop_box.max[axis] * size), size);
+}
+
+void GLWidget::clipColumns(const QVector4D &plane, double y, double z, int W, double x_factor, int *col_start, int *col_end)
+{
+	// A point of column col is kept if a * (col - W/2) * x_factor + offset >= 0
+	double offset = plane.y() * y + plane.z() * z + plane.w();
+	double a = plane.x() * x_factor;
+	if (a == 0)
 	{
-		idx_start = W * H * (curr_slice-1);
-		idx_end = W * H * D;
+		if (offset < 0)
+			*col_end = *col_start;
+		return;
 	}
-	else if(!hide_below && hide_above)
+	// Clamped so that nearly parallel planes do not overflow the conversion
+	double limit = std::min(std::max(W / 2. - offset / a, -1.), W + 1.);
+	if (a > 0)
+		*col_start = std::max(*col_start, (int)std::ceil(limit));
+	else
+		*col_end = std::min(*col_end, (int)std::floor(limit) + 1);
+}
+
+void GLWidget::setCropBox(const CropBox &new_crop_box)
+{
+	crop_box = new_crop_box;
+	updateDisplayPoints();
+	update();
+}
+
+void GLWidget::addClipPlaneFromView()
+{
+	// The plane goes through the center of the volume, facing the viewer
+	QVector3D toward_viewer = transform.inverted().mapVector(QVector3D(0, 0, 1)).normalized();
+	if (clip_planes.size() >= max_clip_planes)
+		clip_planes.erase(clip_planes.begin());
+	clip_planes.push_back(QVector4D(-toward_viewer.x(), -toward_viewer.y(), -toward_viewer.z(), 0));
+	updateDisplayPoints();
+	update();
+}
+
+void GLWidget::clearClipPlanes()
+{
+	clip_planes.clear();
+	updateDisplayPoints();
+	update();
+}
+
+void GLWidget::setFilter(VolumeFilter new_filter)
+{
+	filter = new_filter;
+	updateDisplayPoints();
+	update();
+}
+
+void GLWidget::setResampling(bool enabled, Interpolation interpolation, double spacing)
+{
+	resampling_enabled = enabled;
+	resampling_interpolation = interpolation;
+	resampling_spacing = spacing;
+	updateDisplayPoints();
+	update();
+}
+
+void GLWidget::setVolumeMemoryBudget(size_t budget)
+{
+	volume_memory_budget = budget;
+}
+
+VolumicData *GLWidget::getSourceVolume()
+{
+	VolumicData *source = volumic_data.get();
+	if (resampling_enabled)
 	{
-		idx_start = 0;
-		idx_end = W * H * (curr_slice);
+		if (!resampled_data || resampled_data_interpolation != resampling_interpolation
+			|| resampled_data_spacing != resampling_spacing)
+		{
+			// Volumes computed from the previous one are outdated
+			filtered_data.reset();
+			sparse_volume.reset();
+			normal_volume.reset();
+			resampled_data = resampleVolume(*volumic_data, resampling_spacing, resampling_interpolation,
+				volume_memory_budget);
+			resampled_data_interpolation = resampling_interpolation;
+			resampled_data_spacing = resampling_spacing;
+			if (isVerbose())
+				std::cout << "Resampled volume: " << resampled_data->width << "x"
+					<< resampled_data->height << "x" << resampled_data->depth << std::endl;
+		}
+		source = resampled_data.get();
 	}
-	else if(hide_above && hide_below)
+	if (filter == VolumeFilter::NONE)
+		return source;
+	// The filtered volume is kept until the filter or its source change
+	if (!filtered_data || filtered_data_filter != filter || filtered_data_source != source)
 	{
-		idx_start = W * H * (curr_slice-1);
-		idx_end = W * H * (curr_slice);
+		sparse_volume.reset();
+		normal_volume.reset();
+		filtered_data = applyFilter(*source, filter);
+		filtered_data_filter = filter;
+		filtered_data_source = source;
 	}
+	return filtered_data.get();
+}
 
-	idx_end = std::min(idx_end, W*H*D);
-	int range = idx_end - idx_start;
-	if(range <= 0)
-		return;
-	display_points.reserve(range);
+NormalVolume &GLWidget::getNormalVolume()
+{
+	VolumicData *source = getSourceVolume();
+	if (normal_volume && normal_source == source)
+		return *normal_volume;
+	normal_volume.reset(new NormalVolume(*source));
+	normal_source = source;
+	if (isVerbose())
+		std::cout << "Normals: " << normal_volume->getMemoryUsed() / 1024 << " kB" << std::endl;
+	return *normal_volume;
+}
 
+const SparseVolume &GLWidget::getSparseVolume()
+{
 	double cur_win_min;
 	double cur_win_max;
 	getWinMinMax(&cur_win_min, &cur_win_max);
+	VolumicData *source = getSourceVolume();
+	if (sparse_volume && sparse_source == source && sparse_win_min == cur_win_min && sparse_win_max == cur_win_max
+		&& sparse_color_mode == color_mode && (!color_mode || sparse_table == transfer_function->getTable()))
+		return *sparse_volume;
+	sparse_table = getSegmentTable(cur_win_min, cur_win_max);
+	occupancy_grid.reset();
+	sparse_volume.reset(new SparseVolume(*source, *sparse_table));
+	sparse_source = source;
+	sparse_win_min = cur_win_min;
+	sparse_win_max = cur_win_max;
+	sparse_color_mode = color_mode;
+	if (isVerbose())
+		std::cout << "Sparse voxels: " << sparse_volume->getNbVoxels() << " ("
+			<< sparse_volume->getMemoryUsed() / 1024 << " kB)" << std::endl;
+	return *sparse_volume;
+}
 
-	// Importing points
-	for (int idx = idx_start; idx < idx_end; idx++)
+void GLWidget::initializeGL()
+{
+	try
+	{
+		initializeScene();
+	}
+	catch (const std::runtime_error &error)
 	{
-		double raw_color = volumic_data->data[idx];
-		double c = volumic_data->manualWindowHandling(raw_color); // c [0;1]
+		QMessageBox::critical(this, "Failed to initialize the 3D view", error.what());
+	}
+}
 
-		if (c > 0 || !hide_empty_points)
-		{
-			int segment = volumic_data->threshold(raw_color, cur_win_min, cur_win_max, color_mode);
+void GLWidget::initializeScene()
+{
+	// The widget and the offscreen renderer draw in different contexts
+	QOpenGLContext *context = QOpenGLContext::currentContext();
+	if (point_renderer && point_renderer->getContext() == context)
+		return;
+	PointRenderer::PointLayout layout;
+	layout.stride = sizeof(DrawablePoint);
+	layout.position = offsetof(DrawablePoint, pos);
+	layout.color = offsetof(DrawablePoint, color);
+	layout.alpha = offsetof(DrawablePoint, a);
+	layout.normal = offsetof(DrawablePoint, normal);
+	layout.segment = offsetof(DrawablePoint, segment);
+	point_renderer.reset();
+	point_renderer.reset(new PointRenderer(layout));
+	renderer_points_valid = false;
+	renderer_index_axis = -1;
+	renderer_shading_valid = false;
+}
 
-			if (segment != 0)
-			{
-				if (!contours_mode || (contours_mode && connectivity(color_mode ? 0 : 2, idx, segment, cur_win_min, cur_win_max)))
-				{
-					DrawablePoint p;
-					p.a = alpha;
-					if(highlight){
-      					if(idx>=(curr_slice-1)*W*H && idx<(curr_slice)*W*H)
-            				p.a = 1.0;   
-    				}
-					p.color = volumic_data->getColorSegment(segment, c);
-
-					p.pos = QVector3D((col - W / 2.) * x_factor, (row - H / 2.) * y_factor, (depth - D / 2.) * z_factor);
-					display_points.push_back(p);
-				}
-			}
-		}
-		col++;
-		if (col == W)
+void GLWidget::paintGL()
+{
+	QSize viewport_size = size();
+	renderScene(viewport_size.width(), viewport_size.height());
+}
+
+void GLWidget::renderScene(int width, int height)
+{
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if (!point_renderer)
+		return;
+	if (!renderer_points_valid)
+	{
+		point_renderer->setPoints(display_points.data(), display_points.size());
+		renderer_points_valid = true;
+	}
+
+	// Shading of each normal code, the light is placed at the viewer position
+	if (lighting)
+	{
+		QVector3D light = transform.inverted().mapVector(QVector3D(0, 0, 1));
+		if (!renderer_shading_valid || light != renderer_shading_light)
 		{
-			row++;
-			col = 0;
+			std::vector<float> diffuse, specular;
+			getShading(light, &diffuse, &specular);
+			point_renderer->setShading(diffuse, specular);
+			renderer_shading_light = light;
+			renderer_shading_valid = true;
 		}
-		if (row == H)
+	}
+
+	// Visibility, color and opacity of the segments are read from the
+	// transfer function when drawing, so changing them does not require to
+	// build the points again
+	int nb_segments = (int)segment_offsets.size() - 1;
+	std::vector<char> visible(256, false);
+	std::vector<QVector3D> colors(256);
+	std::vector<float> opacities(256, 1);
+	for (int segment = 0; segment < nb_segments; segment++)
+	{
+		visible[segment] = transfer_function->isVisible(segment);
+		colors[segment] = transfer_function->getColor(segment, 0);
+		opacities[segment] = transfer_function->getOpacity(segment);
+	}
+	point_renderer->setSegments(colors, opacities, visible);
+
+	// Sprites cover the largest side of a voxel, their size in pixels is
+	// derived from the scale of the projection
+	PointRenderer::Frame frame;
+	frame.view_projection = getViewProjection(width, height);
+	frame.pixels_per_unit = frame.view_projection.row(0).toVector3D().length() * width / 2;
+	frame.point_size = *std::max_element(display_grid.factors, display_grid.factors + 3);
+	frame.alpha = alpha;
+	frame.highlight = highlight;
+	frame.lighting = lighting;
+	point_renderer->begin(frame);
+	if (!depth_sorting)
+	{
+		// Only the ranges of the visible segments are drawn
+		for (int segment = 0; segment < nb_segments; segment++)
+			if (visible[segment])
+				point_renderer->draw(segment_offsets[segment],
+					segment_offsets[segment + 1] - segment_offsets[segment]);
+	}
+	else
+	{
+		// Slices perpendicular to the axis closest to the view direction are
+		// drawn from the farthest to the nearest, points are already grouped
+		// by slice so no point is sorted
+		int axis;
+		std::vector<int> order;
+		getSliceOrder(&axis, &order);
+		const SliceIndex &index = getSliceIndex(axis);
+		if (renderer_index_axis != axis)
 		{
-			depth++;
-			row = 0;
+			point_renderer->setIndices(index.indices);
+			renderer_index_axis = axis;
 		}
+		for (int slice : order)
+			point_renderer->drawIndexed(index.offsets[slice], index.offsets[slice + 1] - index.offsets[slice]);
 	}
-	std::cout << "Nb points: " << display_points.size() << std::endl;
+	point_renderer->end();
 }
 
-void GLWidget::initializeGL()
+void GLWidget::onDepthSortingChange(int state)
 {
-	glEnable(GL_BLEND);
-	glDisable(GL_DEPTH_TEST);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDepthFunc(GL_NEVER);
+	depth_sorting = state >= 1;
+	update();
 }
 
-void GLWidget::paintGL()
+int GLWidget::getSlice(const DrawablePoint &p, int axis) const
 {
-	QSize viewport_size = size();
-	int width = viewport_size.width();
-	int height = viewport_size.height();
-	double aspect_ratio = width / (float)height;
-	glViewport(0, 0, width, height);
+	const float coordinates[3] = {p.pos.x(), p.pos.y(), p.pos.z()};
+	int slice = std::lround(coordinates[axis] / display_grid.factors[axis] + display_grid.sizes[axis] / 2.);
+	return std::min(std::max(slice, 0), display_grid.sizes[axis] - 1);
+}
+
+const GLWidget::SliceIndex &GLWidget::getSliceIndex(int axis)
+{
+	SliceIndex &index = slice_indices[axis];
+	if (index.valid)
+		return index;
+	// Counting sort of the points by slice
+	int nb_slices = std::max(display_grid.sizes[axis], 0);
+	std::vector<uint32_t> slices(display_points.size());
+	index.offsets.assign(nb_slices + 1, 0);
+	for (size_t i = 0; i < display_points.size(); i++)
+	{
+		slices[i] = getSlice(display_points[i], axis);
+		index.offsets[slices[i] + 1]++;
+	}
+	for (int slice = 0; slice < nb_slices; slice++)
+		index.offsets[slice + 1] += index.offsets[slice];
+	index.indices.resize(display_points.size());
+	std::vector<uint32_t> next(index.offsets.begin(), index.offsets.end() - 1);
+	for (size_t i = 0; i < display_points.size(); i++)
+		index.indices[next[slices[i]]++] = i;
+	index.valid = true;
+	return index;
+}
 
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
+void GLWidget::getSliceOrder(int *axis, std::vector<int> *order)
+{
+	// Position of the viewer in the coordinates of the points, at infinity in
+	// the direction 'toward_viewer' for orthographic views
+	bool perspective = view_type == ViewType::FRUSTUM;
+	QVector3D viewer;
+	if (perspective)
+	{
+		QMatrix4x4 cam_offset;
+		cam_offset.translate(0, 0, -2 * (1 - log2_zoom));
+		viewer = (cam_offset * transform).inverted().map(QVector3D(0, 0, 0));
+	}
+	else
+		viewer = transform.inverted().mapVector(QVector3D(0, 0, 1));
+	*axis = 0;
+	for (int i = 1; i < 3; i++)
+		if (std::fabs(viewer[i]) > std::fabs(viewer[*axis]))
+			*axis = i;
+	int nb_slices = std::max(display_grid.sizes[*axis], 0);
+	order->resize(nb_slices);
+	for (int slice = 0; slice < nb_slices; slice++)
+		(*order)[slice] = slice;
+	if (!perspective)
+	{
+		// Slices with the lowest coordinates are the farthest if the viewer
+		// is on the positive side
+		if (viewer[*axis] < 0)
+			std::reverse(order->begin(), order->end());
+		return;
+	}
+	double factor = display_grid.factors[*axis];
+	double half_size = display_grid.sizes[*axis] / 2.;
+	double viewer_coordinate = viewer[*axis];
+	std::sort(order->begin(), order->end(), [&](int a, int b)
+	{
+		return std::fabs((a - half_size) * factor - viewer_coordinate)
+			> std::fabs((b - half_size) * factor - viewer_coordinate);
+	});
+}
+
+void GLWidget::getShading(const QVector3D &light, std::vector<float> *diffuse, std::vector<float> *specular)
+{
+	// Normals are decoded once for all
+	static std::vector<QVector3D> decoded_normals;
+	if (decoded_normals.empty())
+	{
+		decoded_normals.resize(1 << 16);
+		for (int code = 0; code < (1 << 16); code++)
+			decoded_normals[code] = NormalVolume::decode(code);
+	}
+	const float ambient = 0.3f;
+	const float diffuse_ratio = 0.7f;
+	const float specular_ratio = 0.3f;
+	const int shininess = 16;
+	QVector3D l = light.normalized();
+	diffuse->resize(1 << 16);
+	specular->resize(1 << 16);
+	for (int code = 0; code < (1 << 16); code++)
+	{
+		// The orientation of the normal is unknown: both sides are lit. As the
+		// light is placed at the viewer, the cosine between the reflected light
+		// and the view direction is 2 * cos(n,l)^2 - 1
+		float cos_nl = std::fabs(QVector3D::dotProduct(decoded_normals[code], l));
+		float cos_rv = std::max(2 * cos_nl * cos_nl - 1, 0.0f);
+		(*diffuse)[code] = ambient + diffuse_ratio * cos_nl;
+		(*specular)[code] = specular_ratio * std::pow(cos_rv, shininess);
+	}
+	// Voxels without gradient are drawn with their flat color
+	(*diffuse)[NormalVolume::no_normal] = 1;
+	(*specular)[NormalVolume::no_normal] = 0;
+}
+
+QMatrix4x4 GLWidget::getViewProjection(int width, int height) const
+{
+	double aspect_ratio = width / (float)height;
+	QMatrix4x4 result;
 	switch (view_type)
 	{
 	case ViewType::ORTHO:
 	{
 		double view_half_size = std::pow(2, -log2_zoom);
-		glScalef(1.0, aspect_ratio, 1.0);
+		result.scale(1.0, aspect_ratio, 1.0);
 		QVector3D center(0, 0, 0);
-		glOrtho(center.x() - view_half_size, center.x() + view_half_size,
+		result.ortho(center.x() - view_half_size, center.x() + view_half_size,
 				center.y() - view_half_size, center.y() + view_half_size,
 				center.z() - view_half_size, center.z() + view_half_size);
-		glMultMatrixf(transform.constData());
+		result *= transform;
 		break;
 	}
 	case ViewType::FRUSTUM:
@@ -236,36 +919,127 @@ void GLWidget::paintGL()
 		projection.perspective(90, aspect_ratio, near_dist, far_dist);
 		QMatrix4x4 cam_offset;
 		cam_offset.translate(0, 0, -2 * (1 - log2_zoom));
-		QMatrix4x4 pov = projection * cam_offset * transform;
-		glMultMatrixf(pov.constData());
+		result = projection * cam_offset * transform;
 	}
 	}
+	return result;
+}
 
-	glMatrixMode(GL_MODELVIEW);
+GLWidget::PickResult GLWidget::pick(int x, int y, int width, int height)
+{
+	PickResult result;
+	result.hit = false;
+	if (!volumic_data || width <= 0 || height <= 0)
+		return result;
+	prepareDisplayPoints();
+	if (!occupancy_grid)
+	{
+		occupancy_grid.reset(new OccupancyGrid(*sparse_volume));
+		if (isVerbose())
+			std::cout << "Occupancy grid: " << occupancy_grid->getMemoryUsed() / 1024 << " kB" << std::endl;
+	}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glLoadIdentity();
+	// The ray goes through the pixel from the near plane to the far plane, in
+	// the coordinates of the voxels: the point of voxel i is at the center of
+	// [i, i+1)
+	QMatrix4x4 inverse = getViewProjection(width, height).inverted();
+	double ndc_x = 2 * (x + 0.5) / width - 1;
+	double ndc_y = 1 - 2 * (y + 0.5) / height;
+	QVector3D ray_start = inverse.map(QVector3D(ndc_x, ndc_y, -1));
+	QVector3D ray_end = inverse.map(QVector3D(ndc_x, ndc_y, 1));
+	for (int axis = 0; axis < 3; axis++)
+	{
+		double factor = display_grid.factors[axis];
+		double offset = display_grid.sizes[axis] / 2. + 0.5;
+		ray_start[axis] = ray_start[axis] / factor + offset;
+		ray_end[axis] = ray_end[axis] / factor + offset;
+	}
 
-	glBegin(GL_POINTS);
-	for (const DrawablePoint &p : display_points)
+	OccupancyGrid::SegmentMask segments;
+	for (int segment = 0; segment < getNbSegments(); segment++)
+		if (transfer_function->isVisible(segment))
+			segments.set(segment);
+	int W = display_grid.sizes[0];
+	int H = display_grid.sizes[1];
+	int D = display_grid.sizes[2];
+	int layer_start, layer_end, row_start, row_end, col_start, col_end;
+	getLayerRange(&layer_start, &layer_end);
+	getCropRange(1, H, &row_start, &row_end);
+	getCropRange(0, W, &col_start, &col_end);
+	// Same tests as visitLayerPoints
+	auto accept = [&](int col, int row, int depth, int, uint16_t value)
 	{
-		if(highlight && p.a == 1.0)
-      		glColor4f(p.color.x(), p.color.y(), p.color.z(), p.a);
-    	else 
-      		glColor4f(p.color.x(), p.color.y(), p.color.z(), alpha);
-    	glVertex3d(p.pos.x(), p.pos.y(), p.pos.z());
+		if (depth < layer_start || depth >= layer_end || row < row_start || row >= row_end
+			|| col < col_start || col >= col_end)
+			return false;
+		QVector4D pos((col - W / 2.) * display_grid.factors[0], (row - H / 2.) * display_grid.factors[1],
+			(depth - D / 2.) * display_grid.factors[2], 1);
+		for (const QVector4D &plane : clip_planes)
+			if (QVector4D::dotProduct(plane, pos) < 0)
+				return false;
+		return volumic_data->manualWindowHandling(value) > 0 || !hide_empty_points;
+	};
+	OccupancyGrid::Hit hit;
+	if (!occupancy_grid->castRay(ray_start, ray_end - ray_start, 0, 1, segments, accept, &hit))
+		return result;
+
+	// The voxel of the source is converted to the voxel of volumic_data
+	// closest to it
+	VolumicData *source = getSourceVolume();
+	double source_spacing[3] = {source->pixel_width, source->pixel_height, source->slice_spacing};
+	double data_spacing[3] = {volumic_data->pixel_width, volumic_data->pixel_height, volumic_data->slice_spacing};
+	int data_sizes[3] = {volumic_data->width, volumic_data->height, volumic_data->depth};
+	result.hit = true;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		result.position[axis] = hit.voxel[axis] * source_spacing[axis];
+		int voxel = hit.voxel[axis];
+		if (data_spacing[axis] > 0 && source_spacing[axis] > 0)
+			voxel = std::round(result.position[axis] / data_spacing[axis]);
+		result.voxel[axis] = std::min(std::max(voxel, 0), data_sizes[axis] - 1);
 	}
-	glEnd();
+	result.value = hit.value;
+	result.segment = hit.segment;
+	return result;
 }
 
-void GLWidget::mousePressEvent(QMouseEvent *event) { lastPos = event->pos(); }
+void GLWidget::setViewType(ViewType new_view_type)
+{
+	view_type = new_view_type;
+	update();
+}
+
+void GLWidget::setTransform(const QMatrix4x4 &new_transform)
+{
+	transform = new_transform;
+	update();
+}
+
+void GLWidget::setZoom(float new_log2_zoom)
+{
+	log2_zoom = new_log2_zoom;
+	update();
+}
+
+void GLWidget::mousePressEvent(QMouseEvent *event)
+{
+	lastPos = event->pos();
+	if (event->button() == Qt::LeftButton && (event->modifiers() & Qt::ControlModifier))
+	{
+		PickResult result = pick(event->x(), event->y(), width(), height());
+		if (result.hit)
+			emit voxelPicked(result);
+	}
+}
 
 void GLWidget::mouseMoveEvent(QMouseEvent *event)
 {
 	double dx = modifiedDelta(event->x() - lastPos.x());
 	double dy = modifiedDelta(event->y() - lastPos.y());
 
-	if (event->buttons() & Qt::LeftButton)
+	// Ctrl + left button picks voxels instead of rotating the view
+	bool picking = event->modifiers() & Qt::ControlModifier;
+	if ((event->buttons() & Qt::LeftButton) && !picking)
 	{
 		QQuaternion local_rotation =
 			QQuaternion::fromEulerAngles(0.5 * dy, 0.5 * dx, 0);
@@ -314,55 +1088,153 @@ void GLWidget::setWinWidth(double new_value)
 	update();
 }
 
-bool GLWidget::connectivity(const int mode, const int idx, const int curr_segment, const double min, const double max)
+/// A neighbor of a voxel: the index of its row among the 3x3 rows around the
+/// voxel, (dz + 1) * 3 + dy + 1, and its column offset
+struct Neighbor
 {
-	const int W = volumic_data->width;
-	const int H = volumic_data->height;
-	const int D = volumic_data->depth;
+	int row;
+	int dx;
+};
 
-	const QVector3D pos = volumic_data->getCoordinate(idx);
-	
-	const int x = pos.x();
-	const int y = pos.y();
-	const int z = pos.z();
+/// The neighbors compared by connectivity for each mode: 6, 18 or 26
+/// neighbors, the voxel itself being included in the last two
+static const std::vector<Neighbor> &getNeighbors(int mode)
+{
+	static const std::vector<Neighbor> neighbors[3] = {
+		[]() {
+			std::vector<Neighbor> result;
+			for (int dz = -1; dz <= 1; ++dz)
+				for (int dy = -1; dy <= 1; ++dy)
+					for (int dx = -1; dx <= 1; ++dx)
+						if (abs(dx + dy + dz) == 1 && (dx == 0 || dy == 0 || dz == 0))
+							result.push_back({(dz + 1) * 3 + dy + 1, dx});
+			return result;
+		}(),
+		[]() {
+			std::vector<Neighbor> result;
+			for (int dz = -1; dz <= 1; ++dz)
+				for (int dy = -1; dy <= 1; ++dy)
+					for (int dx = -1; dx <= 1; ++dx)
+						if (dx == 0 || dy == 0 || dz == 0)
+							result.push_back({(dz + 1) * 3 + dy + 1, dx});
+			return result;
+		}(),
+		[]() {
+			std::vector<Neighbor> result;
+			for (int row = 0; row < 9; ++row)
+				for (int dx = -1; dx <= 1; ++dx)
+					result.push_back({row, dx});
+			return result;
+		}(),
+	};
+	return neighbors[mode == 0 || mode == 1 ? mode : 2];
+}
 
-	for (int dz = -1; dz <= 1; ++dz)
-		for (int dy = -1; dy <= 1; ++dy)
-			for (int dx = -1; dx <= 1; ++dx)
-			{
-				int new_x = x + dx;
-				int new_y = y + dy;
-				int new_z = z + dz;
+bool GLWidget::connectivity(const int mode, const int x, const uint8_t *const rows[9], const int curr_segment)
+{
+	// The rows come from the sparse volume, which may have been resampled
+	const int W = sparse_volume->width;
 
-				if(new_x < 0 || new_y < 0 || new_z < 0 || new_x >= W || new_y >= H || new_z >= D)
-					continue;
+	for (const Neighbor &neighbor : getNeighbors(mode))
+	{
+		int new_x = x + neighbor.dx;
+		const uint8_t *row = rows[neighbor.row];
+		if (row == nullptr || new_x < 0 || new_x >= W)
+			continue;
+		if (row[new_x] != curr_segment)
+			return true;
+	}
+	return false;
+}
 
-				switch(mode)
-				{
-					case 0:
-					{
-						if(!(abs(dx+dy+dz) == 1 && (dx == 0 || dy == 0 || dz == 0)))
-							continue;
-						break;
-					}
-					case 1:
-					{
-						if(dx != 0 && dy != 0 && dz != 0)
-							continue;
-						break;
-					}
-					case 2: break;
-					default: break;
-				}	
-
-				double raw_color = volumic_data->getValue(new_x, new_y, new_z);
-				int neighbor_segment = volumic_data->threshold(raw_color, min, max, color_mode);
-				if (curr_segment != neighbor_segment) {
-					return true;
-				}
-			}
+uint64_t GLWidget::estimateDisplayPoints(double win_min, double win_max)
+{
+	if (!volumic_data)
+		return 0;
+	VolumicData *data = getSourceVolume();
+	if (!data->histogram)
+		return 0;
+	int layer_start, layer_end;
+	getLayerRange(&layer_start, &layer_end);
+	bool hide_empty = hide_empty_points;
+	std::shared_ptr<const std::vector<uint8_t>> segments = getSegmentTable(win_min, win_max);
+	return data->histogram->count([&](uint16_t value) {
+		if (hide_empty && data->manualWindowHandling(value) <= 0)
+			return false;
+		return transfer_function->isVisible((*segments)[value]);
+	}, layer_start, layer_end);
+}
 
-	return false;
+std::shared_ptr<const std::vector<uint8_t>> GLWidget::getSegmentTable(double win_min, double win_max) const
+{
+	if (color_mode)
+		return transfer_function->getTable();
+	// Without colors, the values inside the window form a single segment
+	std::shared_ptr<std::vector<uint8_t>> segments =
+		std::make_shared<std::vector<uint8_t>>(VolumeHistogram::nb_bins, TransferFunction::no_segment);
+	int start = std::max((int)std::ceil(win_min), 0);
+	int end = std::min((int)std::floor(win_max) + 1, VolumeHistogram::nb_bins);
+	if (start < end)
+		std::fill(segments->begin() + start, segments->begin() + end, TransferFunction::window_segment);
+	return segments;
+}
+
+void GLWidget::setTransferFunction(std::shared_ptr<const TransferFunction> new_transfer_function)
+{
+	// Points are grouped by segment, only a change of the ranges of the
+	// segments requires to build them again
+	bool same_table = transfer_function->getTable() == new_transfer_function->getTable();
+	transfer_function = std::move(new_transfer_function);
+	if (color_mode && !same_table)
+		updateDisplayPoints();
+	else
+		publishDisplayPoints();
+	update();
+}
+
+std::shared_ptr<const TransferFunction> GLWidget::getTransferFunction() const
+{
+	return transfer_function;
+}
+
+void GLWidget::setStreamPublisher(std::shared_ptr<VolumeStreamPublisher> publisher)
+{
+	stream_publisher = std::move(publisher);
+	publishVolumicData();
+	publishDisplayPoints();
+}
+
+void GLWidget::getLayerRange(int* layer_start, int* layer_end)
+{
+	*layer_start = 0;
+	*layer_end = 0;
+	if (!volumic_data)
+		return;
+	int slice_start, slice_end;
+	getSliceLayers(curr_slice - 1, &slice_start, &slice_end);
+	int D = getSourceVolume()->depth;
+	int start = hide_below ? slice_start : 0;
+	int end = hide_above ? slice_end : D;
+	int crop_start, crop_end;
+	getCropRange(2, D, &crop_start, &crop_end);
+	*layer_start = std::max(start, crop_start);
+	*layer_end = std::min(end, crop_end);
+}
+
+void GLWidget::getSliceLayers(int slice, int* layer_start, int* layer_end)
+{
+	VolumicData *source = getSourceVolume();
+	if (source->depth == volumic_data->depth)
+	{
+		*layer_start = slice;
+		*layer_end = slice + 1;
+		return;
+	}
+	// Layer z of the source is at position z * ratio in slices, both spacings
+	// having the same sign
+	double ratio = source->getVoxelSize(2) / volumic_data->getVoxelSize(2);
+	*layer_start = std::ceil((slice - 0.5) / ratio);
+	*layer_end = std::ceil((slice + 0.5) / ratio);
 }
 
 void GLWidget::getWinMinMax(double* min, double* max) {
@@ -2,11 +2,21 @@
 #define GLWIDGET_H
 
 #include <QMatrix4x4>
+#include <QVector4D>
 #include <QOpenGLWidget>
 #include <QString>
 
 #include <memory>
 
+#include "memory_arena.h"
+#include "normal_volume.h"
+#include "occupancy_grid.h"
+#include "point_renderer.h"
+#include "sparse_volume.h"
+#include "transfer_function.h"
+#include "volume_filters.h"
+#include "volume_resampling.h"
+#include "volume_stream.h"
 #include "volumic_data.h"
 
 class GLWidget : public QOpenGLWidget {
@@ -15,6 +25,28 @@ public:
 public:
   enum ViewType { ORTHO, FRUSTUM };
 
+  /// The part of the volume displayed, as ratios of the extent of the volume
+  /// along x, y and z
+  struct CropBox {
+    double min[3] = {0, 0, 0};
+    double max[3] = {1, 1, 1};
+  };
+
+  static const int max_clip_planes = 6;
+
+  /// The voxel found under a pixel of the view, see pick
+  struct PickResult {
+    bool hit;
+    /// Column, row and slice of the voxel in the volume
+    int voxel[3];
+    /// Position of the center of the voxel from the first voxel [mm]
+    QVector3D position;
+    /// Stored value of the voxel, in the units of the window
+    uint16_t value;
+    /// Segment of the voxel, see TransferFunction
+    int segment;
+  };
+
   GLWidget(QWidget *parent = 0);
   ~GLWidget();
   QSize sizeHint() const { return QSize(200, 200); }
@@ -28,12 +60,80 @@ public:
 
   void updateDisplayPoints();
 
+  /// Set the filter applied to the volume before extracting the points
+  void setFilter(VolumeFilter new_filter);
+
+  /// Enable or disable the resampling of the volume on cubic voxels of size
+  /// 'spacing' [mm] before extracting the points, see resampleVolume
+  void setResampling(bool enabled, Interpolation interpolation,
+                     double spacing);
+  /// Set the memory budget of the volumes computed from the volumic data
+  /// [bytes], those which exceed it are stored out-of-core. The display
+  /// points are bounded by the same budget, see display_points.
+  void setVolumeMemoryBudget(size_t budget);
+
+  void setCropBox(const CropBox &new_crop_box);
+  /// Add a clip plane through the center of the volume facing the viewer,
+  /// the half of the volume closest to the viewer is hidden. Once
+  /// max_clip_planes are used, the oldest plane is replaced.
+  void addClipPlaneFromView();
+  void clearClipPlanes();
+
+  void setViewType(ViewType new_view_type);
+  void setTransform(const QMatrix4x4 &new_transform);
+  /// Set the zoom on a log2 scale, see log2_zoom
+  void setZoom(float new_log2_zoom);
+
+  /// Prepare the current OpenGL context for renderScene, the context must
+  /// provide the OpenGL 3.3 core profile. The renderer is built again when
+  /// the context changes.
+  /// Throws std::runtime_error if the shaders can't be built
+  void initializeScene();
+  /// Draw the scene in the current OpenGL context, for a viewport of the
+  /// given size. Used by paintGL and to render the scene offscreen.
+  void renderScene(int width, int height);
+
+  /// Return the first visible voxel along the ray going through the pixel
+  /// (x, y) of a viewport of the given size, from the viewer to the back of
+  /// the scene. The voxels hidden by the crop box, the clip planes, the layer
+  /// range or the transfer function are ignored. In contours mode, the
+  /// interior of the segments is not hidden.
+  PickResult pick(int x, int y, int width, int height);
+
+  /// Estimate from the histogram of the volume the number of points which
+  /// would be displayed with the given window, without building them.
+  /// Contours mode is ignored, the result is then an upper bound.
+  uint64_t estimateDisplayPoints(double win_min, double win_max);
+
+  /// Set the segments shown in color mode
+  void setTransferFunction(
+      std::shared_ptr<const TransferFunction> new_transfer_function);
+  std::shared_ptr<const TransferFunction> getTransferFunction() const;
+
+  /// Extract the display points on the calling thread without storing them,
+  /// with the loop of updateDisplayPoints. Return the number of points and
+  /// set 'checksum' to the sum of their x coordinates, red components and
+  /// opacities. Used by runPointBenchmark to compare the loop with its
+  /// reference, see visitReferencePoints.
+  size_t countDisplayPoints(double *checksum);
+
+  /// Publish the volume and the display points to 'publisher' each time they
+  /// change, nullptr to stop publishing. The current state is published
+  /// right away.
+  void setStreamPublisher(std::shared_ptr<VolumeStreamPublisher> publisher);
+
   bool contours_mode;
   bool highlight;
   bool hide_below;
   bool hide_above;
   int curr_slice;
   bool color_mode;
+  /// When enabled, points are shaded according to their normal with a light
+  /// placed at the viewer position
+  bool lighting;
+  /// When enabled, points are drawn from the back to the front of the scene
+  /// so that transparency does not depend on the orientation
+  bool depth_sorting;
 
 public slots:
   void setAlpha(double new_alpha);
@@ -42,13 +142,23 @@ public slots:
   void hideLayersAbove(int state);
   void hideLayersBelow(int state);
   void onColorModeChange(int state);
+  void onLightingModeChange(int state);
+  void onDepthSortingChange(int state);
   void saveXYZ();
 
+signals:
+  /// Emitted when a voxel is picked with Ctrl + left click
+  void voxelPicked(const GLWidget::PickResult &result);
+
 protected:
   struct DrawablePoint {
     QVector3D pos;
     QVector3D color;
     double a;
+    /// Code of the surface normal, see NormalVolume
+    uint16_t normal;
+    /// Segment of the point, see TransferFunction
+    uint8_t segment;
   };
 
   void initializeGL() override;
@@ -65,8 +175,97 @@ protected:
    */
   double modifiedDelta(double delta);
 
-  bool connectivity(const int mode, const int idx, const int curr_segment, const double min, const double max);
+  /// The points of display_points grouped by slice along an axis
+  struct SliceIndex {
+    bool valid = false;
+    /// Points of slice s are between offsets[s] and offsets[s+1]
+    std::vector<uint32_t> offsets;
+    /// Indices of the points in display_points sorted by slice
+    std::vector<uint32_t> indices;
+  };
+
+  /// The transformation from the coordinates of the points to the clip
+  /// coordinates for a viewport of the given size
+  QMatrix4x4 getViewProjection(int width, int height) const;
+
+  /// Index of the slice containing the point along the given axis
+  int getSlice(const DrawablePoint &p, int axis) const;
+
+  /// Return the points grouped by slice along the axis, building the index
+  /// only if the points changed
+  const SliceIndex &getSliceIndex(int axis);
+
+  /// Choose the axis whose slices are the most perpendicular to the view and
+  /// fill 'order' with its slices from the farthest to the nearest
+  void getSliceOrder(int *axis, std::vector<int> *order);
+
+  /// Compute for each normal code the factor applied to the colors and the
+  /// specular highlight added to them for a light coming from 'light'
+  void getShading(const QVector3D &light, std::vector<float> *diffuse,
+                  std::vector<float> *specular);
+
+  /// The extraction loop before it was restructured, kept by the benchmark
+  friend size_t visitReferencePoints(GLWidget *widget, double *checksum);
+
+  /// Return true if the voxel at column x of the active row has a neighbor
+  /// from a different segment. rows[(dz+1)*3+dy+1] are the segments of the
+  /// neighbor rows, nullptr if outside of the volume
+  bool connectivity(const int mode, const int x, const uint8_t *const rows[9], const int curr_segment);
+
+  /// Return the volume used to extract the points: volumic_data, resampled
+  /// and then filtered if required. Intermediate volumes are computed only
+  /// when needed and kept until their parameters change.
+  VolumicData *getSourceVolume();
+
+  /// The segment of each stored value: the transfer function in color mode,
+  /// the values inside the window otherwise
+  std::shared_ptr<const std::vector<uint8_t>>
+  getSegmentTable(double win_min, double win_max) const;
+
+  /// Return the segmented voxels for the current window and color mode,
+  /// rebuilding them only if one of them changed
+  const SparseVolume &getSparseVolume();
+
+  /// Return the normals of the source volume, computing them only if the
+  /// source changed
+  NormalVolume &getNormalVolume();
+
+  /// Build the points to be drawn slab by slab and hand them to 'consumer'
+  /// without storing them
+  template <typename Consumer>
+  void visitDisplayPoints(Consumer &&consumer);
+  /// Compute the grid of the points and the volumes used to generate them,
+  /// afterwards visitLayerPoints can be called from several threads
+  void prepareDisplayPoints();
+  /// Call 'consumer' on the points of the layers [layer_start, layer_end)
+  template <typename Consumer>
+  void visitLayerPoints(int layer_start, int layer_end, Consumer &&consumer);
+  /// Add to counts[s] an upper bound of the number of points of segment 's'
+  /// in a layer: the voxels of the sparse volume inside the crop box,
+  /// ignoring clip planes and the tests on values and contours
+  void countLayerCandidates(int depth, size_t *counts);
+  /// Write volumic_data in a frame of stream_publisher, if any
+  void publishVolumicData();
+  /// Write the visible display points in a frame of stream_publisher, if
+  /// any
+  void publishDisplayPoints();
+  /// Number of segment identifiers used by the points, see TransferFunction
+  int getNbSegments() const;
   void getWinMinMax(double* min, double* max);
+  /// Range [start, end) of the voxels inside the crop box along the given
+  /// axis for a volume of 'size' voxels along this axis
+  void getCropRange(int axis, int size, int *start, int *end) const;
+  /// Restrict the range of columns [col_start, col_end) of the row at (y, z)
+  /// to the voxels on the visible side of 'plane', coordinates are the ones
+  /// of the points
+  static void clipColumns(const QVector4D &plane, double y, double z, int W,
+                          double x_factor, int *col_start, int *col_end);
+  /// Range of layers [start, end) of the source volume shown according to
+  /// hide_below/hide_above and the crop box
+  void getLayerRange(int* layer_start, int* layer_end);
+  /// Range of layers [start, end) of the source volume which are closer to
+  /// the given slice of volumic_data than to any other slice
+  void getSliceLayers(int slice, int* layer_start, int* layer_end);
 
   QPoint lastPos;
   float alpha;
@@ -89,8 +288,85 @@ protected:
   /// The data of all the slices stored in a single object
   std::unique_ptr<VolumicData> volumic_data;
 
+  /// Resampling applied to volumic_data before extracting the points
+  bool resampling_enabled;
+  Interpolation resampling_interpolation;
+  double resampling_spacing;
+  /// The result of the last resampling, kept until its parameters or the
+  /// volume change
+  std::unique_ptr<VolumicData> resampled_data;
+  Interpolation resampled_data_interpolation;
+  double resampled_data_spacing;
+  /// See setVolumeMemoryBudget
+  size_t volume_memory_budget;
+
+  /// The filter applied to the volume before extracting the points
+  VolumeFilter filter;
+  /// The result of the last filter applied, kept until the filter or the
+  /// volume change
+  std::unique_ptr<VolumicData> filtered_data;
+  VolumeFilter filtered_data_filter;
+  const VolumicData *filtered_data_source;
+
+  /// Segments and colors of the values in color mode
+  std::shared_ptr<const TransferFunction> transfer_function;
+
+  /// The voxels of volumic_data belonging to a segment, reused as long as
+  /// the window, the color mode and the table of the transfer function are
+  /// not modified
+  std::unique_ptr<SparseVolume> sparse_volume;
+  const VolumicData *sparse_source;
+  double sparse_win_min;
+  double sparse_win_max;
+  bool sparse_color_mode;
+  std::shared_ptr<const std::vector<uint8_t>> sparse_table;
+
+  /// Bricks of sparse_volume used to cast rays, built by the first pick
+  /// after sparse_volume changes
+  std::unique_ptr<OccupancyGrid> occupancy_grid;
+
+  /// The normals of the source volume, computed only if lighting is enabled
+  std::unique_ptr<NormalVolume> normal_volume;
+  const VolumicData *normal_source;
+
+  CropBox crop_box;
+  /// Planes (a,b,c,d) in the coordinates of the points, points for which
+  /// a*x+b*y+c*z+d < 0 are hidden
+  std::vector<QVector4D> clip_planes;
+
   /// The points to be drawn
-  std::vector<DrawablePoint> display_points;
+  /// The buffer is reused from an update to the next and trimmed once the
+  /// points are generated. When the candidate points exceed
+  /// volume_memory_budget, they are thinned evenly in each layer of each
+  /// segment so that the buffer stays within it.
+  ArenaArray<DrawablePoint> display_points;
+  /// The points are grouped by segment, the points of segment s are between
+  /// segment_offsets[s] and segment_offsets[s+1]
+  std::vector<size_t> segment_offsets;
+
+  /// Number of voxels along each axis of the grid of display_points and
+  /// their size in the coordinates of the points
+  struct DisplayGrid {
+    int sizes[3];
+    double factors[3];
+  };
+  DisplayGrid display_grid;
+  /// Grouping of display_points by slice along x, y and z
+  SliceIndex slice_indices[3];
+
+  /// Draws display_points, built by initializeScene
+  std::unique_ptr<PointRenderer> point_renderer;
+  /// False when display_points changed since they were uploaded
+  bool renderer_points_valid;
+  /// Axis of the slice index uploaded to the renderer, -1 if none
+  int renderer_index_axis;
+  /// Light direction of the shading table uploaded to the renderer, the
+  /// table is only computed again when the view rotates
+  QVector3D renderer_shading_light;
+  bool renderer_shading_valid;
+
+  /// Receives volumic_data and the display points, see setStreamPublisher
+  std::shared_ptr<VolumeStreamPublisher> stream_publisher;
   
 };
 
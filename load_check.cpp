@@ -0,0 +1,106 @@
+#include "load_check.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dicom_scan.h"
+#include "dicom_viewer.h"
+#include "phantom.h"
+
+/// Milliseconds elapsed since 'start'
+static double getElapsedMs(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double, std::milli> duration =
+      std::chrono::steady_clock::now() - start;
+  return duration.count();
+}
+
+/// Remove a directory and the files it contains
+static void removeDirectory(const std::string &dir) {
+  DIR *handle = opendir(dir.c_str());
+  if (handle != nullptr) {
+    while (dirent *entry = readdir(handle)) {
+      std::string name = entry->d_name;
+      if (name != "." && name != "..")
+        unlink((dir + "/" + name).c_str());
+    }
+    closedir(handle);
+  }
+  rmdir(dir.c_str());
+}
+
+uint64_t runLoadCheck(const LoadCheckOptions &options) {
+  SeriesGeneratorOptions generator_options;
+  generator_options.width = options.width;
+  generator_options.height = options.height;
+  generator_options.depth = options.depth;
+  generator_options.syntax = options.syntax;
+  generator_options.output_dir = options.series_dir;
+  bool temporary = options.series_dir.empty();
+  if (temporary) {
+    char dir_template[] = "/tmp/dicom_viewer_series_XXXXXX";
+    if (mkdtemp(dir_template) == nullptr)
+      throw std::runtime_error("Failed to create a temporary directory");
+    generator_options.output_dir = dir_template;
+  } else {
+    mkdir(options.series_dir.c_str(), 0755);
+  }
+
+  uint64_t nb_differences = 0;
+  try {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> paths = writePhantomSeries(generator_options);
+    std::cout << "Series: " << options.width << "x" << options.height << "x"
+              << options.depth << " in " << generator_options.output_dir
+              << std::endl;
+    std::cout << "Generation: " << getElapsedMs(start) << " ms" << std::endl;
+
+    // The headers are checked first, so that an invalid file is reported
+    // here rather than by a dialog of the viewer
+    start = std::chrono::steady_clock::now();
+    std::vector<DicomHeader> headers = scanDicomHeaders(paths);
+    std::cout << "Header scan: " << getElapsedMs(start) << " ms" << std::endl;
+    for (const DicomHeader &header : headers)
+      if (!header.error.empty())
+        throw std::runtime_error(header.info.path + ": " + header.error);
+
+    // Errors are printed rather than shown in dialogs nobody can close
+    DicomViewer viewer;
+    viewer.setInteractive(false);
+    start = std::chrono::steady_clock::now();
+    bool opened = viewer.openDicomFiles(paths);
+    double open_ms = getElapsedMs(start);
+    std::shared_ptr<const VolumicData> volume = viewer.getActiveVolume();
+    if (!opened || !volume)
+      throw std::runtime_error("Failed to open the series");
+    std::cout << "Opening: " << open_ms << " ms, "
+              << open_ms / options.depth << " ms per file" << std::endl;
+
+    if (volume->width != options.width || volume->height != options.height ||
+        volume->depth != options.depth)
+      throw std::runtime_error("The loaded volume has a different size");
+    std::vector<uint16_t> expected((size_t)options.width * options.height);
+    for (int layer = 0; layer < options.depth; layer++) {
+      getPhantomLayer(options.width, options.height, options.depth, layer,
+                      expected.data());
+      std::shared_ptr<const VolumeSlab> slab = volume->getSlab(layer);
+      const uint16_t *values = slab->getLayer(layer);
+      for (size_t idx = 0; idx < expected.size(); idx++)
+        if (values[idx] != expected[idx])
+          nb_differences++;
+    }
+  } catch (...) {
+    if (temporary)
+      removeDirectory(generator_options.output_dir);
+    throw;
+  }
+  if (temporary)
+    removeDirectory(generator_options.output_dir);
+  return nb_differences;
+}
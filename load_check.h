@@ -0,0 +1,35 @@
+#ifndef LOAD_CHECK_H
+#define LOAD_CHECK_H
+
+#include <cstdint>
+#include <string>
+
+#include "series_generator.h"
+
+/// Options of runLoadCheck
+struct LoadCheckOptions {
+  /// Dimensions of the generated series
+  int width = 256;
+  int height = 256;
+  int depth = 64;
+  SeriesSyntax syntax = SeriesSyntax::UNCOMPRESSED;
+  /// The directory receiving the series, which is kept afterwards. When
+  /// empty, the series is written in a temporary directory removed at the
+  /// end.
+  std::string series_dir;
+};
+
+/// Write the phantom series (see writePhantomSeries), open it through
+/// DicomViewer like a collection chosen by the user, and compare the loaded
+/// volume to the phantom.
+///
+/// The durations of the generation, of the scan of the headers and of the
+/// whole opening (scan, validation, decoding and building of the volume) are
+/// printed, so that changes of the loading path can be measured on the same
+/// series on any machine.
+///
+/// Return the number of voxels which differ from the phantom. Throws
+/// std::runtime_error if the series can't be written or opened.
+uint64_t runLoadCheck(const LoadCheckOptions &options);
+
+#endif // LOAD_CHECK_H
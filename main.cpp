@@ -1,8 +1,286 @@
 #include "dicom_viewer.h"
+#include "load_check.h"
+#include "point_benchmark.h"
+#include "render_check.h"
+#include "stream_check.h"
+#include "verbose.h"
+#include "volume_stream.h"
 #include <QApplication>
+#include <QSurfaceFormat>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/stat.h>
+
+/// Render the reference scenes offscreen and compare them to golden images
+/// usage: dicom_viewer --render-check <golden_dir> [--update-golden]
+static int renderCheck(int argc, char *argv[])
+{
+    RenderCheckOptions options;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--update-golden") == 0)
+            options.update_golden = true;
+        else
+            options.golden_dir = argv[i];
+    }
+    if (options.golden_dir.empty()) {
+        std::cerr << "usage: " << argv[0]
+                  << " --render-check <golden_dir> [--update-golden]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    // No window is shown and Mesa renders in software when no GPU is
+    // available, unless the environment requires otherwise
+    setenv("QT_QPA_PLATFORM", "offscreen", 0);
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+    QApplication a(argc, argv);
+    try {
+        int nb_failures = runRenderCheck(options);
+        if (nb_failures > 0)
+            std::cerr << nb_failures << " scenes differ from their golden image"
+                      << std::endl;
+        return nb_failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    } catch (const std::runtime_error &error) {
+        std::cerr << "Render check failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+/// Measure the extraction of the display points of the phantom volume
+/// usage: dicom_viewer --point-benchmark [<width> <height> <depth>]
+static int pointBenchmark(int argc, char *argv[])
+{
+    PointBenchmarkOptions options;
+    if (argc == 5) {
+        options.width = atoi(argv[2]);
+        options.height = atoi(argv[3]);
+        options.depth = atoi(argv[4]);
+    }
+    if ((argc != 2 && argc != 5) || options.width <= 0 ||
+        options.height <= 0 || options.depth <= 0) {
+        std::cerr << "usage: " << argv[0]
+                  << " --point-benchmark [<width> <height> <depth>]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    // The widget is never shown
+    setenv("QT_QPA_PLATFORM", "offscreen", 0);
+    QApplication a(argc, argv);
+    runPointBenchmark(options);
+    return EXIT_SUCCESS;
+}
+
+/// Generate a synthetic series, open it and compare it to the phantom, for
+/// one syntax or for each of them
+/// usage: dicom_viewer --load-check [<width> <height> <depth>]
+///        [--syntax uncompressed|rle|jpeg-lossless|all] [--series-dir <dir>]
+static int loadCheck(int argc, char *argv[])
+{
+    LoadCheckOptions options;
+    std::vector<SeriesSyntax> syntaxes = {options.syntax};
+    std::vector<int> sizes;
+    bool valid = true;
+    for (int i = 2; i < argc && valid; i++) {
+        if (strcmp(argv[i], "--syntax") == 0 && i + 1 < argc &&
+            strcmp(argv[i + 1], "all") == 0) {
+            syntaxes = {SeriesSyntax::UNCOMPRESSED, SeriesSyntax::RLE,
+                        SeriesSyntax::JPEG_LOSSLESS};
+            i++;
+        } else if (strcmp(argv[i], "--syntax") == 0 && i + 1 < argc) {
+            try {
+                syntaxes = {parseSeriesSyntax(argv[++i])};
+            } catch (const std::invalid_argument &error) {
+                std::cerr << error.what() << std::endl;
+                valid = false;
+            }
+        } else if (strcmp(argv[i], "--series-dir") == 0 && i + 1 < argc) {
+            options.series_dir = argv[++i];
+        } else {
+            sizes.push_back(atoi(argv[i]));
+        }
+    }
+    if (sizes.size() == 3) {
+        options.width = sizes[0];
+        options.height = sizes[1];
+        options.depth = sizes[2];
+    }
+    if (!valid || (!sizes.empty() && sizes.size() != 3) ||
+        options.width <= 0 || options.height <= 0 || options.depth <= 0) {
+        std::cerr << "usage: " << argv[0]
+                  << " --load-check [<width> <height> <depth>]"
+                     " [--syntax uncompressed|rle|jpeg-lossless|all]"
+                     " [--series-dir <dir>]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    // The viewer is never shown
+    setenv("QT_QPA_PLATFORM", "offscreen", 0);
+    QApplication a(argc, argv);
+    // With several syntaxes, each series is written in its own directory
+    std::string series_dir = options.series_dir;
+    if (!series_dir.empty() && syntaxes.size() > 1)
+        mkdir(series_dir.c_str(), 0755);
+    int nb_failures = 0;
+    for (SeriesSyntax syntax : syntaxes) {
+        options.syntax = syntax;
+        if (!series_dir.empty() && syntaxes.size() > 1)
+            options.series_dir = series_dir + "/" + getSyntaxName(syntax);
+        std::cout << "Syntax: " << getSyntaxName(syntax) << std::endl;
+        try {
+            uint64_t nb_differences = runLoadCheck(options);
+            if (nb_differences > 0) {
+                std::cerr << nb_differences
+                          << " voxels differ from the phantom" << std::endl;
+                nb_failures++;
+            }
+        } catch (const std::runtime_error &error) {
+            std::cerr << "Load check failed: " << error.what() << std::endl;
+            nb_failures++;
+        }
+    }
+    return nb_failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/// Publish points and a volume and compare what a consumer receives
+/// usage: dicom_viewer --stream-check [<width> <height> <depth>]
+static int streamCheck(int argc, char *argv[])
+{
+    StreamCheckOptions options;
+    if (argc == 5) {
+        options.width = atoi(argv[2]);
+        options.height = atoi(argv[3]);
+        options.depth = atoi(argv[4]);
+    }
+    if ((argc != 2 && argc != 5) || options.width <= 0 ||
+        options.height <= 0 || options.depth <= 0) {
+        std::cerr << "usage: " << argv[0]
+                  << " --stream-check [<width> <height> <depth>]"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+    try {
+        uint64_t nb_differences = runStreamCheck(options);
+        if (nb_differences > 0)
+            std::cerr << nb_differences
+                      << " differences between what is published and received"
+                      << std::endl;
+        return nb_differences > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    } catch (const std::runtime_error &error) {
+        std::cerr << "Stream check failed: " << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+/// Stand-in for the consumers of the viewer: print a summary of each frame
+/// published, until the viewer stops publishing
+/// usage: dicom_viewer --stream-consumer [<socket_path>]
+static int streamConsumer(int argc, char *argv[])
+{
+    if (argc > 3) {
+        std::cerr << "usage: " << argv[0]
+                  << " --stream-consumer [<socket_path>]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string socket_path =
+        argc == 3 ? argv[2] : volume_stream::getDefaultSocketPath();
+    try {
+        VolumeStreamConsumer consumer(socket_path);
+        VolumeStreamConsumer::Frame frame;
+        while (consumer.waitFrame(-1, &frame)) {
+            // The frame is read in place, then checked. The header may be
+            // overwritten meanwhile: what is printed is copied first, and
+            // the count is bounded by the size of the frame so that the
+            // payload is never read past it.
+            const volume_stream::FrameHeader &header = *frame.header;
+            uint64_t sequence = header.sequence;
+            uint32_t kind = header.kind;
+            uint32_t first_layer = header.first_layer;
+            uint32_t sizes[3] = {header.sizes[0], header.sizes[1],
+                                 header.sizes[2]};
+            uint64_t count = header.count;
+            uint64_t payload_bytes =
+                frame.frame_bytes - sizeof(volume_stream::FrameHeader);
+            if (kind == volume_stream::POINTS)
+                count = std::min<uint64_t>(
+                    count, payload_bytes / sizeof(volume_stream::StreamPoint));
+            else if (kind == volume_stream::VOLUME)
+                count = std::min<uint64_t>(count,
+                                           payload_bytes / sizeof(uint16_t));
+            float min[3] = {0, 0, 0}, max[3] = {0, 0, 0};
+            if (kind == volume_stream::POINTS && count > 0) {
+                const volume_stream::StreamPoint *points =
+                    (const volume_stream::StreamPoint *)frame.payload;
+                std::copy(points[0].position, points[0].position + 3, min);
+                std::copy(points[0].position, points[0].position + 3, max);
+                for (uint64_t idx = 1; idx < count; idx++)
+                    for (int axis = 0; axis < 3; axis++) {
+                        min[axis] = std::min(min[axis], points[idx].position[axis]);
+                        max[axis] = std::max(max[axis], points[idx].position[axis]);
+                    }
+            } else if (kind == volume_stream::VOLUME && count > 0) {
+                const uint16_t *values = (const uint16_t *)frame.payload;
+                min[0] = max[0] = values[0];
+                for (uint64_t idx = 1; idx < count; idx++) {
+                    min[0] = std::min<float>(min[0], values[idx]);
+                    max[0] = std::max<float>(max[0], values[idx]);
+                }
+            }
+            if (!consumer.isValid(frame)) {
+                std::cout << "Frame overwritten while reading it" << std::endl;
+                continue;
+            }
+            if (kind == volume_stream::POINTS)
+                std::cout << "Frame " << sequence << ": " << count
+                          << " points in [" << min[0] << ", " << max[0]
+                          << "] x [" << min[1] << ", " << max[1] << "] x ["
+                          << min[2] << ", " << max[2] << "]" << std::endl;
+            else
+                std::cout << "Frame " << sequence << ": volume "
+                          << sizes[0] << "x" << sizes[1] << "x" << sizes[2]
+                          << ", layers from "
+                          << first_layer << ", values in [" << min[0]
+                          << ", " << max[0] << "]" << std::endl;
+        }
+    } catch (const std::runtime_error &error) {
+        std::cerr << error.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
 
 int main(int argc, char *argv[])
 {
+    // The 3D view draws with shaders, the format has to be set before the
+    // application is created
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    QSurfaceFormat::setDefaultFormat(format);
+
+    // --verbose can precede any other option
+    if (argc > 1 && strcmp(argv[1], "--verbose") == 0) {
+        setVerbose(true);
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--render-check") == 0)
+        return renderCheck(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--point-benchmark") == 0)
+        return pointBenchmark(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--load-check") == 0)
+        return loadCheck(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--stream-check") == 0)
+        return streamCheck(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--stream-consumer") == 0)
+        return streamConsumer(argc, argv);
+
     QApplication a(argc, argv);
     DicomViewer w;
     w.show();
@@ -0,0 +1,73 @@
+#include "memory_arena.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+
+static size_t roundToHugePages(size_t bytes) {
+  size_t page = MemoryArena::huge_page_size;
+  return (bytes + page - 1) / page * page;
+}
+
+/// Map 'bytes' of anonymous memory, nullptr on failure
+static void *mapBlock(size_t bytes) {
+  void *block = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED)
+    return nullptr;
+#ifdef MADV_HUGEPAGE
+  // Only a hint, the block is still usable without huge pages
+  madvise(block, bytes, MADV_HUGEPAGE);
+#endif
+  return block;
+}
+
+MemoryArena::MemoryArena()
+    : block(nullptr), mapped_size(0), resident_size(0) {}
+
+MemoryArena::~MemoryArena() {
+  if (block)
+    munmap(block, mapped_size);
+}
+
+void MemoryArena::reserve(size_t bytes) {
+  if (bytes <= mapped_size) {
+    resident_size = std::max(resident_size, bytes);
+    return;
+  }
+  size_t new_size = roundToHugePages(std::max(bytes, mapped_size * 3 / 2));
+  void *new_block = nullptr;
+#ifdef MREMAP_MAYMOVE
+  if (block) {
+    new_block = mremap(block, mapped_size, new_size, MREMAP_MAYMOVE);
+    if (new_block == MAP_FAILED)
+      throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    madvise(new_block, new_size, MADV_HUGEPAGE);
+#endif
+  }
+#endif
+  if (!new_block) {
+    new_block = mapBlock(new_size);
+    if (!new_block)
+      throw std::bad_alloc();
+    if (block) {
+      memcpy(new_block, block, resident_size);
+      munmap(block, mapped_size);
+    }
+  }
+  block = new_block;
+  mapped_size = new_size;
+  resident_size = bytes;
+}
+
+void MemoryArena::trim(size_t bytes) {
+  size_t kept = roundToHugePages(bytes);
+  if (kept >= mapped_size || 2 * kept >= resident_size)
+    return;
+  // The mapping is kept, the pages are zero-filled again when touched
+  madvise((char *)block + kept, mapped_size - kept, MADV_DONTNEED);
+  resident_size = kept;
+}
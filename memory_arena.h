@@ -0,0 +1,96 @@
+#ifndef MEMORY_ARENA_H
+#define MEMORY_ARENA_H
+
+#include <cstddef>
+#include <type_traits>
+
+/// A contiguous block of memory mapped directly from the system and kept
+/// across uses, so that buffers rebuilt often do not go through the
+/// allocator each time.
+///
+/// The block is requested in multiples of the huge page size and advised to
+/// be backed by huge pages when the system supports it. Growing the block
+/// keeps its content. Trimming it returns the physical pages beyond the
+/// given size to the system while keeping the mapping, so the memory is
+/// faulted back in on the next use without remapping.
+class MemoryArena {
+public:
+  /// Granularity of the block [bytes]
+  static const size_t huge_page_size = 2 * 1024 * 1024;
+
+  MemoryArena();
+  ~MemoryArena();
+
+  MemoryArena(const MemoryArena &other) = delete;
+  MemoryArena &operator=(const MemoryArena &other) = delete;
+
+  /// Ensure that at least 'bytes' are available, the block grows by half of
+  /// its size at least to avoid remapping it on each small increase
+  /// Throws std::bad_alloc if the memory can't be mapped
+  void reserve(size_t bytes);
+
+  /// Release the physical pages after the first 'bytes' of the block if
+  /// they represent more than half of the pages in use
+  void trim(size_t bytes);
+
+  void *data() const { return block; }
+
+  /// Size of the mapped block [bytes]
+  size_t capacity() const { return mapped_size; }
+
+  /// Upper bound of the physical memory used by the block [bytes]
+  size_t getMemoryUsed() const { return resident_size; }
+
+private:
+  void *block;
+  size_t mapped_size;
+  /// Bytes of the block which may be backed by physical pages
+  size_t resident_size;
+};
+
+/// An array of trivially copyable elements stored in a MemoryArena
+///
+/// Unlike std::vector, elements are not initialized by resize(): they are
+/// meant to be written directly in place, possibly by several threads
+/// working on disjoint ranges.
+template <typename T> class ArenaArray {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "ArenaArray elements are copied as raw memory");
+
+public:
+  size_t size() const { return nb_elements; }
+  bool empty() const { return nb_elements == 0; }
+
+  T *data() { return (T *)arena.data(); }
+  const T *data() const { return (const T *)arena.data(); }
+
+  T &operator[](size_t idx) { return data()[idx]; }
+  const T &operator[](size_t idx) const { return data()[idx]; }
+
+  T *begin() { return data(); }
+  T *end() { return data() + nb_elements; }
+  const T *begin() const { return data(); }
+  const T *end() const { return data() + nb_elements; }
+
+  /// Ensure that 'capacity' elements can be stored without remapping
+  void reserve(size_t capacity) { arena.reserve(capacity * sizeof(T)); }
+
+  /// Change the number of elements, new elements are left uninitialized
+  void resize(size_t new_size) {
+    reserve(new_size);
+    nb_elements = new_size;
+  }
+
+  void clear() { nb_elements = 0; }
+
+  /// Release the memory which is not used by the current elements
+  void trim() { arena.trim(nb_elements * sizeof(T)); }
+
+  size_t getMemoryUsed() const { return arena.getMemoryUsed(); }
+
+private:
+  MemoryArena arena;
+  size_t nb_elements = 0;
+};
+
+#endif // MEMORY_ARENA_H
@@ -0,0 +1,119 @@
+#include "normal_volume.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+
+/// Number of steps used to quantize each coordinate of the octahedral mapping.
+/// Even, so that the 255 levels 0..254 have a middle one, 127, which decodes
+/// to exactly 0, and 255 is never used by a normal (see no_normal).
+static const int nb_steps = 254;
+
+NormalVolume::NormalVolume(VolumicData &volume)
+    : width(volume.width), height(volume.height), depth(volume.depth) {
+  int W = width;
+  int H = height;
+  int D = depth;
+  int layer_size = W * H;
+  if (volume.isOutOfCore())
+    slab_cache = SlabCache::createTemporary(
+        layer_size, D, volume.slab_cache->getMemoryBudget());
+  else
+    normals.resize((size_t)layer_size * D);
+  // Normals are opposed to the gradient. Layers are placed along z with the
+  // sign of the slice spacing, which is negative when the instance numbers
+  // decrease along z.
+  float fx = -0.5 / volume.getVoxelSize(0);
+  float fy = -0.5 / volume.getVoxelSize(1);
+  float fz = -0.5 / volume.getVoxelSize(2);
+  if (volume.slice_spacing < 0)
+    fz = -fz;
+  parallelFor(0, D, [&](int, int begin, int end) {
+    std::shared_ptr<const VolumeSlab> slabs[3];
+    std::vector<float> gx(W), gy(W), gz(W);
+    std::vector<uint16_t> output(slab_cache ? layer_size : 0);
+    for (int layer = begin; layer < end; layer++) {
+      const uint16_t *layers[3];
+      for (int k = 0; k < 3; k++) {
+        int src_layer = std::min(std::max(layer + k - 1, 0), D - 1);
+        if (!slabs[k] || !slabs[k]->contains(src_layer))
+          slabs[k] = volume.getSlab(src_layer);
+        layers[k] = slabs[k]->getLayer(src_layer);
+      }
+      uint16_t *dst = slab_cache ? output.data()
+                                 : normals.data() + (size_t)layer * layer_size;
+      for (int y = 0; y < H; y++) {
+        const uint16_t *row = layers[1] + y * W;
+        const uint16_t *above = layers[1] + std::max(y - 1, 0) * W;
+        const uint16_t *below = layers[1] + std::min(y + 1, H - 1) * W;
+        const uint16_t *prev = layers[0] + y * W;
+        const uint16_t *next = layers[2] + y * W;
+        // Central differences, borders are replicated
+        gx[0] = fx * (row[std::min(1, W - 1)] - row[0]);
+        for (int x = 1; x < W - 1; x++)
+          gx[x] = fx * (row[x + 1] - row[x - 1]);
+        if (W > 1)
+          gx[W - 1] = fx * (row[W - 1] - row[W - 2]);
+        for (int x = 0; x < W; x++) {
+          gy[x] = fy * (below[x] - above[x]);
+          gz[x] = fz * (next[x] - prev[x]);
+        }
+        for (int x = 0; x < W; x++)
+          dst[y * W + x] = encode(gx[x], gy[x], gz[x]);
+      }
+      if (slab_cache)
+        slab_cache->writeLayer(output.data(), layer);
+    }
+  });
+}
+
+std::shared_ptr<const VolumeSlab> NormalVolume::getSlab(int layer) {
+  if (slab_cache)
+    return slab_cache->getSlab(layer);
+  std::shared_ptr<VolumeSlab> slab = std::make_shared<VolumeSlab>();
+  slab->first_layer = 0;
+  slab->nb_layers = depth;
+  slab->layer_size = width * height;
+  slab->values = normals.data();
+  return slab;
+}
+
+size_t NormalVolume::getMemoryUsed() {
+  if (slab_cache)
+    return slab_cache->getMemoryUsed();
+  return normals.size() * sizeof(uint16_t);
+}
+
+uint16_t NormalVolume::encode(float x, float y, float z) {
+  float norm = std::fabs(x) + std::fabs(y) + std::fabs(z);
+  if (norm == 0)
+    return no_normal;
+  float u = x / norm;
+  float v = y / norm;
+  // The lower half of the octahedron is folded on the upper one
+  if (z < 0) {
+    float folded_u = (1 - std::fabs(v)) * (u >= 0 ? 1 : -1);
+    float folded_v = (1 - std::fabs(u)) * (v >= 0 ? 1 : -1);
+    u = folded_u;
+    v = folded_v;
+  }
+  int qu = std::lround((u + 1) * 0.5f * nb_steps);
+  int qv = std::lround((v + 1) * 0.5f * nb_steps);
+  return (uint16_t)(qu << 8 | qv);
+}
+
+QVector3D NormalVolume::decode(uint16_t code) {
+  if (code == no_normal)
+    return QVector3D(0, 0, 0);
+  float u = (code >> 8) * 2.0f / nb_steps - 1;
+  float v = (code & 0xFF) * 2.0f / nb_steps - 1;
+  float z = 1 - std::fabs(u) - std::fabs(v);
+  if (z < 0) {
+    float unfolded_u = (1 - std::fabs(v)) * (u >= 0 ? 1 : -1);
+    float unfolded_v = (1 - std::fabs(u)) * (v >= 0 ? 1 : -1);
+    u = unfolded_u;
+    v = unfolded_v;
+  }
+  return QVector3D(u, v, z).normalized();
+}
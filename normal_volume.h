@@ -0,0 +1,53 @@
+#ifndef NORMAL_VOLUME_H
+#define NORMAL_VOLUME_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <QVector3D>
+
+#include "slab_cache.h"
+#include "volumic_data.h"
+
+/// The surface normals of a volume, estimated for each voxel from the
+/// gradient of the values by central differences.
+///
+/// Normals point toward lower values and are quantized on 16 bits with an
+/// octahedral mapping (8 bits per coordinate), so that the normal volume uses
+/// the same memory as the values. Like the volume, they are stored
+/// out-of-core if the volume is.
+class NormalVolume {
+public:
+  /// The code of voxels whose gradient is null
+  static const uint16_t no_normal = 0xFFFF;
+
+  int width;
+  int height;
+  int depth;
+
+  /// Compute the normals of all the voxels of 'volume', the spacing of the
+  /// voxels is taken into account
+  NormalVolume(VolumicData &volume);
+
+  /// Return a slab containing the codes of the given layer. When the normals
+  /// are in memory, the slab contains the whole volume.
+  std::shared_ptr<const VolumeSlab> getSlab(int layer);
+
+  /// Memory used by the normals held in memory [bytes]
+  size_t getMemoryUsed();
+
+  /// Quantize a direction, (0,0,0) is encoded as no_normal
+  static uint16_t encode(float x, float y, float z);
+
+  /// Return the unit vector encoded by 'code', (0,0,0) for no_normal
+  static QVector3D decode(uint16_t code);
+
+private:
+  /// Codes of the normals, empty when they are stored out-of-core
+  std::vector<uint16_t> normals;
+  /// The cache holding the codes when they are stored out-of-core
+  std::shared_ptr<SlabCache> slab_cache;
+};
+
+#endif // NORMAL_VOLUME_H
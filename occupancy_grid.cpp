@@ -0,0 +1,106 @@
+#include "occupancy_grid.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "parallel.h"
+
+const int OccupancyGrid::nb_levels;
+const int OccupancyGrid::brick_size;
+
+OccupancyGrid::OccupancyGrid(const SparseVolume &sparse) : sparse(sparse) {
+  sizes[0] = sparse.width;
+  sizes[1] = sparse.height;
+  sizes[2] = sparse.depth;
+  for (int level = 0; level < nb_levels; level++) {
+    int size = getBrickSize(level);
+    for (int axis = 0; axis < 3; axis++)
+      nb_bricks[level][axis] = (sizes[axis] + size - 1) / size;
+    masks[level].resize((size_t)nb_bricks[level][0] * nb_bricks[level][1] *
+                        nb_bricks[level][2]);
+  }
+  // Each thread fills the finest bricks of its own layers of bricks
+  const int *nb = nb_bricks[0];
+  parallelFor(0, nb[2], [&](int, int begin, int end) {
+    int layer_end = std::min(end * brick_size, sizes[2]);
+    for (int layer = begin * brick_size; layer < layer_end; layer++) {
+      const SparseVolume::Layer &l = sparse.getLayer(layer);
+      for (int row = 0; row < sizes[1]; row++) {
+        SegmentMask *row_masks =
+            &masks[0][((size_t)(layer / brick_size) * nb[1] +
+                       row / brick_size) * nb[0]];
+        for (uint32_t i = l.row_offsets[row]; i < l.row_offsets[row + 1];
+             i++) {
+          const SparseVolume::Run &run = l.runs[i];
+          int last = (run.col + run.length - 1) / brick_size;
+          for (int x = run.col / brick_size; x <= last; x++)
+            row_masks[x].set(run.segment);
+        }
+      }
+    }
+  });
+  // A brick of a coarser level holds the segments of the bricks it contains
+  for (int level = 1; level < nb_levels; level++) {
+    const int *fine = nb_bricks[level - 1];
+    for (int z = 0; z < fine[2]; z++)
+      for (int y = 0; y < fine[1]; y++)
+        for (int x = 0; x < fine[0]; x++) {
+          size_t coarse_idx = ((size_t)(z / 4) * nb_bricks[level][1] +
+                               y / 4) * nb_bricks[level][0] + x / 4;
+          masks[level][coarse_idx] |=
+              masks[level - 1][((size_t)z * fine[1] + y) * fine[0] + x];
+        }
+  }
+}
+
+const SparseVolume &OccupancyGrid::getSparseVolume() const { return sparse; }
+
+size_t OccupancyGrid::getMemoryUsed() const {
+  size_t result = 0;
+  for (int level = 0; level < nb_levels; level++)
+    result += masks[level].size() * sizeof(SegmentMask);
+  return result;
+}
+
+int OccupancyGrid::getBrickSize(int level) {
+  return brick_size << (2 * level);
+}
+
+const OccupancyGrid::SegmentMask &OccupancyGrid::getMask(int level, int x,
+                                                         int y, int z) const {
+  int size = getBrickSize(level);
+  const int *nb = nb_bricks[level];
+  return masks[level][((size_t)(z / size) * nb[1] + y / size) * nb[0] +
+                      x / size];
+}
+
+bool OccupancyGrid::clipRay(const double origin[3], const double direction[3],
+                            double *t_min, double *t_max) const {
+  for (int axis = 0; axis < 3; axis++) {
+    if (direction[axis] == 0) {
+      if (origin[axis] < 0 || origin[axis] >= sizes[axis])
+        return false;
+      continue;
+    }
+    double t0 = -origin[axis] / direction[axis];
+    double t1 = (sizes[axis] - origin[axis]) / direction[axis];
+    if (t0 > t1)
+      std::swap(t0, t1);
+    *t_min = std::max(*t_min, t0);
+    *t_max = std::min(*t_max, t1);
+  }
+  return *t_min <= *t_max;
+}
+
+double OccupancyGrid::getExitDistance(const double origin[3],
+                                      const double direction[3],
+                                      const int corner[3], int size) {
+  double result = std::numeric_limits<double>::infinity();
+  for (int axis = 0; axis < 3; axis++) {
+    if (direction[axis] == 0)
+      continue;
+    double bound = direction[axis] > 0 ? corner[axis] + size : corner[axis];
+    result = std::min(result, (bound - origin[axis]) / direction[axis]);
+  }
+  return result;
+}
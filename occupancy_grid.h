@@ -0,0 +1,145 @@
+#ifndef OCCUPANCY_GRID_H
+#define OCCUPANCY_GRID_H
+
+#include <bitset>
+#include <cmath>
+#include <vector>
+
+#include <QVector3D>
+
+#include "sparse_volume.h"
+
+/// A hierarchy of bricks recording which segments are present in each region
+/// of a SparseVolume, used to cast rays through the volume while skipping
+/// the empty regions.
+///
+/// Bricks of level l cover (brick_size << 2*l)^3 voxels. A ray only visits
+/// the voxels of the finest bricks containing one of the requested
+/// segments, the coarser levels allow to cross large empty regions at once.
+///
+/// The grid references the SparseVolume it was built from, which has to
+/// outlive it.
+class OccupancyGrid {
+public:
+  /// Segments present in a brick, bit s is set if segment s is present
+  typedef std::bitset<256> SegmentMask;
+
+  static const int nb_levels = 3;
+  /// Number of voxels along each axis of the bricks of the finest level
+  static const int brick_size = 8;
+
+  /// A voxel found by castRay
+  struct Hit {
+    int voxel[3];
+    int segment;
+    uint16_t value;
+    /// Distance along the ray where it enters the voxel
+    double t;
+  };
+
+  /// Build the hierarchy from the runs of 'sparse', layers are processed in
+  /// parallel
+  explicit OccupancyGrid(const SparseVolume &sparse);
+
+  const SparseVolume &getSparseVolume() const;
+
+  /// Cast the ray 'origin + t * direction' for t in [t_min, t_max] through
+  /// the voxels, voxel (x, y, z) covering [x, x+1) * [y, y+1) * [z, z+1).
+  /// Stored voxels whose segment is in 'segments' are visited from the
+  /// closest to the farthest and given to
+  /// 'accept(x, y, z, segment, value)', the first one accepted fills 'hit'.
+  /// Return false if no voxel is accepted.
+  template <typename Accept>
+  bool castRay(const QVector3D &origin, const QVector3D &direction,
+               double t_min, double t_max, const SegmentMask &segments,
+               Accept &&accept, Hit *hit) const;
+
+  /// Memory used by the bricks [bytes]
+  size_t getMemoryUsed() const;
+
+private:
+  /// Number of voxels along each axis of the bricks of a level
+  static int getBrickSize(int level);
+
+  /// The segments of the brick containing a voxel at a given level
+  const SegmentMask &getMask(int level, int x, int y, int z) const;
+
+  /// Restrict [t_min, t_max] to the part of the ray inside the volume,
+  /// return false if the ray misses the volume
+  bool clipRay(const double origin[3], const double direction[3],
+               double *t_min, double *t_max) const;
+
+  /// Distance along the ray where it leaves the cube of size 'size' whose
+  /// lowest corner is 'corner'
+  static double getExitDistance(const double origin[3],
+                                const double direction[3],
+                                const int corner[3], int size);
+
+  const SparseVolume &sparse;
+  int sizes[3];
+  /// Number of bricks along each axis for each level
+  int nb_bricks[nb_levels][3];
+  /// The bricks of each level, x being the fastest index
+  std::vector<SegmentMask> masks[nb_levels];
+};
+
+template <typename Accept>
+bool OccupancyGrid::castRay(const QVector3D &origin,
+                            const QVector3D &direction, double t_min,
+                            double t_max, const SegmentMask &segments,
+                            Accept &&accept, Hit *hit) const {
+  double length = direction.length();
+  if (length <= 0)
+    return false;
+  // Distances are expressed in voxels along the normalized direction
+  double o[3], d[3];
+  for (int axis = 0; axis < 3; axis++) {
+    o[axis] = origin[axis];
+    d[axis] = direction[axis] / length;
+  }
+  t_min *= length;
+  t_max *= length;
+  if (!clipRay(o, d, &t_min, &t_max))
+    return false;
+  // Offset used to step inside the next voxel once a voxel is left
+  const double step = 1e-4;
+  double t = t_min;
+  while (t <= t_max) {
+    int voxel[3];
+    bool inside = true;
+    for (int axis = 0; axis < 3; axis++) {
+      voxel[axis] = (int)std::floor(o[axis] + d[axis] * (t + step));
+      inside = inside && voxel[axis] >= 0 && voxel[axis] < sizes[axis];
+    }
+    if (!inside)
+      return false;
+    // Skip the largest brick which does not contain a requested segment
+    int empty_level = -1;
+    for (int level = nb_levels - 1; level >= 0 && empty_level < 0; level--)
+      if ((getMask(level, voxel[0], voxel[1], voxel[2]) & segments).none())
+        empty_level = level;
+    int size = 1;
+    if (empty_level >= 0) {
+      size = getBrickSize(empty_level);
+    } else {
+      uint16_t value;
+      int segment = sparse.getVoxel(voxel[0], voxel[1], voxel[2], &value);
+      if (segment != 0 && segments[segment] &&
+          accept(voxel[0], voxel[1], voxel[2], segment, value)) {
+        for (int axis = 0; axis < 3; axis++)
+          hit->voxel[axis] = voxel[axis];
+        hit->segment = segment;
+        hit->value = value;
+        hit->t = t / length;
+        return true;
+      }
+    }
+    int corner[3];
+    for (int axis = 0; axis < 3; axis++)
+      corner[axis] = voxel[axis] / size * size;
+    t = std::max(getExitDistance(o, d, corner, size), t + step);
+  }
+  return false;
+}
+
+#endif // OCCUPANCY_GRID_H
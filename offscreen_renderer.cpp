@@ -0,0 +1,69 @@
+#include "offscreen_renderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+OffscreenRenderer::OffscreenRenderer(int width, int height)
+    : width(width), height(height) {
+  // The scene is drawn with shaders, see PointRenderer
+  QSurfaceFormat format;
+  format.setRenderableType(QSurfaceFormat::OpenGL);
+  format.setVersion(3, 3);
+  format.setProfile(QSurfaceFormat::CoreProfile);
+  surface.setFormat(format);
+  surface.create();
+  context.setFormat(format);
+  if (!context.create())
+    throw std::runtime_error("Failed to create an OpenGL context");
+  if (!context.makeCurrent(&surface))
+    throw std::runtime_error("Failed to activate the OpenGL context");
+  fbo.reset(new QOpenGLFramebufferObject(
+      width, height, QOpenGLFramebufferObject::CombinedDepthStencil));
+  if (!fbo->isValid())
+    throw std::runtime_error("Failed to create the framebuffer");
+  context.doneCurrent();
+}
+
+OffscreenRenderer::~OffscreenRenderer() {
+  // The framebuffer has to be released while its context is current
+  context.makeCurrent(&surface);
+  fbo.reset();
+  context.doneCurrent();
+}
+
+void OffscreenRenderer::draw(GLWidget &widget) {
+  fbo->bind();
+  widget.initializeScene();
+  widget.renderScene(width, height);
+  glFinish();
+}
+
+QImage OffscreenRenderer::render(GLWidget &widget) {
+  context.makeCurrent(&surface);
+  draw(widget);
+  QImage result = fbo->toImage();
+  fbo->release();
+  context.doneCurrent();
+  return result;
+}
+
+double OffscreenRenderer::measureFrameTime(GLWidget &widget, int nb_frames) {
+  if (nb_frames <= 0)
+    return 0;
+  context.makeCurrent(&surface);
+  std::vector<double> durations;
+  for (int frame = 0; frame < nb_frames; frame++) {
+    auto start = std::chrono::steady_clock::now();
+    draw(widget);
+    auto end = std::chrono::steady_clock::now();
+    durations.push_back(
+        std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  fbo->release();
+  context.doneCurrent();
+  std::nth_element(durations.begin(), durations.begin() + nb_frames / 2,
+                   durations.end());
+  return durations[nb_frames / 2];
+}
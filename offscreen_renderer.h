@@ -0,0 +1,42 @@
+#ifndef OFFSCREEN_RENDERER_H
+#define OFFSCREEN_RENDERER_H
+
+#include <memory>
+
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+
+#include "glwidget.h"
+
+/// Renders the scene of a GLWidget in a framebuffer object, without showing
+/// the widget. It works with the 'offscreen' platform plugin and a software
+/// OpenGL implementation, so that scenes can be rendered on headless
+/// machines.
+class OffscreenRenderer {
+public:
+  /// Create the context and the framebuffer
+  /// Throws std::runtime_error if no OpenGL context is available
+  OffscreenRenderer(int width, int height);
+  ~OffscreenRenderer();
+
+  /// Render the scene of 'widget' and return the image obtained
+  QImage render(GLWidget &widget);
+
+  /// Render the scene 'nb_frames' times and return the median duration of a
+  /// frame [ms], the rendering is finished before each measure is stopped
+  double measureFrameTime(GLWidget &widget, int nb_frames);
+
+private:
+  /// Draw the scene in the framebuffer, the context has to be current
+  void draw(GLWidget &widget);
+
+  int width;
+  int height;
+  QOffscreenSurface surface;
+  QOpenGLContext context;
+  std::unique_ptr<QOpenGLFramebufferObject> fbo;
+};
+
+#endif // OFFSCREEN_RENDERER_H
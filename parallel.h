@@ -0,0 +1,51 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/// Number of threads used by default for parallel loops
+inline int getNbThreads() {
+  int nb_threads = std::thread::hardware_concurrency();
+  return nb_threads > 0 ? nb_threads : 1;
+}
+
+/// Split [begin, end) in contiguous chunks, one per thread, and run
+/// 'task(thread_idx, chunk_begin, chunk_end)' on each chunk in parallel.
+/// - Returns once all the chunks have been processed
+/// - If a task throws, the first exception is rethrown in the calling thread
+inline void parallelFor(int begin, int end,
+                        const std::function<void(int, int, int)> &task,
+                        int nb_threads = getNbThreads()) {
+  int size = end - begin;
+  if (size <= 0)
+    return;
+  nb_threads = std::max(1, std::min(nb_threads, size));
+  if (nb_threads == 1) {
+    task(0, begin, end);
+    return;
+  }
+  std::vector<std::thread> threads;
+  std::vector<std::exception_ptr> errors(nb_threads);
+  for (int thread_idx = 0; thread_idx < nb_threads; thread_idx++) {
+    int chunk_begin = begin + (long long)size * thread_idx / nb_threads;
+    int chunk_end = begin + (long long)size * (thread_idx + 1) / nb_threads;
+    threads.emplace_back([&, thread_idx, chunk_begin, chunk_end]() {
+      try {
+        task(thread_idx, chunk_begin, chunk_end);
+      } catch (...) {
+        errors[thread_idx] = std::current_exception();
+      }
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+  for (const std::exception_ptr &error : errors)
+    if (error)
+      std::rethrow_exception(error);
+}
+
+#endif // PARALLEL_H
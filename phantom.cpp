@@ -0,0 +1,93 @@
+#include "phantom.h"
+
+#include <vector>
+
+#include "parallel.h"
+
+/// Stored values of the materials of the phantom
+static const uint16_t outside_value = 2000; // No segment
+static const uint16_t body_value = 40;      // Grey matter
+static const uint16_t core_value = 25;      // White matter
+static const uint16_t fluid_value = 10;     // Water
+static const uint16_t calcified_value = 150;
+static const uint16_t bone_value = 600;
+
+/// Deterministic noise in [-2,2]
+static int getNoise(uint32_t seed) {
+  seed ^= seed >> 16;
+  seed *= 0x7feb352d;
+  seed ^= seed >> 15;
+  seed *= 0x846ca68b;
+  seed ^= seed >> 16;
+  return (int)(seed % 5) - 2;
+}
+
+/// True if the point is inside the ellipsoid of center c and radii r, all
+/// coordinates being relative to the half extent of the volume
+static bool inside(double x, double y, double z, double cx, double cy,
+                   double cz, double r) {
+  double dx = x - cx;
+  double dy = y - cy;
+  double dz = z - cz;
+  return dx * dx + dy * dy + dz * dz < r * r;
+}
+
+uint16_t getPhantomValue(double x, double y, double z, double rx, double ry,
+                         double rz, uint32_t noise_seed) {
+  // Normalized coordinates in [-1,1]
+  double u = x / rx;
+  double v = y / ry;
+  double w = z / rz;
+  if (!inside(u, v, w, 0, 0, 0, 0.9))
+    return outside_value;
+  uint16_t value = body_value;
+  if (inside(u, v, w, 0.45, 0.3, 0, 0.2))
+    value = bone_value;
+  else if (inside(u, v, w, -0.4, 0.35, 0.2, 0.15))
+    value = calcified_value;
+  else if (inside(u, v, w, 0, -0.4, -0.3, 0.25))
+    value = fluid_value;
+  else if (inside(u, v, w, 0, 0, 0, 0.5))
+    value = core_value;
+  // Noise keeps the values in their segment
+  return value + getNoise(noise_seed);
+}
+
+void getPhantomLayer(int width, int height, int depth, int layer,
+                     uint16_t *values) {
+  double rx = width * phantom_pixel_size / 2;
+  double ry = height * phantom_pixel_size / 2;
+  double rz = depth * phantom_slice_spacing / 2;
+  double z = (layer + 0.5) * phantom_slice_spacing - rz;
+  for (int row = 0; row < height; row++) {
+    double y = (row + 0.5) * phantom_pixel_size - ry;
+    for (int col = 0; col < width; col++) {
+      double x = (col + 0.5) * phantom_pixel_size - rx;
+      uint32_t seed = ((uint32_t)layer * height + row) * width + col;
+      values[row * width + col] = getPhantomValue(x, y, z, rx, ry, rz, seed);
+    }
+  }
+}
+
+std::unique_ptr<VolumicData> createPhantom(int width, int height, int depth) {
+  std::unique_ptr<VolumicData> result(
+      new VolumicData(width, height, depth, 0, 1024, 0));
+  result->pixel_width = phantom_pixel_size;
+  result->pixel_height = phantom_pixel_size;
+  result->slice_spacing = phantom_slice_spacing;
+  int nb_threads = getNbThreads();
+  std::vector<VolumeHistogram> histograms(nb_threads, VolumeHistogram(depth));
+  parallelFor(0, depth, [&](int thread_idx, int begin, int end) {
+    std::vector<uint16_t> layer_values(width * height);
+    for (int layer = begin; layer < end; layer++) {
+      getPhantomLayer(width, height, depth, layer, layer_values.data());
+      result->setStoredLayer(layer_values.data(), layer,
+                             &histograms[thread_idx]);
+    }
+  }, nb_threads);
+  for (int thread_idx = 1; thread_idx < nb_threads; thread_idx++)
+    histograms[0].merge(histograms[thread_idx]);
+  result->histogram =
+      std::make_shared<const VolumeHistogram>(std::move(histograms[0]));
+  return result;
+}
@@ -0,0 +1,33 @@
+#ifndef PHANTOM_H
+#define PHANTOM_H
+
+#include <memory>
+
+#include "volumic_data.h"
+
+/// Build a synthetic volume which does not depend on any file: an ellipsoidal
+/// body containing a softer core and spheres of various densities, with a
+/// deterministic noise. Stored values are chosen to fall in the segments of
+/// TransferFunction::createDefault, voxels outside the body belong to no
+/// segment.
+///
+/// Voxels are anisotropic: 0.8*0.8*2.0 [mm]. The histogram of the volume is
+/// computed.
+std::unique_ptr<VolumicData> createPhantom(int width, int height, int depth);
+
+/// Size of the voxels of the phantom [mm]
+const double phantom_pixel_size = 0.8;
+const double phantom_slice_spacing = 2.0;
+
+/// Fill 'values' with the width * height stored values of a layer of the
+/// phantom volume of the given dimensions
+void getPhantomLayer(int width, int height, int depth, int layer,
+                     uint16_t *values);
+
+/// Stored value of the phantom at the given position [mm] from the center of
+/// the volume whose half extent is given by (rx, ry, rz) [mm], 'noise_seed'
+/// identifies the voxel for the noise
+uint16_t getPhantomValue(double x, double y, double z, double rx, double ry,
+                         double rz, uint32_t noise_seed);
+
+#endif // PHANTOM_H
@@ -0,0 +1,273 @@
+#include "point_benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "glwidget.h"
+#include "normal_volume.h"
+#include "phantom.h"
+#include "sparse_volume.h"
+
+/// A display mode measured by the benchmark
+struct PointScene {
+  const char *name;
+  bool contours;
+  bool color;
+  bool lighting;
+};
+
+static const std::vector<PointScene> point_scenes = {
+    {"window", false, false, false},
+    {"color", false, true, false},
+    {"contours", true, false, false},
+    {"color_contours", true, true, false},
+    {"lighting", false, false, true},
+};
+
+/// GLWidget::connectivity before the neighbors of each mode were tabulated
+static bool referenceConnectivity(int mode, int x, const uint8_t *const rows[9],
+                                  int curr_segment, int W) {
+  for (int dz = -1; dz <= 1; ++dz)
+    for (int dy = -1; dy <= 1; ++dy)
+      for (int dx = -1; dx <= 1; ++dx) {
+        int new_x = x + dx;
+        const uint8_t *row = rows[(dz + 1) * 3 + dy + 1];
+        if (new_x < 0 || row == nullptr || new_x >= W)
+          continue;
+        switch (mode) {
+        case 0:
+          if (!(abs(dx + dy + dz) == 1 && (dx == 0 || dy == 0 || dz == 0)))
+            continue;
+          break;
+        case 1:
+          if (dx != 0 && dy != 0 && dz != 0)
+            continue;
+          break;
+        default:
+          break;
+        }
+        if (curr_segment != row[new_x])
+          return true;
+      }
+  return false;
+}
+
+size_t visitReferencePoints(GLWidget *widget, double *checksum) {
+  typedef GLWidget::DrawablePoint DrawablePoint;
+  size_t nb_points = 0;
+  double sum = 0;
+  *checksum = 0;
+  if (!widget->volumic_data)
+    return 0;
+  widget->prepareDisplayPoints();
+  int layer_start, layer_end;
+  widget->getLayerRange(&layer_start, &layer_end);
+  const GLWidget::DisplayGrid &grid = widget->display_grid;
+  int W = grid.sizes[0];
+  int H = grid.sizes[1];
+  int D = grid.sizes[2];
+  double x_factor = grid.factors[0];
+  double y_factor = grid.factors[1];
+  double z_factor = grid.factors[2];
+  int active_start, active_end;
+  widget->getSliceLayers(widget->curr_slice - 1, &active_start, &active_end);
+  int mode = widget->color_mode ? 0 : 2;
+  int row_start, row_end, col_start, col_end;
+  widget->getCropRange(1, H, &row_start, &row_end);
+  widget->getCropRange(0, W, &col_start, &col_end);
+
+  NormalVolume *normals =
+      widget->lighting ? widget->normal_volume.get() : nullptr;
+  std::shared_ptr<const VolumeSlab> normal_slab;
+  const uint16_t *layer_normals = nullptr;
+  std::shared_ptr<const VolumeSlab> value_slab;
+
+  const SparseVolume &sparse = *widget->sparse_volume;
+  std::vector<uint8_t> neighborhood(widget->contours_mode ? 9 * W : 0);
+  const uint8_t *neighbor_rows[9];
+  for (int depth = layer_start; depth < layer_end; depth++) {
+    const SparseVolume::Layer &layer = sparse.getLayer(depth);
+    if (layer.runs.empty())
+      continue;
+    const uint16_t *layer_values = sparse.getLayerValues(depth, &value_slab);
+    if (normals) {
+      if (!normal_slab || !normal_slab->contains(depth))
+        normal_slab = normals->getSlab(depth);
+      layer_normals = normal_slab->getLayer(depth);
+    }
+    for (int row = row_start; row < row_end; row++) {
+      uint32_t runs_start = layer.row_offsets[row];
+      uint32_t runs_end = layer.row_offsets[row + 1];
+      if (runs_start == runs_end)
+        continue;
+      double y = (row - H / 2.) * y_factor;
+      double z = (depth - D / 2.) * z_factor;
+      int row_col_start = col_start;
+      int row_col_end = col_end;
+      for (const QVector4D &plane : widget->clip_planes)
+        GLWidget::clipColumns(plane, y, z, W, x_factor, &row_col_start,
+                              &row_col_end);
+      if (row_col_start >= row_col_end)
+        continue;
+      if (widget->contours_mode) {
+        for (int i = 0; i < 9; i++) {
+          int neighbor_layer = depth + i / 3 - 1;
+          int neighbor_row = row + i % 3 - 1;
+          neighbor_rows[i] = nullptr;
+          if (neighbor_layer < 0 || neighbor_row < 0 || neighbor_layer >= D ||
+              neighbor_row >= H)
+            continue;
+          sparse.getRowSegments(neighbor_row, neighbor_layer,
+                                &neighborhood[i * W]);
+          neighbor_rows[i] = &neighborhood[i * W];
+        }
+      }
+      for (uint32_t run_idx = runs_start; run_idx < runs_end; run_idx++) {
+        const SparseVolume::Run &run = layer.runs[run_idx];
+        int segment = run.segment;
+        int first = std::max(row_col_start - run.col, 0);
+        int last = std::min(row_col_end - run.col, (int)run.length);
+        for (int i = first; i < last; i++) {
+          int col = run.col + i;
+          double raw_color = layer_values[run.first_value + i];
+          double c = widget->volumic_data->manualWindowHandling(raw_color);
+          if (!(c > 0 || !widget->hide_empty_points))
+            continue;
+          if (widget->contours_mode &&
+              !referenceConnectivity(mode, col, neighbor_rows, segment,
+                                     sparse.width))
+            continue;
+          DrawablePoint p;
+          p.a = widget->alpha;
+          if (widget->highlight && depth >= active_start && depth < active_end)
+            p.a = 1.0;
+          p.color = widget->transfer_function->getColor(segment, c);
+          p.segment = segment;
+          p.normal = layer_normals ? layer_normals[row * W + col]
+                                   : NormalVolume::no_normal;
+          p.pos = QVector3D((col - W / 2.) * x_factor, y, z);
+          nb_points++;
+          sum += p.pos.x() + p.color.x() + p.a;
+        }
+      }
+    }
+  }
+  *checksum = sum;
+  return nb_points;
+}
+
+/// Median duration of 'nb_runs' calls of 'kernel' [ms]
+template <typename Kernel>
+static double measureKernel(Kernel &&kernel, int nb_runs) {
+  std::vector<double> durations;
+  for (int run = 0; run < nb_runs; run++) {
+    auto start = std::chrono::steady_clock::now();
+    kernel();
+    std::chrono::duration<double, std::milli> duration =
+        std::chrono::steady_clock::now() - start;
+    durations.push_back(duration.count());
+  }
+  std::sort(durations.begin(), durations.end());
+  return durations.empty() ? 0 : durations[durations.size() / 2];
+}
+
+/// Copy of 'volume' whose layers are stored compressed, see CompressedVolume
+static std::unique_ptr<VolumicData>
+createCompressedCopy(const VolumicData &volume) {
+  // Same cache of decompressed layers as the volumes built by the viewer
+  const size_t cache_budget = 16 * 1024 * 1024;
+  std::unique_ptr<VolumicData> copy(new VolumicData(
+      volume.width, volume.height, volume.depth, volume.win_min,
+      volume.win_max, volume.intercept,
+      std::make_shared<CompressedVolume>(volume.width, volume.height,
+                                         volume.depth, cache_budget)));
+  copy->pixel_width = volume.pixel_width;
+  copy->pixel_height = volume.pixel_height;
+  copy->slice_spacing = volume.slice_spacing;
+  copy->histogram = volume.histogram;
+  for (int layer = 0; layer < volume.depth; layer++) {
+    std::shared_ptr<const VolumeSlab> slab = volume.getSlab(layer);
+    copy->setStoredLayer(slab->getLayer(layer), layer);
+  }
+  return copy;
+}
+
+/// Median duration of the extraction of the points of a scene [ms]
+static double measureScene(GLWidget *widget, const PointScene &scene,
+                           int nb_runs) {
+  // Switching the modes extracts the points once, which also builds the
+  // sparse and normal volumes before the measures
+  widget->onContoursModeChange(scene.contours ? 2 : 0);
+  widget->onColorModeChange(scene.color ? 2 : 0);
+  widget->onLightingModeChange(scene.lighting ? 2 : 0);
+  return measureKernel([&]() { widget->updateDisplayPoints(); }, nb_runs);
+}
+
+void runPointBenchmark(const PointBenchmarkOptions &options) {
+  std::unique_ptr<VolumicData> phantom =
+      createPhantom(options.width, options.height, options.depth);
+  std::unique_ptr<VolumicData> compressed = createCompressedCopy(*phantom);
+  double nb_voxels = (double)options.width * options.height * options.depth;
+  double ratio = 2 * nb_voxels / compressed->compressed->getCompressedSize();
+  // The same phantom is shown by a widget for each storage
+  GLWidget raw_widget, compressed_widget;
+  for (GLWidget *widget : {&raw_widget, &compressed_widget}) {
+    widget->setWinCenter(300);
+    widget->setWinWidth(700);
+  }
+  raw_widget.updateVolumicData(std::move(phantom));
+  compressed_widget.updateVolumicData(std::move(compressed));
+
+  std::cout << "Volume: " << options.width << "x" << options.height << "x"
+            << options.depth << ", compression ratio " << ratio << std::endl;
+  std::cout << std::left << std::setw(24) << "Scene" << std::setw(16)
+            << "Median [ms]" << std::setw(16) << "Per voxel [ns]"
+            << std::setw(20) << "Compressed [ms]" << "Overhead [%]"
+            << std::endl;
+  for (const PointScene &scene : point_scenes) {
+    double median = measureScene(&raw_widget, scene, options.nb_runs);
+    double compressed_median =
+        measureScene(&compressed_widget, scene, options.nb_runs);
+    std::cout << std::left << std::setw(24) << scene.name << std::setw(16)
+              << median << std::setw(16) << median * 1e6 / nb_voxels
+              << std::setw(20) << compressed_median
+              << 100 * (compressed_median / median - 1) << std::endl;
+  }
+
+  // The extraction loop alone, on one thread, before and after the
+  // invariants were hoisted, on the same volume and the same sparse volume
+  std::cout << std::endl
+            << "Extraction loop on one thread [ns per voxel]" << std::endl;
+  std::cout << std::left << std::setw(24) << "Scene" << std::setw(16)
+            << "Reference" << std::setw(16) << "Current" << "Points"
+            << std::endl;
+  for (const PointScene &scene : point_scenes) {
+    raw_widget.onContoursModeChange(scene.contours ? 2 : 0);
+    raw_widget.onColorModeChange(scene.color ? 2 : 0);
+    raw_widget.onLightingModeChange(scene.lighting ? 2 : 0);
+    size_t reference_points = 0, current_points = 0;
+    double reference_checksum = 0, current_checksum = 0;
+    double reference = measureKernel(
+        [&]() {
+          reference_points =
+              visitReferencePoints(&raw_widget, &reference_checksum);
+        },
+        options.nb_runs);
+    double current = measureKernel(
+        [&]() {
+          current_points = raw_widget.countDisplayPoints(&current_checksum);
+        },
+        options.nb_runs);
+    std::cout << std::left << std::setw(24) << scene.name << std::setw(16)
+              << reference * 1e6 / nb_voxels << std::setw(16)
+              << current * 1e6 / nb_voxels << current_points
+              << (current_points == reference_points ? "" : " (reference: " +
+                      std::to_string(reference_points) + ")")
+              << std::endl;
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef POINT_BENCHMARK_H
+#define POINT_BENCHMARK_H
+
+#include <cstddef>
+
+class GLWidget;
+
+/// Options of runPointBenchmark
+struct PointBenchmarkOptions {
+  /// Dimensions of the phantom volume the points are extracted from
+  int width = 256;
+  int height = 256;
+  int depth = 128;
+  /// Number of extractions measured for each scene
+  int nb_runs = 10;
+};
+
+/// Measure the extraction of the display points of the phantom volume
+/// (GLWidget::updateDisplayPoints) for several display modes, without any
+/// rendering.
+///
+/// For each scene, the median extraction time and the cost per voxel of the
+/// volume are printed, so that changes of the extraction loops can be
+/// compared on the same volume. The extraction loop alone is then timed on
+/// one thread against its reference, see visitReferencePoints. The scenes are also measured on a copy of
+/// the phantom stored compressed (see CompressedVolume), along with the
+/// overhead of the compression over the raw storage.
+void runPointBenchmark(const PointBenchmarkOptions &options);
+
+/// The extraction loop of the display points as it was before the invariants
+/// were hoisted out of it: one window mapping, color lookup, highlight test
+/// and position per voxel, and a test of the mode for each of the 27
+/// neighbors in contours mode. Only the access to the values of the sparse
+/// volume follows the current storage. Same result as
+/// GLWidget::countDisplayPoints, on which the current loop is measured.
+size_t visitReferencePoints(GLWidget *widget, double *checksum);
+
+#endif // POINT_BENCHMARK_H
@@ -0,0 +1,203 @@
+#include "point_renderer.h"
+
+#include <stdexcept>
+#include <string>
+
+#include "transfer_function.h"
+
+static const char *vertex_shader = R"(#version 330 core
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 color;
+layout(location = 2) in float point_alpha;
+layout(location = 3) in uint normal;
+layout(location = 4) in uint segment;
+
+uniform mat4 view_projection;
+/// Diameter of the sprites in pixels at a distance of 1 from the viewer
+uniform float point_size;
+uniform float alpha;
+uniform bool highlight;
+uniform bool lighting;
+uniform uint window_segment;
+uniform sampler2D segment_table;
+uniform sampler2D shading_table;
+
+out vec4 point_color;
+
+void main() {
+  vec4 entry = texelFetch(segment_table, ivec2(int(segment), 0), 0);
+  if (entry.a < 0.0) {
+    // Hidden segment, the point is clipped
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    gl_PointSize = 1.0;
+    point_color = vec4(0.0);
+    return;
+  }
+  gl_Position = view_projection * vec4(position, 1.0);
+  gl_PointSize = max(point_size / gl_Position.w, 1.0);
+  vec3 c = segment == window_segment ? color : entry.rgb;
+  if (lighting) {
+    ivec2 texel = ivec2(int(normal % 256u), int(normal / 256u));
+    vec2 shading = texelFetch(shading_table, texel, 0).rg;
+    c = min(c * shading.x + shading.y, vec3(1.0));
+  }
+  float a = highlight && point_alpha == 1.0 ? 1.0 : alpha * entry.a;
+  point_color = vec4(c, a);
+}
+)";
+
+static const char *fragment_shader = R"(#version 330 core
+in vec4 point_color;
+out vec4 fragment_color;
+
+void main() {
+  // Sprites are round so that their overlaps do not depend on the view
+  vec2 offset = gl_PointCoord - vec2(0.5);
+  if (dot(offset, offset) > 0.25)
+    discard;
+  fragment_color = point_color;
+}
+)";
+
+PointRenderer::PointRenderer(const PointLayout &layout)
+    : context(QOpenGLContext::currentContext()), stride(layout.stride),
+      points(QOpenGLBuffer::VertexBuffer), indices(QOpenGLBuffer::IndexBuffer),
+      segment_table(QOpenGLTexture::Target2D),
+      shading_table(QOpenGLTexture::Target2D) {
+  if (!context)
+    throw std::runtime_error("No OpenGL context to draw the points");
+  initializeOpenGLFunctions();
+  if (!program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertex_shader) ||
+      !program.addShaderFromSourceCode(QOpenGLShader::Fragment,
+                                       fragment_shader) ||
+      !program.link())
+    throw std::runtime_error("Failed to build the point shaders: " +
+                             program.log().toStdString());
+
+  // The attributes are read from the points as they are stored in memory,
+  // the index buffer is part of the state of the vertex array too
+  vertex_array.create();
+  vertex_array.bind();
+  points.create();
+  points.bind();
+  indices.create();
+  indices.bind();
+  for (GLuint location = 0; location < 5; location++)
+    glEnableVertexAttribArray(location);
+  auto offset = [](int bytes) { return (const void *)(size_t)bytes; };
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, layout.stride,
+                        offset(layout.position));
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, layout.stride,
+                        offset(layout.color));
+  glVertexAttribPointer(2, 1, GL_DOUBLE, GL_FALSE, layout.stride,
+                        offset(layout.alpha));
+  glVertexAttribIPointer(3, 1, GL_UNSIGNED_SHORT, layout.stride,
+                         offset(layout.normal));
+  glVertexAttribIPointer(4, 1, GL_UNSIGNED_BYTE, layout.stride,
+                         offset(layout.segment));
+  vertex_array.release();
+  points.release();
+
+  segment_table.setFormat(QOpenGLTexture::RGBA32F);
+  segment_table.setSize(256, 1);
+  segment_table.setMipLevels(1);
+  segment_table.setMinMagFilters(QOpenGLTexture::Nearest,
+                                 QOpenGLTexture::Nearest);
+  segment_table.allocateStorage(QOpenGLTexture::RGBA,
+                                QOpenGLTexture::Float32);
+  shading_table.setFormat(QOpenGLTexture::RG32F);
+  shading_table.setSize(256, 256);
+  shading_table.setMipLevels(1);
+  shading_table.setMinMagFilters(QOpenGLTexture::Nearest,
+                                 QOpenGLTexture::Nearest);
+  shading_table.allocateStorage(QOpenGLTexture::RG, QOpenGLTexture::Float32);
+  // All the segments are visible and the normals are not shaded until the
+  // tables are set
+  setSegments(std::vector<QVector3D>(256), std::vector<float>(256, 1),
+              std::vector<char>(256, true));
+  setShading(std::vector<float>(1 << 16, 1), std::vector<float>(1 << 16, 0));
+}
+
+QOpenGLContext *PointRenderer::getContext() const { return context; }
+
+void PointRenderer::setPoints(const void *data, size_t nb_points) {
+  // Unlike QOpenGLBuffer::allocate, the size is not limited to 2 GiB
+  points.bind();
+  glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(nb_points * stride), data,
+               GL_STATIC_DRAW);
+  points.release();
+}
+
+void PointRenderer::setIndices(const std::vector<uint32_t> &new_indices) {
+  // The index buffer is bound through the vertex array
+  vertex_array.bind();
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               (GLsizeiptr)(new_indices.size() * sizeof(uint32_t)),
+               new_indices.data(), GL_STATIC_DRAW);
+  vertex_array.release();
+}
+
+void PointRenderer::setSegments(const std::vector<QVector3D> &colors,
+                                const std::vector<float> &opacities,
+                                const std::vector<char> &visible) {
+  std::vector<float> texels(4 * 256);
+  for (int segment = 0; segment < 256; segment++) {
+    float *texel = &texels[4 * segment];
+    texel[0] = colors[segment].x();
+    texel[1] = colors[segment].y();
+    texel[2] = colors[segment].z();
+    texel[3] = visible[segment] ? opacities[segment] : -1;
+  }
+  segment_table.setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32,
+                        texels.data());
+}
+
+void PointRenderer::setShading(const std::vector<float> &diffuse,
+                               const std::vector<float> &specular) {
+  std::vector<float> texels(2 << 16);
+  for (int code = 0; code < (1 << 16); code++) {
+    texels[2 * code] = diffuse[code];
+    texels[2 * code + 1] = specular[code];
+  }
+  shading_table.setData(QOpenGLTexture::RG, QOpenGLTexture::Float32,
+                        texels.data());
+}
+
+void PointRenderer::begin(const Frame &frame) {
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_PROGRAM_POINT_SIZE);
+  program.bind();
+  program.setUniformValue("view_projection", frame.view_projection);
+  program.setUniformValue("point_size",
+                          frame.point_size * frame.pixels_per_unit);
+  program.setUniformValue("alpha", frame.alpha);
+  program.setUniformValue("highlight", (GLint)frame.highlight);
+  program.setUniformValue("lighting", (GLint)frame.lighting);
+  program.setUniformValue("window_segment",
+                          (GLuint)TransferFunction::window_segment);
+  segment_table.bind(0);
+  shading_table.bind(1);
+  program.setUniformValue("segment_table", 0);
+  program.setUniformValue("shading_table", 1);
+  vertex_array.bind();
+}
+
+void PointRenderer::draw(size_t first, size_t count) {
+  if (count > 0)
+    glDrawArrays(GL_POINTS, first, count);
+}
+
+void PointRenderer::drawIndexed(size_t first, size_t count) {
+  if (count > 0)
+    glDrawElements(GL_POINTS, count, GL_UNSIGNED_INT,
+                   (const void *)(first * sizeof(uint32_t)));
+}
+
+void PointRenderer::end() {
+  vertex_array.release();
+  shading_table.release(1);
+  segment_table.release(0);
+  program.release();
+}
@@ -0,0 +1,113 @@
+#ifndef POINT_RENDERER_H
+#define POINT_RENDERER_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <QMatrix4x4>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
+#include <QVector3D>
+
+/// Draws points as round sprites with an OpenGL 3.3 core profile context.
+///
+/// The points are uploaded once in a vertex buffer, in the layout they have
+/// in memory, and drawn by ranges or through an index buffer. The size of
+/// the sprites is given in the coordinates of the points and converted to
+/// pixels by the vertex shader, so that it follows the zoom and the
+/// perspective. Colors, opacities and visibility of the segments, and the
+/// shading of the normals, are read from small tables when drawing, so that
+/// changing them does not require to upload the points again.
+///
+/// The resources belong to the context current when the renderer is built,
+/// which has to be current when calling the other methods and when the
+/// renderer is destroyed.
+class PointRenderer : protected QOpenGLExtraFunctions {
+public:
+  /// Offsets of the attributes of a point in memory [bytes]
+  struct PointLayout {
+    int stride;
+    /// 3 floats
+    int position;
+    /// 3 floats in [0;1], used for the points of window_segment
+    int color;
+    /// A double, 1 for the points of the highlighted layer
+    int alpha;
+    /// A uint16_t, see NormalVolume
+    int normal;
+    /// A uint8_t, see TransferFunction
+    int segment;
+  };
+
+  /// The parameters of a frame, see begin
+  struct Frame {
+    QMatrix4x4 view_projection;
+    /// Number of pixels of the viewport per unit of the coordinates of the
+    /// points, at a distance of 1 from the viewer for perspective views
+    float pixels_per_unit;
+    /// Diameter of the sprites in the coordinates of the points
+    float point_size;
+    /// Opacity of the points, multiplied by the opacity of their segment
+    float alpha;
+    /// When enabled, points whose alpha is 1 are opaque
+    bool highlight;
+    /// When enabled, colors are shaded according to the normals
+    bool lighting;
+  };
+
+  /// Compile the shaders and create the buffers in the current context
+  /// Throws std::runtime_error if the shaders can't be built
+  explicit PointRenderer(const PointLayout &layout);
+
+  PointRenderer(const PointRenderer &other) = delete;
+  PointRenderer &operator=(const PointRenderer &other) = delete;
+
+  /// The context owning the resources of the renderer
+  QOpenGLContext *getContext() const;
+
+  /// Upload the points, 'points' holds 'nb_points' points of the layout
+  void setPoints(const void *points, size_t nb_points);
+
+  /// Upload the indices of the points used by drawIndexed
+  void setIndices(const std::vector<uint32_t> &indices);
+
+  /// Set the color, the opacity and the visibility of the 256 segments
+  void setSegments(const std::vector<QVector3D> &colors,
+                   const std::vector<float> &opacities,
+                   const std::vector<char> &visible);
+
+  /// Set the diffuse factor and the specular term of each normal code, see
+  /// GLWidget::getShading
+  void setShading(const std::vector<float> &diffuse,
+                  const std::vector<float> &specular);
+
+  /// Set the state and the uniforms for the draw calls which follow
+  void begin(const Frame &frame);
+  /// Draw the points [first, first + count) of the vertex buffer
+  void draw(size_t first, size_t count);
+  /// Draw the points whose indices are [first, first + count) in the index
+  /// buffer. Points of hidden segments are discarded by the shaders.
+  void drawIndexed(size_t first, size_t count);
+  void end();
+
+private:
+  QOpenGLContext *context;
+  /// Size of a point in memory [bytes]
+  int stride;
+  QOpenGLShaderProgram program;
+  QOpenGLVertexArrayObject vertex_array;
+  QOpenGLBuffer points;
+  QOpenGLBuffer indices;
+  /// Color and opacity of each segment, opacity is negative for hidden
+  /// segments
+  QOpenGLTexture segment_table;
+  /// Diffuse factor and specular term of each normal code, 256x256 texels
+  QOpenGLTexture shading_table;
+};
+
+#endif // POINT_RENDERER_H
@@ -0,0 +1,154 @@
+#include "render_check.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <QFileInfo>
+#include <QMatrix4x4>
+#include <QQuaternion>
+
+#include "glwidget.h"
+#include "offscreen_renderer.h"
+#include "phantom.h"
+
+/// A scene rendered by the check
+struct RenderScene {
+  const char *name;
+  GLWidget::ViewType view_type;
+  /// Rotation of the camera around x and y [deg]
+  float pitch;
+  float yaw;
+  bool contours;
+  bool color;
+  bool lighting;
+  bool depth_sorting;
+  /// Keep the central part of the volume and clip it from the camera
+  bool cropped;
+};
+
+static const std::vector<RenderScene> scenes = {
+    {"ortho_front", GLWidget::ORTHO, 0, 0, false, false, false, false, false},
+    {"ortho_rotated", GLWidget::ORTHO, 30, 45, false, false, false, false,
+     false},
+    {"frustum_rotated", GLWidget::FRUSTUM, 30, 45, false, false, false, false,
+     false},
+    {"ortho_contours", GLWidget::ORTHO, 30, 45, true, false, false, false,
+     false},
+    {"ortho_color", GLWidget::ORTHO, 30, 45, false, true, false, false, false},
+    {"frustum_color_contours", GLWidget::FRUSTUM, -20, 120, true, true, false,
+     false, false},
+    {"ortho_lighting", GLWidget::ORTHO, 30, 45, false, false, true, false,
+     false},
+    // Same cameras with and without depth sorting to compare frame times
+    {"ortho_back", GLWidget::ORTHO, 20, 200, false, true, false, false, false},
+    {"ortho_back_sorted", GLWidget::ORTHO, 20, 200, false, true, false, true,
+     false},
+    {"ortho_rotated_sorted", GLWidget::ORTHO, 30, 45, false, false, false,
+     true, false},
+    {"frustum_rotated_sorted", GLWidget::FRUSTUM, 30, 45, false, false, false,
+     true, false},
+    {"ortho_cropped", GLWidget::ORTHO, 30, 45, false, true, false, false,
+     true},
+};
+
+double compareImages(const QImage &a, const QImage &b, int channel_tolerance,
+                     QImage *diff) {
+  if (a.size() != b.size())
+    return 1;
+  QImage rgb_a = a.convertToFormat(QImage::Format_RGB32);
+  QImage rgb_b = b.convertToFormat(QImage::Format_RGB32);
+  if (diff) {
+    *diff = QImage(a.width(), a.height(), QImage::Format_RGB32);
+    diff->fill(0);
+  }
+  size_t nb_different = 0;
+  for (int y = 0; y < a.height(); y++) {
+    const QRgb *row_a = (const QRgb *)rgb_a.constScanLine(y);
+    const QRgb *row_b = (const QRgb *)rgb_b.constScanLine(y);
+    for (int x = 0; x < a.width(); x++) {
+      int delta = std::max(std::abs(qRed(row_a[x]) - qRed(row_b[x])),
+                           std::abs(qGreen(row_a[x]) - qGreen(row_b[x])));
+      delta = std::max(delta, std::abs(qBlue(row_a[x]) - qBlue(row_b[x])));
+      if (delta <= channel_tolerance)
+        continue;
+      nb_different++;
+      if (diff)
+        ((QRgb *)diff->scanLine(y))[x] = qRgb(255, 0, 0);
+    }
+  }
+  return nb_different / (double)std::max(1, a.width() * a.height());
+}
+
+int runRenderCheck(const RenderCheckOptions &options) {
+  OffscreenRenderer renderer(options.width, options.height);
+  GLWidget widget;
+  widget.setAlpha(0.1);
+  widget.setWinCenter(300);
+  widget.setWinWidth(700);
+  widget.updateVolumicData(createPhantom(96, 96, 40));
+
+  std::ofstream report(options.golden_dir + "/render_report.csv");
+  report << "scene,frame_time_ms,diff_ratio,status" << std::endl;
+  std::cout << std::left << std::setw(24) << "Scene" << std::setw(12)
+            << "Frame [ms]" << std::setw(12) << "Diff" << "Status"
+            << std::endl;
+  int nb_failures = 0;
+  for (const RenderScene &scene : scenes) {
+    widget.setViewType(scene.view_type);
+    QMatrix4x4 transform;
+    transform.rotate(QQuaternion::fromEulerAngles(scene.pitch, scene.yaw, 0));
+    widget.setTransform(transform);
+    widget.onContoursModeChange(scene.contours ? 2 : 0);
+    widget.onColorModeChange(scene.color ? 2 : 0);
+    widget.onLightingModeChange(scene.lighting ? 2 : 0);
+    widget.onDepthSortingChange(scene.depth_sorting ? 2 : 0);
+    GLWidget::CropBox crop_box;
+    widget.clearClipPlanes();
+    if (scene.cropped) {
+      for (int axis = 0; axis < 3; axis++) {
+        crop_box.min[axis] = 0.2;
+        crop_box.max[axis] = 0.8;
+      }
+      widget.addClipPlaneFromView();
+    }
+    widget.setCropBox(crop_box);
+
+    QImage image = renderer.render(widget);
+    double frame_time = renderer.measureFrameTime(widget, options.nb_frames);
+    std::string golden_path = options.golden_dir + "/" + scene.name + ".png";
+    std::string status;
+    double diff_ratio = 0;
+    if (options.update_golden) {
+      if (!image.save(golden_path.c_str()))
+        throw std::runtime_error("Failed to write '" + golden_path + "'");
+      status = "updated";
+    } else if (!QFileInfo(golden_path.c_str()).exists()) {
+      status = "missing golden";
+      nb_failures++;
+      image.save((options.golden_dir + "/" + scene.name + "_actual.png").c_str());
+    } else {
+      QImage golden(golden_path.c_str());
+      QImage diff;
+      diff_ratio = compareImages(image, golden, options.channel_tolerance, &diff);
+      if (diff_ratio <= options.max_diff_ratio) {
+        status = "ok";
+      } else {
+        status = "FAILED";
+        nb_failures++;
+        std::string prefix = options.golden_dir + "/" + scene.name;
+        image.save((prefix + "_actual.png").c_str());
+        diff.save((prefix + "_diff.png").c_str());
+      }
+    }
+    std::cout << std::left << std::setw(24) << scene.name << std::setw(12)
+              << frame_time << std::setw(12) << diff_ratio << status
+              << std::endl;
+    report << scene.name << "," << frame_time << "," << diff_ratio << ","
+           << status << std::endl;
+  }
+  return nb_failures;
+}
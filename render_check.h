@@ -0,0 +1,43 @@
+#ifndef RENDER_CHECK_H
+#define RENDER_CHECK_H
+
+#include <string>
+
+#include <QImage>
+
+/// Options of runRenderCheck
+struct RenderCheckOptions {
+  /// Directory holding the golden images, the report is written there too
+  std::string golden_dir;
+  /// When enabled, golden images are replaced by the rendered images
+  bool update_golden = false;
+  /// Difference on a color channel under which pixels are considered equal
+  int channel_tolerance = 8;
+  /// Maximal ratio of different pixels for an image to match its golden image
+  double max_diff_ratio = 0.001;
+  /// Number of frames rendered to measure the frame time of each scene
+  int nb_frames = 20;
+  int width = 256;
+  int height = 256;
+};
+
+/// Render a fixed set of scenes of the phantom volume offscreen, with several
+/// cameras and display modes, and compare them to the golden images.
+///
+/// For each scene, the median frame time and the ratio of different pixels
+/// are printed and written to 'render_report.csv'. The rendered image of a
+/// scene which does not match is saved next to its golden image with the
+/// suffix '_actual', along with a '_diff' image. A scene without golden
+/// image is a failure, its rendered image is saved with the suffix
+/// '_actual' as well; golden images are only written with 'update_golden'.
+///
+/// Return the number of scenes which do not match their golden image.
+int runRenderCheck(const RenderCheckOptions &options);
+
+/// Return the ratio of pixels having a difference larger than
+/// 'channel_tolerance' on at least one color channel, 1 if the sizes differ.
+/// If 'diff' is provided, it is filled with the differing pixels in red.
+double compareImages(const QImage &a, const QImage &b, int channel_tolerance,
+                     QImage *diff = nullptr);
+
+#endif // RENDER_CHECK_H
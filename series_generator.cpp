@@ -0,0 +1,213 @@
+#include "series_generator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include <dcmtk/dcmdata/dcrleerg.h>
+#include <dcmtk/dcmdata/dctk.h>
+#include <dcmtk/dcmjpeg/djencode.h>
+#include <dcmtk/dcmjpeg/djrplol.h>
+
+#include "parallel.h"
+#include "phantom.h"
+
+/// Offset from the pixels to the values loaded by DicomViewer, as in most CT
+/// series
+static const int rescale_intercept = -1024;
+
+const char *getSyntaxName(SeriesSyntax syntax) {
+  switch (syntax) {
+  case SeriesSyntax::RLE:
+    return "rle";
+  case SeriesSyntax::JPEG_LOSSLESS:
+    return "jpeg-lossless";
+  default:
+    return "uncompressed";
+  }
+}
+
+SeriesSyntax parseSeriesSyntax(const std::string &name) {
+  for (SeriesSyntax syntax :
+       {SeriesSyntax::UNCOMPRESSED, SeriesSyntax::RLE,
+        SeriesSyntax::JPEG_LOSSLESS})
+    if (name == getSyntaxName(syntax))
+      return syntax;
+  throw std::invalid_argument("Unknown transfer syntax '" + name +
+                              "', expected uncompressed, rle or jpeg-lossless");
+}
+
+/// A UID under the 2.25 root derived from 'key', so that the same options
+/// always give the same identifiers
+static std::string getUID(const std::string &key) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (char c : key) {
+    hash ^= (uint8_t)c;
+    hash *= 0x100000001b3ull;
+  }
+  return "2.25." + std::to_string(hash);
+}
+
+/// Format the values of a decimal string (DS) element
+static std::string formatDS(const std::vector<double> &values) {
+  std::ostringstream oss;
+  oss << std::setprecision(10);
+  for (size_t i = 0; i < values.size(); i++)
+    oss << (i > 0 ? "\\" : "") << values[i];
+  return oss.str();
+}
+
+/// Insert a signed short element, for the elements whose representation
+/// depends on the pixel representation
+static OFCondition putSint16(DcmDataset *dataset, const DcmTagKey &tag_key,
+                             Sint16 value) {
+  DcmSignedShort *element = new DcmSignedShort(DcmTag(tag_key, EVR_SS));
+  OFCondition status = element->putSint16(value);
+  if (status.good())
+    status = dataset->insert(element, true);
+  if (status.bad())
+    delete element;
+  return status;
+}
+
+/// Write the file of a layer of the phantom, throws std::runtime_error on
+/// failure
+static void writeSlice(const SeriesGeneratorOptions &options,
+                       const std::string &series_uid, int layer,
+                       const std::vector<Sint16> &pixels,
+                       const std::string &path) {
+  int instance = layer + 1;
+  Sint16 min_pixel = pixels[0];
+  Sint16 max_pixel = pixels[0];
+  for (Sint16 pixel : pixels) {
+    min_pixel = std::min(min_pixel, pixel);
+    max_pixel = std::max(max_pixel, pixel);
+  }
+  // Positions of the centers of the voxels, the volume being centered on
+  // the origin as in createPhantom
+  double x = (1 - options.width) * phantom_pixel_size / 2;
+  double y = (1 - options.height) * phantom_pixel_size / 2;
+  double z = (layer + 0.5 - options.depth / 2.0) * phantom_slice_spacing;
+
+  DcmFileFormat file;
+  DcmDataset *dataset = file.getDataset();
+  OFCondition status = EC_Normal;
+  auto put = [&](const DcmTagKey &tag_key, const std::string &value) {
+    if (status.good())
+      status = dataset->putAndInsertString(tag_key, value.c_str());
+  };
+  auto putUint16 = [&](const DcmTagKey &tag_key, int value) {
+    if (status.good())
+      status = dataset->putAndInsertUint16(tag_key, value);
+  };
+  put(DCM_SOPClassUID, UID_CTImageStorage);
+  put(DCM_SOPInstanceUID, series_uid + "." + std::to_string(instance));
+  put(DCM_StudyInstanceUID, getUID("study"));
+  put(DCM_SeriesInstanceUID, series_uid);
+  put(DCM_Modality, "CT");
+  put(DCM_PatientName, "Phantom^Synthetic");
+  put(DCM_PatientID, "PHANTOM");
+  put(DCM_SeriesDescription, std::string("Synthetic phantom (") +
+                                 getSyntaxName(options.syntax) + ")");
+  put(DCM_SeriesNumber, "1");
+  put(DCM_AcquisitionNumber, "1");
+  put(DCM_InstanceNumber, std::to_string(instance));
+  put(DCM_ImagePositionPatient, formatDS({x, y, z}));
+  put(DCM_ImageOrientationPatient, "1\\0\\0\\0\\1\\0");
+  put(DCM_PixelSpacing, formatDS({phantom_pixel_size, phantom_pixel_size}));
+  put(DCM_SliceThickness, formatDS({phantom_slice_spacing}));
+  put(DCM_WindowCenter, "512");
+  put(DCM_WindowWidth, "1024");
+  put(DCM_RescaleIntercept, std::to_string(rescale_intercept));
+  put(DCM_RescaleSlope, "1");
+  put(DCM_PhotometricInterpretation, "MONOCHROME2");
+  putUint16(DCM_SamplesPerPixel, 1);
+  putUint16(DCM_Rows, options.height);
+  putUint16(DCM_Columns, options.width);
+  putUint16(DCM_BitsAllocated, 16);
+  putUint16(DCM_BitsStored, 16);
+  putUint16(DCM_HighBit, 15);
+  putUint16(DCM_PixelRepresentation, 1);
+  if (status.good())
+    status = putSint16(dataset, DCM_SmallestImagePixelValue, min_pixel);
+  if (status.good())
+    status = putSint16(dataset, DCM_LargestImagePixelValue, max_pixel);
+  if (status.good())
+    status = dataset->putAndInsertUint16Array(
+        DCM_PixelData, (const Uint16 *)pixels.data(), pixels.size());
+  if (status.bad())
+    throw std::runtime_error("Failed to build " + path + ": " + status.text());
+
+  E_TransferSyntax xfer = EXS_LittleEndianExplicit;
+  DJ_RPLossless lossless_parameters;
+  const DcmRepresentationParameter *parameters = nullptr;
+  if (options.syntax == SeriesSyntax::RLE) {
+    xfer = EXS_RLELossless;
+  } else if (options.syntax == SeriesSyntax::JPEG_LOSSLESS) {
+    xfer = EXS_JPEGProcess14SV1;
+    parameters = &lossless_parameters;
+  }
+  if (xfer != EXS_LittleEndianExplicit) {
+    status = dataset->chooseRepresentation(xfer, parameters);
+    if (status.good() && !dataset->canWriteXfer(xfer))
+      status = EC_CannotChangeRepresentation;
+    if (status.bad())
+      throw std::runtime_error("Failed to encode " + path + ": " +
+                               status.text());
+  }
+  status = file.saveFile(path.c_str(), xfer);
+  if (status.bad())
+    throw std::runtime_error("Failed to write " + path + ": " + status.text());
+}
+
+std::vector<std::string> writePhantomSeries(const SeriesGeneratorOptions &options) {
+  if (options.width <= 0 || options.height <= 0 || options.depth <= 0 ||
+      options.width > 65535 || options.height > 65535)
+    throw std::runtime_error("Invalid series size");
+  // Registering the codecs again has no effect
+  DcmRLEEncoderRegistration::registerCodecs();
+  DJEncoderRegistration::registerCodecs();
+
+  std::string series_uid =
+      getUID("series " + std::to_string(options.width) + "x" +
+             std::to_string(options.height) + "x" +
+             std::to_string(options.depth) + " " +
+             getSyntaxName(options.syntax));
+  std::vector<std::string> paths(options.depth);
+  for (int layer = 0; layer < options.depth; layer++) {
+    std::ostringstream oss;
+    oss << options.output_dir << "/slice_" << std::setw(4) << std::setfill('0')
+        << layer + 1 << ".dcm";
+    paths[layer] = oss.str();
+  }
+
+  // Files are encoded in parallel, the first error is reported
+  std::mutex error_mutex;
+  std::string error;
+  size_t layer_size = (size_t)options.width * options.height;
+  parallelFor(0, options.depth, [&](int, int begin, int end) {
+    std::vector<uint16_t> values(layer_size);
+    std::vector<Sint16> pixels(layer_size);
+    for (int layer = begin; layer < end; layer++) {
+      getPhantomLayer(options.width, options.height, options.depth, layer,
+                      values.data());
+      for (size_t i = 0; i < layer_size; i++)
+        pixels[i] = values[i] - rescale_intercept;
+      try {
+        writeSlice(options, series_uid, layer, pixels, paths[layer]);
+      } catch (const std::runtime_error &slice_error) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (error.empty())
+          error = slice_error.what();
+        return;
+      }
+    }
+  });
+  if (!error.empty())
+    throw std::runtime_error(error);
+  return paths;
+}
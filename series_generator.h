@@ -0,0 +1,41 @@
+#ifndef SERIES_GENERATOR_H
+#define SERIES_GENERATOR_H
+
+#include <string>
+#include <vector>
+
+/// Transfer syntaxes of the generated files
+enum class SeriesSyntax { UNCOMPRESSED, RLE, JPEG_LOSSLESS };
+
+/// Options of writePhantomSeries
+struct SeriesGeneratorOptions {
+  /// The directory receiving the files, it must exist
+  std::string output_dir;
+  /// Size of the images [pixels] and number of slices
+  int width = 512;
+  int height = 512;
+  int depth = 128;
+  SeriesSyntax syntax = SeriesSyntax::UNCOMPRESSED;
+};
+
+/// Write the phantom volume (see createPhantom) as a CT series of one file
+/// per slice, named slice_<instance>.dcm with instances starting at 1, and
+/// return the paths of the files.
+///
+/// Pixels are signed 16 bits values with an intercept of -1024, so that the
+/// values loaded by DicomViewer are the stored values of the phantom, whose
+/// materials fall in the segments of the default transfer function. The
+/// identifiers of the study, the series and the instances only depend on the
+/// options: generating a series twice gives the same files, which can be
+/// shared in bug reports instead of patient data.
+///
+/// Throws std::runtime_error if a file can't be encoded or written.
+std::vector<std::string> writePhantomSeries(const SeriesGeneratorOptions &options);
+
+/// Parse the name of a syntax: "uncompressed", "rle" or "jpeg-lossless".
+/// Throws std::invalid_argument for other names.
+SeriesSyntax parseSeriesSyntax(const std::string &name);
+/// The name of a syntax parsed by parseSeriesSyntax
+const char *getSyntaxName(SeriesSyntax syntax);
+
+#endif // SERIES_GENERATOR_H
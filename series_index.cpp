@@ -0,0 +1,287 @@
+#include "series_index.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <locale>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "parallel.h"
+
+/// First line of the index files, to be changed along with their format
+static const char *index_signature = "dicom_viewer series index 1";
+
+/// Number of fields of a line of the index
+static const size_t nb_fields = 24;
+
+/// Fields are separated by tabs and entries by new lines, these characters
+/// are replaced in the strings stored
+static std::string sanitize(const std::string &str) {
+  std::string result = str;
+  std::replace_if(result.begin(), result.end(),
+                  [](char c) { return c == '\t' || c == '\n' || c == '\r'; },
+                  ' ');
+  return result;
+}
+
+static std::vector<std::string> splitFields(const std::string &line) {
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (true) {
+    size_t end = line.find('\t', start);
+    fields.push_back(line.substr(start, end - start));
+    if (end == std::string::npos)
+      return fields;
+    start = end + 1;
+  }
+}
+
+/// Parse a number written by SeriesIndex::save. std::stod depends on the C
+/// locale, which the application sets from the environment: with a decimal
+/// comma, "0.5" would be read as 0. Throws std::invalid_argument on failure.
+static double parseDouble(const std::string &field) {
+  // Not parsed by the streams, but written by them
+  if (field == "nan" || field == "-nan")
+    return std::numeric_limits<double>::quiet_NaN();
+  if (field == "inf" || field == "-inf")
+    return field[0] == '-' ? -std::numeric_limits<double>::infinity()
+                           : std::numeric_limits<double>::infinity();
+  std::istringstream in(field);
+  in.imbue(std::locale::classic());
+  double value;
+  in >> value;
+  if (in.fail() || in.peek() != std::char_traits<char>::eof())
+    throw std::invalid_argument("Invalid number '" + field + "'");
+  return value;
+}
+
+/// Create a directory if it does not exist yet
+static void makeDirectory(const std::string &path) {
+  if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+    throw std::runtime_error("Failed to create directory '" + path +
+                             "': " + strerror(errno));
+}
+
+static std::string getCacheDirectory() {
+  const char *cache_home = getenv("XDG_CACHE_HOME");
+  if (cache_home && cache_home[0] != '\0')
+    return cache_home;
+  const char *home = getenv("HOME");
+  return std::string(home ? home : "/tmp") + "/.cache";
+}
+
+SeriesIndex::SeriesIndex(const std::string &root) : nb_scanned(0) {
+  // The same directory is reached by a single path so that it has a single
+  // index
+  char resolved[PATH_MAX];
+  this->root = realpath(root.c_str(), resolved) ? resolved : root;
+}
+
+std::string SeriesIndex::getIndexPath(const std::string &root) {
+  std::ostringstream name;
+  name << "index_" << std::hex << std::hash<std::string>()(root) << ".tsv";
+  return getCacheDirectory() + "/dicom_viewer/" + name.str();
+}
+
+std::vector<DicomHeader> SeriesIndex::update() {
+  load();
+  std::map<std::string, Entry> found = walk();
+  // Files are read again if their size or their modification time changed
+  std::vector<std::string> paths;
+  for (auto &entry : found) {
+    auto indexed = entries.find(entry.first);
+    if (indexed != entries.end() &&
+        indexed->second.mtime_ns == entry.second.mtime_ns &&
+        indexed->second.size == entry.second.size)
+      entry.second.header = indexed->second.header;
+    else
+      paths.push_back(entry.first);
+  }
+  std::vector<DicomHeader> headers = scanDicomHeaders(paths);
+  for (size_t i = 0; i < paths.size(); i++)
+    found[paths[i]].header = std::move(headers[i]);
+  bool changed = !paths.empty() || found.size() != entries.size();
+  nb_scanned = paths.size();
+  entries = std::move(found);
+  if (changed) {
+    // The index only avoids reading the files again, failing to write it is
+    // not an error
+    try {
+      save();
+    } catch (const std::runtime_error &error) {
+      std::cerr << "Series index not saved: " << error.what() << std::endl;
+    }
+  }
+
+  std::vector<DicomHeader> result;
+  for (const auto &entry : entries)
+    if (entry.second.header.error.empty())
+      result.push_back(entry.second.header);
+  std::stable_sort(result.begin(), result.end(),
+                   [](const DicomHeader &a, const DicomHeader &b) {
+                     return std::tie(a.study_uid, a.series_uid) <
+                            std::tie(b.study_uid, b.series_uid);
+                   });
+  return result;
+}
+
+std::map<std::string, SeriesIndex::Entry> SeriesIndex::walk() const {
+  std::map<std::string, Entry> result;
+  std::vector<std::string> level = {root};
+  int nb_threads = getNbThreads();
+  while (!level.empty()) {
+    // Each thread lists its own directories, results are merged afterwards
+    std::vector<std::vector<std::string>> sub_directories(nb_threads);
+    std::vector<std::vector<std::pair<std::string, Entry>>> files(nb_threads);
+    parallelFor(0, (int)level.size(), [&](int thread_idx, int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        DIR *dir = opendir(level[i].c_str());
+        if (!dir)
+          continue;
+        while (struct dirent *dir_entry = readdir(dir)) {
+          std::string name = dir_entry->d_name;
+          // DICOMDIR only references files which are found by the walk
+          if (name == "." || name == ".." || name == "DICOMDIR")
+            continue;
+          std::string path = level[i] + "/" + name;
+          struct stat status;
+          if (lstat(path.c_str(), &status) != 0)
+            continue;
+          if (S_ISDIR(status.st_mode)) {
+            sub_directories[thread_idx].push_back(path);
+            continue;
+          }
+          // Links to files are followed, links to directories are not to
+          // avoid cycles
+          if (S_ISLNK(status.st_mode) && stat(path.c_str(), &status) != 0)
+            continue;
+          if (!S_ISREG(status.st_mode))
+            continue;
+          Entry entry;
+#ifdef __linux__
+          entry.mtime_ns = (int64_t)status.st_mtim.tv_sec * 1000000000 +
+                           status.st_mtim.tv_nsec;
+#else
+          entry.mtime_ns = (int64_t)status.st_mtime * 1000000000;
+#endif
+          entry.size = status.st_size;
+          files[thread_idx].emplace_back(path, std::move(entry));
+        }
+        closedir(dir);
+      }
+    }, nb_threads);
+    level.clear();
+    for (int thread_idx = 0; thread_idx < nb_threads; thread_idx++) {
+      level.insert(level.end(), sub_directories[thread_idx].begin(),
+                   sub_directories[thread_idx].end());
+      for (auto &file : files[thread_idx])
+        result.insert(std::move(file));
+    }
+  }
+  return result;
+}
+
+void SeriesIndex::load() {
+  entries.clear();
+  std::ifstream in(getIndexPath(root));
+  std::string line;
+  if (!std::getline(in, line) || line != index_signature)
+    return;
+  // Two directories may share the name of their index
+  if (!std::getline(in, line) || line != root)
+    return;
+  try {
+    while (std::getline(in, line)) {
+      std::vector<std::string> fields = splitFields(line);
+      if (fields.size() != nb_fields)
+        throw std::invalid_argument("Invalid number of fields");
+      size_t field = 0;
+      std::string path = fields[field++];
+      Entry &entry = entries[path];
+      entry.mtime_ns = std::stoll(fields[field++]);
+      entry.size = std::stoll(fields[field++]);
+      DicomHeader &header = entry.header;
+      header.error = fields[field++];
+      header.study_uid = fields[field++];
+      header.series_uid = fields[field++];
+      header.series_description = fields[field++];
+      header.patient_name = fields[field++];
+      header.rows = std::stoi(fields[field++]);
+      header.columns = std::stoi(fields[field++]);
+      header.min_value = parseDouble(fields[field++]);
+      header.max_value = parseDouble(fields[field++]);
+      DicomSliceInfo &info = header.info;
+      info.path = path;
+      info.instance_number = std::stoi(fields[field++]);
+      info.acquisition_number = std::stoi(fields[field++]);
+      info.image_position.resize(3);
+      for (double &value : info.image_position)
+        value = parseDouble(fields[field++]);
+      info.pixel_spacing.resize(2);
+      for (double &value : info.pixel_spacing)
+        value = parseDouble(fields[field++]);
+      info.window_center = parseDouble(fields[field++]);
+      info.window_width = parseDouble(fields[field++]);
+      info.slope = parseDouble(fields[field++]);
+      info.intercept = parseDouble(fields[field++]);
+      info.transfer_syntax = (E_TransferSyntax)std::stoi(fields[field++]);
+    }
+  } catch (const std::logic_error &error) {
+    // A corrupted index is rebuilt from the files
+    std::cerr << "Ignoring invalid series index: " << error.what()
+              << std::endl;
+    entries.clear();
+  }
+}
+
+void SeriesIndex::save() const {
+  std::string path = getIndexPath(root);
+  makeDirectory(getCacheDirectory());
+  makeDirectory(path.substr(0, path.rfind('/')));
+  // The index is replaced at once so that readers never see a partial index
+  std::string tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path);
+  if (!out)
+    throw std::runtime_error("Failed to open '" + tmp_path + "'");
+  // Values are written with enough digits to be read back exactly, in the
+  // format expected by parseDouble
+  out.imbue(std::locale::classic());
+  out.precision(17);
+  out << index_signature << "\n" << root << "\n";
+  for (const auto &entry : entries) {
+    if (sanitize(entry.first) != entry.first)
+      continue;
+    const DicomHeader &header = entry.second.header;
+    const DicomSliceInfo &info = header.info;
+    out << entry.first << "\t" << entry.second.mtime_ns << "\t"
+        << entry.second.size << "\t" << sanitize(header.error) << "\t"
+        << sanitize(header.study_uid) << "\t" << sanitize(header.series_uid)
+        << "\t" << sanitize(header.series_description) << "\t"
+        << sanitize(header.patient_name) << "\t" << header.rows << "\t"
+        << header.columns << "\t" << header.min_value << "\t"
+        << header.max_value << "\t" << info.instance_number << "\t"
+        << info.acquisition_number;
+    for (int i = 0; i < 3; i++)
+      out << "\t" << (i < (int)info.image_position.size() ? info.image_position[i] : 0);
+    for (int i = 0; i < 2; i++)
+      out << "\t" << (i < (int)info.pixel_spacing.size() ? info.pixel_spacing[i] : 0);
+    out << "\t" << info.window_center << "\t" << info.window_width << "\t"
+        << info.slope << "\t" << info.intercept << "\t"
+        << (int)info.transfer_syntax << "\n";
+  }
+  out.close();
+  if (!out || rename(tmp_path.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("Failed to write '" + path + "'");
+}
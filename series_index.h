@@ -0,0 +1,61 @@
+#ifndef SERIES_INDEX_H
+#define SERIES_INDEX_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dicom_scan.h"
+
+/// The headers of the files found in a directory tree, stored on disk so that
+/// opening the directory again only reads the files added or modified since.
+///
+/// The index of a directory is kept in the cache directory of the user
+/// ($XDG_CACHE_HOME or ~/.cache), so that read-only exports can be indexed.
+/// Files which are not Dicom files are kept in the index with their error to
+/// avoid reading them each time.
+class SeriesIndex {
+public:
+  /// The index of the directory 'root', nothing is read before update()
+  SeriesIndex(const std::string &root);
+
+  /// Load the index file, walk the directory tree and read the headers of
+  /// the files which are not indexed or have been modified, then save the
+  /// index if it changed.
+  ///
+  /// Return the headers of the Dicom files of the tree sorted by study,
+  /// series and path.
+  std::vector<DicomHeader> update();
+
+  /// Path of the file storing the index of 'root'
+  static std::string getIndexPath(const std::string &root);
+
+  /// Number of headers read from the files by the last update
+  size_t getNbScanned() const { return nb_scanned; }
+
+private:
+  /// A file of the tree along with the properties used to detect changes
+  struct Entry {
+    int64_t mtime_ns;
+    int64_t size;
+    DicomHeader header;
+  };
+
+  /// Replace the entries by the content of the index file, entries are
+  /// cleared if the file is missing or has another format
+  void load();
+  /// Throws std::runtime_error if the index can't be written
+  void save() const;
+
+  /// List the regular files of the tree with their modification time and
+  /// size, directories of a same depth are read in parallel
+  std::map<std::string, Entry> walk() const;
+
+  std::string root;
+  /// Indexed by absolute path
+  std::map<std::string, Entry> entries;
+  size_t nb_scanned;
+};
+
+#endif // SERIES_INDEX_H
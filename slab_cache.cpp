@@ -0,0 +1,173 @@
+#include "slab_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+/// Size targeted for a slab [bytes]
+static const size_t slab_target_size = 8 * 1024 * 1024;
+
+SlabCache::SlabCache(const std::string &path, int layer_size, int depth,
+                     size_t memory_budget)
+    : path(path), layer_size(layer_size), depth(depth) {
+  size_t layer_bytes = std::max<size_t>(1, layer_size * sizeof(uint16_t));
+  slab_layers = std::max<size_t>(1, slab_target_size / layer_bytes);
+  slab_layers = std::min(slab_layers, std::max(depth, 1));
+  // At least 3 slabs are kept to allow access to the neighbors of a layer
+  max_slabs = std::max<size_t>(3, memory_budget / (layer_bytes * slab_layers));
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    throw std::runtime_error("Failed to create cache file '" + path +
+                             "': " + strerror(errno));
+}
+
+std::shared_ptr<SlabCache> SlabCache::createTemporary(int layer_size,
+                                                      int depth,
+                                                      size_t memory_budget) {
+  static std::atomic<int> nb_files(0);
+  const char *tmp_dir = getenv("TMPDIR");
+  std::string path = std::string(tmp_dir ? tmp_dir : "/tmp") +
+                     "/dicom_viewer_" + std::to_string(getpid()) + "_" +
+                     std::to_string(nb_files++) + ".raw";
+  return std::make_shared<SlabCache>(path, layer_size, depth, memory_budget);
+}
+
+SlabCache::~SlabCache() {
+  close(fd);
+  unlink(path.c_str());
+}
+
+void SlabCache::writeLayer(const uint16_t *layer_data, int layer) {
+  if (layer < 0 || layer >= depth)
+    throw std::out_of_range(
+        "Layer " + std::to_string(layer) +
+        " is outside of volume (depth=" + std::to_string(depth) + ")");
+  size_t bytes = (size_t)layer_size * sizeof(uint16_t);
+  off_t offset = (off_t)layer * bytes;
+  const char *src = (const char *)layer_data;
+  size_t written = 0;
+  while (written < bytes) {
+    ssize_t status = pwrite(fd, src + written, bytes - written,
+                            offset + written);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error("Failed to write layer " +
+                               std::to_string(layer) + " to '" + path +
+                               "': " + strerror(errno));
+    }
+    written += status;
+  }
+  // The slab holding the layer is now outdated, as well as a slab being
+  // read from the file
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = slabs.find(layer / slab_layers);
+  if (it != slabs.end()) {
+    lru.erase(it->second);
+    slabs.erase(it);
+  }
+  pending.erase(layer / slab_layers);
+}
+
+std::shared_ptr<const VolumeSlab> SlabCache::getSlab(int layer) {
+  if (layer < 0 || layer >= depth)
+    throw std::out_of_range(
+        "Layer " + std::to_string(layer) +
+        " is outside of volume (depth=" + std::to_string(depth) + ")");
+  int slab_idx = layer / slab_layers;
+  std::unique_lock<std::mutex> lock(mutex);
+  auto it = slabs.find(slab_idx);
+  if (it != slabs.end()) {
+    lru.splice(lru.begin(), lru, it->second);
+    return *it->second;
+  }
+  // A slab being read by another thread is waited for rather than read twice
+  auto pending_it = pending.find(slab_idx);
+  if (pending_it != pending.end()) {
+    std::shared_future<std::shared_ptr<const VolumeSlab>> future =
+        pending_it->second->future;
+    lock.unlock();
+    return future.get();
+  }
+  std::shared_ptr<PendingSlab> pending_slab = std::make_shared<PendingSlab>();
+  pending_slab->future = pending_slab->promise.get_future().share();
+  pending[slab_idx] = pending_slab;
+  lock.unlock();
+
+  // The file is read outside of the lock, so that threads reading other
+  // slabs or using the cached ones do not wait for the disk
+  std::shared_ptr<const VolumeSlab> slab;
+  try {
+    slab = readSlab(slab_idx);
+  } catch (...) {
+    pending_slab->promise.set_exception(std::current_exception());
+    lock.lock();
+    pending_it = pending.find(slab_idx);
+    if (pending_it != pending.end() && pending_it->second == pending_slab)
+      pending.erase(pending_it);
+    throw;
+  }
+  pending_slab->promise.set_value(slab);
+
+  lock.lock();
+  // A layer of the slab written during the read removed the pending slab,
+  // which is then outdated and not cached
+  pending_it = pending.find(slab_idx);
+  if (pending_it == pending.end() || pending_it->second != pending_slab)
+    return slab;
+  pending.erase(pending_it);
+  lru.push_front(slab);
+  slabs[slab_idx] = lru.begin();
+  while (lru.size() > max_slabs) {
+    slabs.erase(lru.back()->first_layer / slab_layers);
+    lru.pop_back();
+  }
+  return slab;
+}
+
+std::shared_ptr<const VolumeSlab> SlabCache::readSlab(int slab_idx) {
+  std::shared_ptr<VolumeSlab> slab(new VolumeSlab());
+  slab->first_layer = slab_idx * slab_layers;
+  slab->nb_layers = std::min(slab_layers, depth - slab->first_layer);
+  slab->layer_size = layer_size;
+  slab->storage.resize((size_t)slab->nb_layers * layer_size);
+  slab->values = slab->storage.data();
+  size_t bytes = slab->storage.size() * sizeof(uint16_t);
+  off_t offset = (off_t)slab->first_layer * layer_size * sizeof(uint16_t);
+  char *dst = (char *)slab->storage.data();
+  size_t read_bytes = 0;
+  while (read_bytes < bytes) {
+    ssize_t status = pread(fd, dst + read_bytes, bytes - read_bytes,
+                           offset + read_bytes);
+    if (status < 0 && errno == EINTR)
+      continue;
+    if (status < 0)
+      throw std::runtime_error("Failed to read slab from '" + path +
+                               "': " + strerror(errno));
+    // Layers which have never been written are read as 0
+    if (status == 0)
+      break;
+    read_bytes += status;
+  }
+  return slab;
+}
+
+int SlabCache::getSlabLayers() const { return slab_layers; }
+
+size_t SlabCache::getMemoryBudget() const {
+  return max_slabs * slab_layers * layer_size * sizeof(uint16_t);
+}
+
+size_t SlabCache::getMemoryUsed() {
+  std::lock_guard<std::mutex> lock(mutex);
+  size_t result = 0;
+  for (const auto &slab : lru)
+    result += slab->storage.size() * sizeof(uint16_t);
+  return result;
+}
@@ -0,0 +1,106 @@
+#ifndef SLAB_CACHE_H
+#define SLAB_CACHE_H
+
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// A block of consecutive layers of a volume available in memory
+class VolumeSlab {
+public:
+  /// Index of the first layer of the slab
+  int first_layer;
+  /// Number of layers in the slab
+  int nb_layers;
+  /// Number of values in a layer
+  int layer_size;
+  /// The values of the slab, layer by layer
+  const uint16_t *values;
+  /// The memory owned by the slab, empty if 'values' points to memory owned
+  /// by another object
+  std::vector<uint16_t> storage;
+
+  bool contains(int layer) const {
+    return layer >= first_layer && layer < first_layer + nb_layers;
+  }
+
+  const uint16_t *getLayer(int layer) const {
+    return values + (size_t)(layer - first_layer) * layer_size;
+  }
+};
+
+/// Stores the layers of a volume in a raw cache file and pages them in memory
+/// by slabs of consecutive layers.
+///
+/// Once the memory budget is exceeded, the least recently used slabs are
+/// dropped from the cache. Slabs are handed out as shared pointers, so a slab
+/// stays valid as long as it is used even if it has been dropped.
+///
+/// All the methods are thread-safe.
+class SlabCache {
+public:
+  /// Create the cache file at 'path', it is removed when the cache is
+  /// destroyed. Throws std::runtime_error if the file can't be created.
+  SlabCache(const std::string &path, int layer_size, int depth,
+            size_t memory_budget);
+  ~SlabCache();
+
+  /// Create a cache backed by a new file in the temporary directory
+  static std::shared_ptr<SlabCache> createTemporary(int layer_size, int depth,
+                                                    size_t memory_budget);
+
+  SlabCache(const SlabCache &other) = delete;
+  SlabCache &operator=(const SlabCache &other) = delete;
+
+  /// Write the values of a layer to the cache file
+  void writeLayer(const uint16_t *layer_data, int layer);
+
+  /// Return the slab containing the given layer, reading it from the cache
+  /// file if it is not in memory. The file is read outside of the lock:
+  /// threads needing other slabs do not wait for the read, threads needing
+  /// the same slab wait for it instead of reading it again.
+  std::shared_ptr<const VolumeSlab> getSlab(int layer);
+
+  /// Number of layers in each slab
+  int getSlabLayers() const;
+
+  /// Maximal memory used by the slabs held by the cache [bytes]
+  size_t getMemoryBudget() const;
+
+  /// Memory currently used by the slabs held by the cache [bytes]
+  size_t getMemoryUsed();
+
+private:
+  /// A slab being read from the file by a thread
+  struct PendingSlab {
+    std::promise<std::shared_ptr<const VolumeSlab>> promise;
+    std::shared_future<std::shared_ptr<const VolumeSlab>> future;
+  };
+
+  /// Read a slab from the cache file
+  std::shared_ptr<const VolumeSlab> readSlab(int slab_idx);
+
+  std::string path;
+  int fd;
+  int layer_size;
+  int depth;
+  int slab_layers;
+  size_t max_slabs;
+
+  std::mutex mutex;
+  /// Slabs in memory, most recently used first
+  std::list<std::shared_ptr<const VolumeSlab>> lru;
+  /// Access to the slabs of 'lru' by slab index
+  std::unordered_map<int, std::list<std::shared_ptr<const VolumeSlab>>::iterator>
+      slabs;
+  /// Slabs being read, removed when one of their layers is written so that
+  /// the outdated values are not cached
+  std::unordered_map<int, std::shared_ptr<PendingSlab>> pending;
+};
+
+#endif // SLAB_CACHE_H
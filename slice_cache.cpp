@@ -0,0 +1,119 @@
+#include "slice_cache.h"
+
+SliceCache::SliceCache(Loader loader, size_t memory_budget, int nb_prefetched)
+    : loader(loader), memory_budget(memory_budget),
+      nb_prefetched(nb_prefetched), memory_used(0), stopping(false) {
+  worker = std::thread(&SliceCache::prefetchLoop, this);
+}
+
+SliceCache::~SliceCache() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    queue.clear();
+  }
+  condition.notify_all();
+  worker.join();
+}
+
+std::shared_ptr<DicomImage> SliceCache::get(int instance,
+                                            const std::string &path) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    auto it = entries.find(instance);
+    if (it != entries.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+      return it->second->image;
+    }
+    // Waiting for the prefetching thread rather than decoding twice
+    if (in_flight.count(instance) == 0)
+      return decode(instance, path, lock);
+    condition.wait(lock);
+  }
+}
+
+void SliceCache::prefetch(int instance, int direction, int min_instance,
+                          int max_instance, const PathFinder &find_path) {
+  if (direction == 0)
+    direction = 1;
+  // Paths are found before locking, the finder may be slow
+  std::deque<std::pair<int, std::string>> requests;
+  for (int i = 1; i <= nb_prefetched; i++) {
+    int next = instance + i * direction;
+    if (next < min_instance || next > max_instance)
+      break;
+    std::string path;
+    if (find_path(next, &path))
+      requests.push_back(std::make_pair(next, path));
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.swap(requests);
+  }
+  condition.notify_all();
+}
+
+void SliceCache::clear() {
+  std::unique_lock<std::mutex> lock(mutex);
+  queue.clear();
+  while (!in_flight.empty())
+    condition.wait(lock);
+  lru.clear();
+  entries.clear();
+  memory_used = 0;
+}
+
+size_t SliceCache::getMemoryUsed() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return memory_used;
+}
+
+void SliceCache::prefetchLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+    if (stopping)
+      return;
+    std::pair<int, std::string> request = queue.front();
+    queue.pop_front();
+    if (entries.count(request.first) > 0 ||
+        in_flight.count(request.first) > 0)
+      continue;
+    decode(request.first, request.second, lock);
+  }
+}
+
+std::shared_ptr<DicomImage>
+SliceCache::decode(int instance, const std::string &path,
+                   std::unique_lock<std::mutex> &lock) {
+  in_flight.insert(instance);
+  lock.unlock();
+  std::shared_ptr<DicomImage> image = loader(path);
+  lock.lock();
+  in_flight.erase(instance);
+  if (image) {
+    Entry entry;
+    entry.instance = instance;
+    entry.image = image;
+    entry.size = getImageSize(image.get());
+    lru.push_front(entry);
+    entries[instance] = lru.begin();
+    memory_used += entry.size;
+    // The slice which has just been decoded is never dropped
+    while (memory_used > memory_budget && lru.size() > 1) {
+      memory_used -= lru.back().size;
+      entries.erase(lru.back().instance);
+      lru.pop_back();
+    }
+  }
+  condition.notify_all();
+  return image;
+}
+
+size_t SliceCache::getImageSize(DicomImage *image) {
+  // Pixel data of the dataset, internal representation and 8-bits rendering
+  // of the 2D view
+  size_t nb_pixels = (size_t)image->getWidth() * image->getHeight();
+  size_t bytes_per_pixel = (image->getDepth() + 7) / 8;
+  return nb_pixels * (2 * bytes_per_pixel + 1);
+}
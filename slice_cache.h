@@ -0,0 +1,100 @@
+#ifndef SLICE_CACHE_H
+#define SLICE_CACHE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <dcmtk/dcmimgle/dcmimage.h>
+
+/// Keeps the decoded slices of a collection in memory for the 2D view.
+///
+/// - Slices are indexed by instance number and dropped in least recently used
+///   order once the memory budget is exceeded
+/// - A background thread decodes in advance the slices following the active
+///   one in the direction the user is scrolling
+///
+/// Slices are handed out as shared pointers, so they stay valid as long as
+/// they are used even if they have been dropped from the cache. The path of
+/// each slice is copied when it is requested, so the loader never accesses
+/// the data of the caller from the prefetching thread.
+class SliceCache {
+public:
+  /// Decode the slice stored in the given file, returns nullptr on failure.
+  /// It is called from the prefetching thread.
+  typedef std::function<std::shared_ptr<DicomImage>(const std::string &)>
+      Loader;
+  /// Set the path of the file of an instance, returns false if the instance
+  /// has no file. It is called from the thread requesting the prefetching.
+  typedef std::function<bool(int, std::string *)> PathFinder;
+
+  SliceCache(Loader loader, size_t memory_budget, int nb_prefetched = 8);
+  ~SliceCache();
+
+  SliceCache(const SliceCache &other) = delete;
+  SliceCache &operator=(const SliceCache &other) = delete;
+
+  /// Return the decoded slice, decoding it from 'path' if it is not
+  /// available yet
+  std::shared_ptr<DicomImage> get(int instance, const std::string &path);
+
+  /// Request the prefetching of the slices following 'instance' in the given
+  /// direction (+1 or -1) within [min_instance, max_instance], the instances
+  /// without file being skipped. Previous requests which have not been
+  /// handled yet are cancelled.
+  void prefetch(int instance, int direction, int min_instance,
+                int max_instance, const PathFinder &find_path);
+
+  /// Drop all the slices and wait for the prefetching thread to be idle, must
+  /// be called before the sources used by the loader are modified
+  void clear();
+
+  /// Memory used by the slices held by the cache [bytes]
+  size_t getMemoryUsed();
+
+private:
+  struct Entry {
+    int instance;
+    std::shared_ptr<DicomImage> image;
+    size_t size;
+  };
+
+  Loader loader;
+  size_t memory_budget;
+  int nb_prefetched;
+
+  std::mutex mutex;
+  /// Notified when a slice has been decoded or a prefetch has been requested
+  std::condition_variable condition;
+  /// Slices in memory, most recently used first
+  std::list<Entry> lru;
+  std::map<int, std::list<Entry>::iterator> entries;
+  size_t memory_used;
+  /// Instances currently being decoded
+  std::set<int> in_flight;
+  /// Instances waiting to be prefetched, with the path of their file
+  std::deque<std::pair<int, std::string>> queue;
+  bool stopping;
+  std::thread worker;
+
+  /// Body of the prefetching thread
+  void prefetchLoop();
+
+  /// Decode a slice which is not in the cache and insert it, 'lock' is
+  /// released during the decoding
+  std::shared_ptr<DicomImage> decode(int instance, const std::string &path,
+                                     std::unique_lock<std::mutex> &lock);
+
+  /// Estimation of the memory used by a decoded slice [bytes]
+  static size_t getImageSize(DicomImage *image);
+};
+
+#endif // SLICE_CACHE_H
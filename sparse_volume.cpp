@@ -0,0 +1,145 @@
+#include "sparse_volume.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#include "parallel.h"
+
+SparseVolume::SparseVolume(VolumicData &volume,
+                           const std::vector<uint8_t> &segments)
+    : width(volume.width), height(volume.height), depth(volume.depth),
+      volume(volume), layers(volume.depth) {
+  if (width > UINT16_MAX)
+    throw std::out_of_range("Volume too wide for a sparse representation: " +
+                            std::to_string(width));
+  // Values of volumes in memory are read in place, the others are copied
+  // until the copies exceed the budget of the storage of the volume
+  size_t value_budget = 0;
+  if (volume.slab_cache)
+    value_budget = volume.slab_cache->getMemoryBudget();
+  else if (volume.compressed)
+    value_budget = volume.compressed->getCacheBudget();
+  std::atomic<bool> copy_values(value_budget > 0);
+  std::atomic<size_t> copied_bytes(0);
+  const uint8_t *lut = segments.data();
+  parallelFor(0, depth, [&](int, int begin, int end) {
+    std::shared_ptr<const VolumeSlab> slab;
+    for (int layer = begin; layer < end; layer++) {
+      if (!slab || !slab->contains(layer))
+        slab = volume.getSlab(layer);
+      const uint16_t *layer_values = slab->getLayer(layer);
+      bool copy_layer = copy_values;
+      Layer &result = layers[layer];
+      result.row_offsets.resize(height + 1);
+      for (int row = 0; row < height; row++) {
+        result.row_offsets[row] = result.runs.size();
+        const uint16_t *row_values = layer_values + row * width;
+        int col = 0;
+        while (col < width) {
+          uint8_t segment = lut[row_values[col]];
+          if (segment == 0) {
+            col++;
+            continue;
+          }
+          Run run;
+          run.col = col;
+          run.segment = segment;
+          run.first_value =
+              copy_layer ? result.values.size() : row * width + col;
+          while (col < width && lut[row_values[col]] == segment) {
+            if (copy_layer)
+              result.values.push_back(row_values[col]);
+            col++;
+          }
+          run.length = col - run.col;
+          result.runs.push_back(run);
+        }
+      }
+      result.row_offsets[height] = result.runs.size();
+      result.runs.shrink_to_fit();
+      result.values.shrink_to_fit();
+      copied_bytes += result.values.size() * sizeof(uint16_t);
+      if (copied_bytes > value_budget)
+        copy_values = false;
+    }
+  });
+  has_values = copy_values;
+  if (has_values)
+    return;
+  // Over the budget, the values already copied are dropped and all the
+  // layers index the values of the volume
+  parallelFor(0, depth, [&](int, int begin, int end) {
+    for (int layer = begin; layer < end; layer++) {
+      Layer &l = layers[layer];
+      if (l.values.empty())
+        continue;
+      for (int row = 0; row < height; row++)
+        for (uint32_t i = l.row_offsets[row]; i < l.row_offsets[row + 1]; i++)
+          l.runs[i].first_value = row * width + l.runs[i].col;
+      std::vector<uint16_t>().swap(l.values);
+    }
+  });
+}
+
+const SparseVolume::Layer &SparseVolume::getLayer(int layer) const {
+  return layers[layer];
+}
+
+const uint16_t *
+SparseVolume::getLayerValues(int layer,
+                             std::shared_ptr<const VolumeSlab> *slab) const {
+  if (has_values)
+    return layers[layer].values.data();
+  if (!*slab || !(*slab)->contains(layer))
+    *slab = volume.getSlab(layer);
+  return (*slab)->getLayer(layer);
+}
+
+bool SparseVolume::hasValues() const { return has_values; }
+
+void SparseVolume::getRowSegments(int row, int layer,
+                                  uint8_t *segments) const {
+  memset(segments, 0, width);
+  const Layer &l = layers[layer];
+  for (uint32_t i = l.row_offsets[row]; i < l.row_offsets[row + 1]; i++)
+    memset(segments + l.runs[i].col, l.runs[i].segment, l.runs[i].length);
+}
+
+int SparseVolume::getVoxel(int col, int row, int layer,
+                           uint16_t *value) const {
+  const Layer &l = layers[layer];
+  // Runs of a row are sorted by column
+  const Run *first = l.runs.data() + l.row_offsets[row];
+  const Run *last = l.runs.data() + l.row_offsets[row + 1];
+  const Run *run = std::upper_bound(
+      first, last, col, [](int c, const Run &r) { return c < r.col; });
+  if (run == first)
+    return 0;
+  run--;
+  if (col >= run->col + run->length)
+    return 0;
+  if (value) {
+    std::shared_ptr<const VolumeSlab> slab;
+    *value = getLayerValues(layer, &slab)[run->first_value + col - run->col];
+  }
+  return run->segment;
+}
+
+size_t SparseVolume::getNbVoxels() const {
+  size_t result = 0;
+  for (const Layer &layer : layers)
+    for (const Run &run : layer.runs)
+      result += run.length;
+  return result;
+}
+
+size_t SparseVolume::getMemoryUsed() const {
+  size_t result = 0;
+  for (const Layer &layer : layers)
+    result += layer.row_offsets.size() * sizeof(uint32_t) +
+              layer.runs.size() * sizeof(Run) +
+              layer.values.size() * sizeof(uint16_t);
+  return result;
+}
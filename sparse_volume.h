@@ -0,0 +1,86 @@
+#ifndef SPARSE_VOLUME_H
+#define SPARSE_VOLUME_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "volumic_data.h"
+
+/// The voxels of a VolumicData which belong to a segment, stored as runs of
+/// consecutive voxels of a same row sharing the same segment.
+///
+/// It is built once for a given segmentation of the values and allows to
+/// visit only the segmented voxels, which are usually a small fraction of
+/// the volume.
+///
+/// The stored values of the segmented voxels are copied only when reading
+/// them from the volume is costly, i.e. when it is out-of-core or
+/// compressed, and only as long as the copies fit in the memory budget of
+/// its storage. Otherwise they are read back from the volume, which must
+/// then outlive the sparse representation.
+class SparseVolume {
+public:
+  /// Consecutive voxels of a row sharing the same segment
+  struct Run {
+    /// Column of the first voxel
+    uint16_t col;
+    /// Number of voxels
+    uint16_t length;
+    uint8_t segment;
+    /// Index of the value of the first voxel in the values returned by
+    /// getLayerValues
+    uint32_t first_value;
+  };
+
+  /// The runs of a layer
+  struct Layer {
+    /// The runs of row 'r' are runs[row_offsets[r]] to runs[row_offsets[r+1]]
+    std::vector<uint32_t> row_offsets;
+    std::vector<Run> runs;
+    /// The stored values of the voxels of the runs, empty if they are read
+    /// from the volume
+    std::vector<uint16_t> values;
+  };
+
+  int width;
+  int height;
+  int depth;
+
+  /// Build the sparse representation of 'volume', 'segments[v]' being the
+  /// segment of the value 'v'. Voxels of segment 0 are not stored.
+  /// Layers are processed in parallel.
+  SparseVolume(VolumicData &volume, const std::vector<uint8_t> &segments);
+
+  const Layer &getLayer(int layer) const;
+
+  /// Return the values indexed by the 'first_value' of the runs of a layer.
+  /// When they are read from the volume, 'slab' receives the slab holding
+  /// them, which must be kept while they are used; it is left unchanged if
+  /// it already contains the layer.
+  const uint16_t *getLayerValues(int layer,
+                                 std::shared_ptr<const VolumeSlab> *slab) const;
+
+  /// True if the values of the voxels are copied in the layers
+  bool hasValues() const;
+
+  /// Fill 'segments' with the segment of the 'width' voxels of a row
+  void getRowSegments(int row, int layer, uint8_t *segments) const;
+
+  /// Return the segment of a voxel, 0 if it is not stored. If the voxel is
+  /// stored and 'value' is provided, it receives its stored value.
+  int getVoxel(int col, int row, int layer, uint16_t *value = nullptr) const;
+
+  /// Total number of voxels stored
+  size_t getNbVoxels() const;
+
+  /// Memory used by the representation [bytes]
+  size_t getMemoryUsed() const;
+
+private:
+  const VolumicData &volume;
+  bool has_values;
+  std::vector<Layer> layers;
+};
+
+#endif // SPARSE_VOLUME_H
@@ -0,0 +1,145 @@
+#include "stream_check.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "phantom.h"
+#include "volume_stream.h"
+
+using namespace volume_stream;
+
+/// The point 'idx' of the published point set
+static StreamPoint getCheckPoint(uint64_t idx) {
+  StreamPoint point;
+  memset(&point, 0, sizeof(point));
+  for (int axis = 0; axis < 3; axis++) {
+    point.position[axis] = (float)((idx >> (8 * axis)) & 0xff);
+    point.color[axis] = (float)((idx + axis) % 7) / 6;
+  }
+  point.opacity = (float)(idx % 11) / 10;
+  point.normal = (uint16_t)(idx * 2654435761u);
+  point.segment = (uint8_t)(idx % 5);
+  return point;
+}
+
+uint64_t runStreamCheck(const StreamCheckOptions &options) {
+  std::unique_ptr<VolumicData> phantom =
+      createPhantom(options.width, options.height, options.depth);
+  size_t layer_size = (size_t)options.width * options.height;
+  size_t volume_bytes = layer_size * options.depth * sizeof(uint16_t);
+  size_t points_bytes = (size_t)options.nb_points * sizeof(StreamPoint);
+  // Everything published fits in the ring, so that the frames are all valid
+  // when they are read, and a volume frame holds a few layers at least
+  size_t capacity = 2 * (volume_bytes + points_bytes) +
+                    16 * layer_size * sizeof(uint16_t) + ((size_t)1 << 20);
+
+  char dir_template[] = "/tmp/dicom_viewer_stream_XXXXXX";
+  if (mkdtemp(dir_template) == nullptr)
+    throw std::runtime_error("Failed to create a temporary directory");
+  std::string socket_path = std::string(dir_template) + "/stream.sock";
+  uint64_t nb_differences = 0;
+  try {
+    VolumeStreamPublisher publisher(socket_path, "/dicom_viewer_check",
+                                    capacity);
+    try {
+      VolumeStreamPublisher other(socket_path, "/dicom_viewer_check_other");
+      std::cout << "A second publisher took over " << socket_path
+                << std::endl;
+      nb_differences++;
+    } catch (const std::runtime_error &error) {
+      std::cout << "Second publisher refused: " << error.what() << std::endl;
+    }
+    VolumeStreamConsumer consumer(socket_path);
+
+    FrameHeader *frame = publisher.beginFrame(POINTS, points_bytes);
+    frame->count = options.nb_points;
+    frame->sizes[0] = options.width;
+    frame->sizes[1] = options.height;
+    frame->sizes[2] = options.depth;
+    StreamPoint *points = (StreamPoint *)(frame + 1);
+    for (int idx = 0; idx < options.nb_points; idx++)
+      points[idx] = getCheckPoint(idx);
+    publisher.endFrame();
+    publisher.publishVolume(*phantom);
+
+    // Each frame is compared in place, then checked like any consumer would
+    uint64_t nb_points = 0, point_differences = 0, voxel_differences = 0;
+    int nb_volume_frames = 0;
+    std::vector<bool> received_layers(options.depth, false);
+    VolumeStreamConsumer::Frame received;
+    while (nb_points == 0 ||
+           std::find(received_layers.begin(), received_layers.end(), false) !=
+               received_layers.end()) {
+      if (!consumer.waitFrame(1000, &received)) {
+        std::cout << "Timeout waiting for the frames" << std::endl;
+        nb_differences++;
+        break;
+      }
+      const FrameHeader &header = *received.header;
+      uint64_t payload_bytes = received.frame_bytes - sizeof(FrameHeader);
+      if (header.kind == POINTS) {
+        nb_points = std::min<uint64_t>(header.count,
+                                       payload_bytes / sizeof(StreamPoint));
+        if (nb_points != (uint64_t)options.nb_points)
+          point_differences += options.nb_points;
+        const StreamPoint *in = (const StreamPoint *)received.payload;
+        for (uint64_t idx = 0; idx < nb_points; idx++) {
+          StreamPoint expected = getCheckPoint(idx);
+          if (memcmp(&in[idx], &expected, sizeof(expected)) != 0)
+            point_differences++;
+        }
+      } else if (header.kind == VOLUME) {
+        nb_volume_frames++;
+        uint64_t count =
+            std::min<uint64_t>(header.count, payload_bytes / sizeof(uint16_t));
+        uint64_t nb_layers = count / layer_size;
+        if (header.sizes[0] != (uint32_t)options.width ||
+            header.sizes[1] != (uint32_t)options.height ||
+            header.sizes[2] != (uint32_t)options.depth ||
+            count % layer_size != 0 ||
+            header.first_layer + nb_layers > (uint64_t)options.depth) {
+          std::cout << "Invalid volume frame " << header.sequence << std::endl;
+          nb_differences++;
+          continue;
+        }
+        const uint16_t *values = (const uint16_t *)received.payload;
+        for (uint64_t idx = 0; idx < nb_layers; idx++) {
+          int layer = header.first_layer + idx;
+          std::shared_ptr<const VolumeSlab> slab = phantom->getSlab(layer);
+          const uint16_t *expected = slab->getLayer(layer);
+          for (size_t value = 0; value < layer_size; value++)
+            if (values[idx * layer_size + value] != expected[value])
+              voxel_differences++;
+          received_layers[layer] = true;
+        }
+      }
+      if (!consumer.isValid(received)) {
+        std::cout << "Frame " << header.sequence << " overwritten"
+                  << std::endl;
+        nb_differences++;
+      }
+    }
+    for (int layer = 0; layer < options.depth; layer++)
+      if (!received_layers[layer])
+        voxel_differences += layer_size;
+    std::cout << "Points: " << nb_points << " received, " << point_differences
+              << " differ" << std::endl;
+    std::cout << "Volume: " << options.width << "x" << options.height << "x"
+              << options.depth << " in " << nb_volume_frames << " frames, "
+              << voxel_differences << " voxels differ" << std::endl;
+    nb_differences += point_differences + voxel_differences;
+  } catch (...) {
+    rmdir(dir_template);
+    throw;
+  }
+  rmdir(dir_template);
+  return nb_differences;
+}
@@ -0,0 +1,25 @@
+#ifndef STREAM_CHECK_H
+#define STREAM_CHECK_H
+
+#include <cstdint>
+
+/// Options of runStreamCheck
+struct StreamCheckOptions {
+  /// Dimensions of the published phantom volume
+  int width = 128;
+  int height = 128;
+  int depth = 64;
+  /// Number of points of the published point set
+  int nb_points = 100000;
+};
+
+/// Publish a point set and the phantom volume with a VolumeStreamPublisher
+/// listening on a temporary socket, receive them with a VolumeStreamConsumer
+/// and compare what is received to what has been published. Also checks
+/// that a second publisher can't take over the socket of the first one.
+///
+/// Return the number of points, voxels and checks which differ. Throws
+/// std::runtime_error if the stream can't be set up.
+uint64_t runStreamCheck(const StreamCheckOptions &options);
+
+#endif // STREAM_CHECK_H
@@ -0,0 +1,164 @@
+#include "task_graph.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+TaskGraph::TaskGraph(int nb_threads)
+    : nb_threads(std::max(1, nb_threads)), nb_queued(0), nb_finished(0),
+      started(false), stopping(false), failed(false) {
+  for (int thread_idx = 0; thread_idx < this->nb_threads; thread_idx++)
+    queues.emplace_back(new Queue());
+}
+
+TaskGraph::~TaskGraph() {
+  if (!started)
+    return;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_finished.wait(lock, [this]() {
+      return nb_finished == (int)nodes.size();
+    });
+    stopping = true;
+  }
+  task_available.notify_all();
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+int TaskGraph::addTask(Task task, const std::vector<int> &dependencies) {
+  if (started)
+    throw std::logic_error("Tasks can't be added to a running graph");
+  int id = nodes.size();
+  std::unique_ptr<Node> node(new Node());
+  node->task = std::move(task);
+  node->nb_pending = 0;
+  for (int dependency : dependencies) {
+    if (dependency < 0 || dependency >= id)
+      throw std::out_of_range("Invalid dependency " +
+                              std::to_string(dependency) + " for task " +
+                              std::to_string(id));
+    nodes[dependency]->dependents.push_back(id);
+    node->nb_pending++;
+  }
+  nodes.push_back(std::move(node));
+  return id;
+}
+
+void TaskGraph::start() {
+  if (started)
+    return;
+  started = true;
+  for (int id = 0; id < (int)nodes.size(); id++)
+    if (nodes[id]->nb_pending == 0)
+      ready.push_back(id);
+  nb_queued = ready.size();
+  for (int thread_idx = 0; thread_idx < nb_threads; thread_idx++)
+    threads.emplace_back(&TaskGraph::runThread, this, thread_idx);
+}
+
+bool TaskGraph::waitFor(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex);
+  return all_finished.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                               [this]() {
+                                 return nb_finished == (int)nodes.size();
+                               });
+}
+
+void TaskGraph::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  all_finished.wait(lock, [this]() {
+    return nb_finished == (int)nodes.size();
+  });
+  if (error)
+    std::rethrow_exception(error);
+}
+
+int TaskGraph::getNbThreads() const { return nb_threads; }
+
+int TaskGraph::getNbFinished() const { return nb_finished; }
+
+void TaskGraph::runThread(int thread_idx) {
+  while (true) {
+    int task;
+    if (popTask(thread_idx, &task)) {
+      runTask(thread_idx, task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    task_available.wait(lock, [this]() { return stopping || nb_queued > 0; });
+    if (stopping)
+      return;
+  }
+}
+
+bool TaskGraph::popTask(int thread_idx, int *task) {
+  if (nb_queued == 0)
+    return false;
+  {
+    Queue &queue = *queues[thread_idx];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = queue.tasks.back();
+      queue.tasks.pop_back();
+      nb_queued--;
+      return true;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!ready.empty()) {
+      *task = ready.front();
+      ready.pop_front();
+      nb_queued--;
+      return true;
+    }
+  }
+  for (int i = 1; i < nb_threads; i++) {
+    Queue &queue = *queues[(thread_idx + i) % nb_threads];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = queue.tasks.front();
+      queue.tasks.pop_front();
+      nb_queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskGraph::runTask(int thread_idx, int task) {
+  Node &node = *nodes[task];
+  if (!failed) {
+    try {
+      node.task(thread_idx);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error)
+        error = std::current_exception();
+      failed = true;
+    }
+  }
+  // The task is released to free what it holds
+  node.task = nullptr;
+  for (int dependent : node.dependents)
+    if (--nodes[dependent]->nb_pending == 0)
+      pushTask(thread_idx, dependent);
+  if (++nb_finished == (int)nodes.size()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    all_finished.notify_all();
+  }
+}
+
+void TaskGraph::pushTask(int thread_idx, int task) {
+  {
+    Queue &queue = *queues[thread_idx];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+    nb_queued++;
+  }
+  // Taking the lock ensures that a thread about to wait sees the task
+  std::lock_guard<std::mutex> lock(mutex);
+  task_available.notify_one();
+}
@@ -0,0 +1,106 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+
+/// Runs a graph of tasks on a pool of threads, each task starting once the
+/// tasks it depends on are finished.
+///
+/// Tasks without dependencies are started in the order they have been
+/// added. When a task finishes, the tasks which were waiting for it are
+/// queued on the thread which ran it and run next by this thread, so that
+/// the data produced by a task is consumed while it is still in the caches.
+/// Threads without queued tasks steal the oldest tasks of the other threads.
+///
+/// Tasks are added before start() is called, then the calling thread is free
+/// to do other work while the graph runs, e.g. showing the progress, and
+/// waits for the end of the graph with waitFor() or wait().
+class TaskGraph {
+public:
+  /// A task receives the index of the thread running it, in
+  /// [0, getNbThreads())
+  typedef std::function<void(int)> Task;
+
+  explicit TaskGraph(int nb_threads = ::getNbThreads());
+  /// Wait for the end of the tasks if the graph has been started
+  ~TaskGraph();
+
+  TaskGraph(const TaskGraph &other) = delete;
+  TaskGraph &operator=(const TaskGraph &other) = delete;
+
+  /// Add a task which starts once all the 'dependencies' are finished and
+  /// return its identifier. Tasks can only depend on tasks added before them.
+  /// Throws std::logic_error if the graph has been started.
+  int addTask(Task task, const std::vector<int> &dependencies = std::vector<int>());
+
+  /// Start running the tasks in the threads of the pool
+  void start();
+
+  /// Wait for the end of the tasks for at most 'timeout_ms', return true if
+  /// they are all finished
+  bool waitFor(int timeout_ms);
+
+  /// Wait for the end of the tasks. If a task threw, the first exception is
+  /// rethrown here; once a task has thrown, the tasks which have not
+  /// started yet are skipped.
+  void wait();
+
+  int getNbThreads() const;
+
+  /// Number of tasks finished or skipped
+  int getNbFinished() const;
+
+private:
+  struct Node {
+    Task task;
+    /// The tasks waiting for this one
+    std::vector<int> dependents;
+    /// Number of dependencies not finished yet
+    std::atomic<int> nb_pending;
+  };
+
+  /// The tasks queued on a thread
+  struct Queue {
+    std::mutex mutex;
+    std::deque<int> tasks;
+  };
+
+  void runThread(int thread_idx);
+  /// Take the next task for a thread: the last one queued on the thread,
+  /// then the first one not started, then one stolen from another thread
+  bool popTask(int thread_idx, int *task);
+  void runTask(int thread_idx, int task);
+  /// Queue a task whose dependencies are finished on a thread
+  void pushTask(int thread_idx, int task);
+
+  int nb_threads;
+  std::vector<std::unique_ptr<Node>> nodes;
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+
+  /// Protects 'ready', 'error' and the waits on the condition variables
+  std::mutex mutex;
+  std::condition_variable task_available;
+  std::condition_variable all_finished;
+  /// The tasks without dependencies, in the order they have been added
+  std::deque<int> ready;
+  /// Number of tasks queued and not started
+  std::atomic<int> nb_queued;
+  std::atomic<int> nb_finished;
+  bool started;
+  bool stopping;
+  std::atomic<bool> failed;
+  std::exception_ptr error;
+};
+
+#endif // TASK_GRAPH_H
@@ -0,0 +1,57 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "series_generator.h"
+
+/// Write a synthetic Dicom series of the phantom volume, see
+/// writePhantomSeries
+/// usage: generate_series <output_dir> [<width> <height> <depth>]
+///                        [--syntax uncompressed|rle|jpeg-lossless]
+int main(int argc, char *argv[]) {
+  SeriesGeneratorOptions options;
+  int nb_sizes = 0;
+  int sizes[3];
+  bool valid = true;
+  for (int i = 1; i < argc && valid; i++) {
+    if (strcmp(argv[i], "--syntax") == 0 && i + 1 < argc) {
+      try {
+        options.syntax = parseSeriesSyntax(argv[++i]);
+      } catch (const std::invalid_argument &error) {
+        std::cerr << error.what() << std::endl;
+        valid = false;
+      }
+    } else if (options.output_dir.empty()) {
+      options.output_dir = argv[i];
+    } else if (nb_sizes < 3) {
+      sizes[nb_sizes++] = atoi(argv[i]);
+    } else {
+      valid = false;
+    }
+  }
+  if (nb_sizes == 3) {
+    options.width = sizes[0];
+    options.height = sizes[1];
+    options.depth = sizes[2];
+  }
+  if (!valid || options.output_dir.empty() || (nb_sizes != 0 && nb_sizes != 3)) {
+    std::cerr << "usage: " << argv[0]
+              << " <output_dir> [<width> <height> <depth>]"
+                 " [--syntax uncompressed|rle|jpeg-lossless]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+  mkdir(options.output_dir.c_str(), 0755);
+  try {
+    std::vector<std::string> paths = writePhantomSeries(options);
+    std::cout << paths.size() << " files written in " << options.output_dir
+              << std::endl;
+  } catch (const std::runtime_error &error) {
+    std::cerr << error.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#-------------------------------------------------
+#
+# Writes synthetic Dicom series of the phantom volume, used to benchmark and
+# check the loading of series without patient data
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = generate_series
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        generate_series.cpp \
+        ../series_generator.cpp \
+        ../phantom.cpp \
+        ../volumic_data.cpp \
+        ../compressed_volume.cpp \
+        ../slab_cache.cpp \
+        ../volume_histogram.cpp
+
+HEADERS += \
+        ../series_generator.h \
+        ../phantom.h \
+        ../parallel.h
+
+LIBS += \
+        -ldcmdata \
+        -ldcmjpeg \
+        -ldcmimgle \
+        -lofstd
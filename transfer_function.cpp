@@ -0,0 +1,134 @@
+#include "transfer_function.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "volume_histogram.h"
+
+const uint8_t TransferFunction::no_segment;
+const uint8_t TransferFunction::window_segment;
+const int TransferFunction::first_segment;
+const int TransferFunction::max_segments;
+
+TransferFunction::TransferFunction(const std::string &name,
+                                   std::vector<Segment> segments)
+    : name(name), segments(std::move(segments)) {
+  if (this->segments.size() > (size_t)max_segments)
+    throw std::invalid_argument("Too many segments in transfer function '" +
+                                name + "'");
+  buildTable();
+}
+
+std::shared_ptr<const TransferFunction> TransferFunction::createDefault() {
+  std::vector<Segment> segments = {
+      {"Bone", 200, 1024, QVector3D(1, 1, 1), 1, true},
+      {"Weakly calcified structures", 100, 200, QVector3D(0.5, 0.5, 0.5), 1,
+       true},
+      {"Grey matter", 37, 45, QVector3D(0, 1, 0), 1, true},
+      {"White matter", 20, 30, QVector3D(1, 0.7, 0), 1, true},
+      {"Water and cerebrospinal fluid", -5, 15, QVector3D(0.2, 0.2, 1), 1,
+       true},
+      {"Fat, lungs and air", -1024, -10, QVector3D(1, 0, 0), 1, true}};
+  return std::make_shared<const TransferFunction>("Default", segments);
+}
+
+std::shared_ptr<const TransferFunction>
+TransferFunction::loadJSON(const std::string &path) {
+  QFile file(path.c_str());
+  if (!file.open(QIODevice::ReadOnly))
+    throw std::runtime_error("Failed to open '" + path + "'");
+  QJsonParseError error;
+  QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+  if (document.isNull())
+    throw std::runtime_error("Invalid JSON in '" + path +
+                             "': " + error.errorString().toStdString());
+  QJsonObject root = document.object();
+  if (!root.value("segments").isArray())
+    throw std::runtime_error("No 'segments' array in '" + path + "'");
+  std::vector<Segment> segments;
+  for (const QJsonValue &value : root.value("segments").toArray()) {
+    QJsonObject object = value.toObject();
+    QJsonArray color = object.value("color").toArray();
+    if (!object.value("min").isDouble() || !object.value("max").isDouble() ||
+        color.size() != 3)
+      throw std::runtime_error("Segment " + std::to_string(segments.size()) +
+                               " of '" + path +
+                               "' requires 'min', 'max' and 'color'");
+    Segment segment;
+    segment.name = object.value("name").toString().toStdString();
+    if (segment.name.empty())
+      segment.name = "Segment " + std::to_string(segments.size() + 1);
+    segment.min = object.value("min").toDouble();
+    segment.max = object.value("max").toDouble();
+    segment.color = QVector3D(color[0].toDouble(), color[1].toDouble(),
+                              color[2].toDouble());
+    segment.opacity = object.value("opacity").toDouble(1);
+    segment.visible = object.value("visible").toBool(true);
+    segments.push_back(segment);
+  }
+  std::string name = root.value("name").toString().toStdString();
+  try {
+    return std::make_shared<const TransferFunction>(name.empty() ? path : name,
+                                                    segments);
+  } catch (const std::invalid_argument &error) {
+    throw std::runtime_error(error.what());
+  }
+}
+
+std::shared_ptr<const TransferFunction>
+TransferFunction::withVisibility(size_t index, bool visible) const {
+  std::shared_ptr<TransferFunction> result =
+      std::make_shared<TransferFunction>(*this);
+  if (index < segments.size())
+    result->segments[index].visible = visible;
+  return result;
+}
+
+bool TransferFunction::isVisible(int segment) const {
+  if (segment == window_segment)
+    return true;
+  size_t index = segment - first_segment;
+  return segment >= first_segment && index < segments.size() &&
+         segments[index].visible;
+}
+
+QVector3D TransferFunction::getColor(int segment, double c) const {
+  if (segment == window_segment)
+    return QVector3D(c, c, c);
+  size_t index = segment - first_segment;
+  if (segment < first_segment || index >= segments.size())
+    return QVector3D(0, 0, 0);
+  return segments[index].color;
+}
+
+double TransferFunction::getOpacity(int segment) const {
+  size_t index = segment - first_segment;
+  if (segment < first_segment || index >= segments.size())
+    return 1;
+  return segments[index].opacity;
+}
+
+void TransferFunction::buildTable() {
+  std::shared_ptr<std::vector<uint8_t>> new_table =
+      std::make_shared<std::vector<uint8_t>>(VolumeHistogram::nb_bins,
+                                             no_segment);
+  // Segments are written from the last one so that the first segment
+  // containing a value wins
+  for (int index = (int)segments.size() - 1; index >= 0; index--) {
+    const Segment &segment = segments[index];
+    double min = std::max(segment.min, 0.0);
+    double max = std::min(segment.max, (double)VolumeHistogram::nb_bins);
+    if (!(min < max))
+      continue;
+    std::fill(new_table->begin() + (int)std::ceil(min),
+              new_table->begin() + (int)std::ceil(max),
+              (uint8_t)(first_segment + index));
+  }
+  table = new_table;
+}
@@ -0,0 +1,90 @@
+#ifndef TRANSFER_FUNCTION_H
+#define TRANSFER_FUNCTION_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QVector3D>
+
+/// Segmentation of the stored values of a volume in ranges shown with their
+/// own color and opacity.
+///
+/// The segments are compiled into a table giving the segment of each of the
+/// 65536 stored values, so that segmenting a voxel is a single lookup.
+/// Transfer functions are immutable, changing a segment produces a new
+/// transfer function, which allows views to share them and to detect changes
+/// by comparing pointers. Hidden segments are part of the table, so
+/// transfer functions differing only by the visibility, the color or the
+/// opacity of their segments share the same table.
+class TransferFunction {
+public:
+  /// Segment of the values which are not shown
+  static const uint8_t no_segment = 0;
+  /// Segment of the values inside the window when colors are not used
+  static const uint8_t window_segment = 1;
+  /// Segment of the first range of the transfer function
+  static const int first_segment = 2;
+  static const int max_segments = 254;
+
+  /// A range of values shown with the same color
+  struct Segment {
+    std::string name;
+    /// Range of stored values [min, max)
+    double min;
+    double max;
+    QVector3D color;
+    /// Factor applied to the opacity of the points of the segment
+    double opacity;
+    bool visible;
+  };
+
+  /// When ranges overlap, values belong to the first segment containing them
+  /// Throws std::invalid_argument if there are more than max_segments
+  TransferFunction(const std::string &name, std::vector<Segment> segments);
+
+  /// The ranges of tissues used before transfer functions were configurable
+  static std::shared_ptr<const TransferFunction> createDefault();
+
+  /// Load a transfer function from a JSON file of the form:
+  ///   {"name": "...", "segments": [{"name": "Bone", "min": 200, "max": 1024,
+  ///    "color": [1, 1, 1], "opacity": 1, "visible": true}, ...]}
+  /// 'opacity' and 'visible' are optional.
+  /// Throws std::runtime_error if the file can't be read or is invalid
+  static std::shared_ptr<const TransferFunction>
+  loadJSON(const std::string &path);
+
+  /// Return a copy of the transfer function with the visibility of the
+  /// segment at 'index' in getSegments() changed, sharing the same table
+  std::shared_ptr<const TransferFunction> withVisibility(size_t index,
+                                                         bool visible) const;
+
+  const std::string &getName() const { return name; }
+  const std::vector<Segment> &getSegments() const { return segments; }
+
+  /// The segment of each stored value, including hidden segments
+  std::shared_ptr<const std::vector<uint8_t>> getTable() const {
+    return table;
+  }
+
+  /// Return true for window_segment and the visible segments
+  bool isVisible(int segment) const;
+
+  /// Color of the points of a segment, 'c' is the value of the point in the
+  /// window [0, 1], used for window_segment
+  QVector3D getColor(int segment, double c) const;
+
+  /// Opacity factor of the points of a segment
+  double getOpacity(int segment) const;
+
+private:
+  /// Fill the table from the segments
+  void buildTable();
+
+  std::string name;
+  std::vector<Segment> segments;
+  std::shared_ptr<const std::vector<uint8_t>> table;
+};
+
+#endif // TRANSFER_FUNCTION_H
@@ -0,0 +1,10 @@
+#include "verbose.h"
+
+#include <atomic>
+
+/// Read from the worker threads
+static std::atomic<bool> verbose_mode(false);
+
+void setVerbose(bool verbose) { verbose_mode = verbose; }
+
+bool isVerbose() { return verbose_mode; }
@@ -0,0 +1,10 @@
+#ifndef VERBOSE_H
+#define VERBOSE_H
+
+/// The diagnostics of the viewer (number of points, memory used by the
+/// intermediate volumes, evicted volumes...) are printed on std::cout only
+/// in verbose mode, enabled by the --verbose option
+void setVerbose(bool verbose);
+bool isVerbose();
+
+#endif // VERBOSE_H
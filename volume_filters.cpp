@@ -0,0 +1,266 @@
+#include "volume_filters.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+
+/// Compute each layer of 'result' from the layers [layer-radius,
+/// layer+radius] of 'volume', clamped to the volume.
+///
+/// 'kernel(layers, output)' receives the 2*radius+1 input layers and fills the
+/// output layer. Chunks of consecutive layers are handled in parallel and the
+/// histogram of 'result' is computed in the same pass.
+template <typename LayerKernel>
+static void filterLayers(VolumicData &volume, VolumicData &result, int radius,
+                         const LayerKernel &kernel) {
+  int D = volume.depth;
+  int layer_size = volume.width * volume.height;
+  int nb_threads = getNbThreads();
+  std::vector<VolumeHistogram> histograms(nb_threads, VolumeHistogram(D));
+  parallelFor(0, D, [&](int thread_idx, int begin, int end) {
+    std::vector<std::shared_ptr<const VolumeSlab>> slabs(2 * radius + 1);
+    std::vector<const uint16_t *> layers(2 * radius + 1);
+    std::vector<uint16_t> output(layer_size);
+    for (int layer = begin; layer < end; layer++) {
+      for (int k = -radius; k <= radius; k++) {
+        int src_layer = std::min(std::max(layer + k, 0), D - 1);
+        std::shared_ptr<const VolumeSlab> &slab = slabs[k + radius];
+        if (!slab || !slab->contains(src_layer))
+          slab = volume.getSlab(src_layer);
+        layers[k + radius] = slab->getLayer(src_layer);
+      }
+      kernel(layers.data(), output.data());
+      result.setStoredLayer(output.data(), layer, &histograms[thread_idx]);
+    }
+  }, nb_threads);
+  for (int thread_idx = 1; thread_idx < nb_threads; thread_idx++)
+    histograms[0].merge(histograms[thread_idx]);
+  result.histogram =
+      std::make_shared<const VolumeHistogram>(std::move(histograms[0]));
+}
+
+/// Normalized gaussian weights from -radius to +radius for the given sigma
+/// expressed in voxels
+static std::vector<float> getGaussianWeights(double sigma) {
+  if (!(sigma > 0.1))
+    return std::vector<float>(1, 1.0f);
+  int radius = std::ceil(3 * sigma);
+  std::vector<float> weights(2 * radius + 1);
+  double sum = 0;
+  for (int k = -radius; k <= radius; k++) {
+    weights[k + radius] = std::exp(-k * k / (2 * sigma * sigma));
+    sum += weights[k + radius];
+  }
+  for (float &weight : weights)
+    weight /= sum;
+  return weights;
+}
+
+/// Copy 'row' in 'padded' with 'radius' values replicated at each border
+static void padRow(const uint16_t *row, int width, int radius,
+                   uint16_t *padded) {
+  std::fill(padded, padded + radius, row[0]);
+  std::copy(row, row + width, padded + radius);
+  std::fill(padded + radius + width, padded + 2 * radius + width,
+            row[width - 1]);
+}
+
+static void roundValues(const float *src, int size, uint16_t *dst) {
+  for (int i = 0; i < size; i++)
+    dst[i] = std::min(std::max(src[i] + 0.5f, 0.0f), 65535.0f);
+}
+
+std::unique_ptr<VolumicData> applyFilter(VolumicData &volume,
+                                         VolumeFilter filter) {
+  switch (filter) {
+  case VolumeFilter::GAUSSIAN:
+    return gaussianFilter(volume, 1.0);
+  case VolumeFilter::MEDIAN:
+    return medianFilter(volume);
+  case VolumeFilter::BILATERAL:
+    return bilateralFilter(volume, 1.0, 50.0);
+  case VolumeFilter::NONE:
+  default:
+    return nullptr;
+  }
+}
+
+std::unique_ptr<VolumicData> gaussianFilter(VolumicData &volume,
+                                            double sigma) {
+  int W = volume.width;
+  int H = volume.height;
+  int layer_size = W * H;
+  std::vector<float> wx = getGaussianWeights(sigma / volume.getVoxelSize(0));
+  std::vector<float> wy = getGaussianWeights(sigma / volume.getVoxelSize(1));
+  std::vector<float> wz = getGaussianWeights(sigma / volume.getVoxelSize(2));
+  int rx = wx.size() / 2;
+  int ry = wy.size() / 2;
+  int rz = wz.size() / 2;
+
+  // First pass smoothes each layer along rows and columns
+  std::unique_ptr<VolumicData> smoothed_layers = volume.createEmptyCopy();
+  filterLayers(volume, *smoothed_layers, 0,
+               [&](const uint16_t *const *layers, uint16_t *output) {
+    std::vector<uint16_t> padded(W + 2 * rx);
+    std::vector<float> rows(layer_size, 0.0f);
+    std::vector<float> acc(W);
+    for (int y = 0; y < H; y++) {
+      padRow(layers[0] + y * W, W, rx, padded.data());
+      float *row = rows.data() + y * W;
+      for (int k = 0; k < (int)wx.size(); k++) {
+        const uint16_t *src = padded.data() + k;
+        float w = wx[k];
+        for (int x = 0; x < W; x++)
+          row[x] += w * src[x];
+      }
+    }
+    for (int y = 0; y < H; y++) {
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      for (int k = -ry; k <= ry; k++) {
+        const float *src = rows.data() + std::min(std::max(y + k, 0), H - 1) * W;
+        float w = wy[k + ry];
+        for (int x = 0; x < W; x++)
+          acc[x] += w * src[x];
+      }
+      roundValues(acc.data(), W, output + y * W);
+    }
+  });
+
+  // Second pass smoothes across layers
+  std::unique_ptr<VolumicData> result = volume.createEmptyCopy();
+  filterLayers(*smoothed_layers, *result, rz,
+               [&](const uint16_t *const *layers, uint16_t *output) {
+    std::vector<float> acc(layer_size, 0.0f);
+    for (int k = 0; k < (int)wz.size(); k++) {
+      const uint16_t *src = layers[k];
+      float w = wz[k];
+      for (int i = 0; i < layer_size; i++)
+        acc[i] += w * src[i];
+    }
+    roundValues(acc.data(), layer_size, output);
+  });
+  return result;
+}
+
+/// Fill 'rows[(dz+1)*3+dy+1]' with the row y+dy of layers[dz+1], padded by one
+/// value on each side
+static void getPaddedNeighborhood(const uint16_t *const *layers, int W, int H,
+                                  int y, std::vector<uint16_t> &buffer,
+                                  const uint16_t *rows[9]) {
+  buffer.resize(9 * (W + 2));
+  for (int i = 0; i < 9; i++) {
+    int src_y = std::min(std::max(y + i % 3 - 1, 0), H - 1);
+    uint16_t *padded = buffer.data() + i * (W + 2);
+    padRow(layers[i / 3] + src_y * W, W, 1, padded);
+    rows[i] = padded;
+  }
+}
+
+/// Element-wise: a[x] = min(a[x],b[x]) and b[x] = max(a[x],b[x])
+static void sortPair(uint16_t *a, uint16_t *b, int size) {
+  for (int x = 0; x < size; x++) {
+    uint16_t low = std::min(a[x], b[x]);
+    uint16_t high = std::max(a[x], b[x]);
+    a[x] = low;
+    b[x] = high;
+  }
+}
+
+std::unique_ptr<VolumicData> medianFilter(VolumicData &volume) {
+  int W = volume.width;
+  int H = volume.height;
+  std::unique_ptr<VolumicData> result = volume.createEmptyCopy();
+  filterLayers(volume, *result, 1,
+               [&](const uint16_t *const *layers, uint16_t *output) {
+    // Forgetful selection applied to whole rows: starting from 15 of the 27
+    // neighbors, the min and the max are repeatedly dropped and replaced by
+    // one of the remaining neighbors. All operations are element-wise so that
+    // they are vectorized along the row.
+    const int nb_neighbors = 27;
+    const int nb_kept = nb_neighbors / 2 + 2;
+    std::vector<uint16_t> buffer;
+    std::vector<uint16_t> work(nb_kept * W);
+    const uint16_t *rows[9];
+    uint16_t *slots[nb_kept];
+    for (int y = 0; y < H; y++) {
+      getPaddedNeighborhood(layers, W, H, y, buffer, rows);
+      auto neighbor = [&](int idx) { return rows[idx / 3] + idx % 3; };
+      for (int i = 0; i < nb_kept; i++) {
+        slots[i] = work.data() + i * W;
+        std::copy(neighbor(i), neighbor(i) + W, slots[i]);
+      }
+      int size = nb_kept;
+      int next = nb_kept;
+      while (true) {
+        for (int i = 1; i < size; i++)
+          sortPair(slots[0], slots[i], W);
+        for (int i = 1; i < size - 1; i++)
+          sortPair(slots[i], slots[size - 1], W);
+        // Dropping min and max
+        uint16_t *free_slot = slots[0];
+        for (int i = 1; i < size - 1; i++)
+          slots[i - 1] = slots[i];
+        size -= 2;
+        if (next == nb_neighbors)
+          break;
+        std::copy(neighbor(next), neighbor(next) + W, free_slot);
+        slots[size++] = free_slot;
+        next++;
+      }
+      std::copy(slots[0], slots[0] + W, output + y * W);
+    }
+  });
+  return result;
+}
+
+std::unique_ptr<VolumicData> bilateralFilter(VolumicData &volume,
+                                             double sigma_space,
+                                             double sigma_range) {
+  int W = volume.width;
+  int H = volume.height;
+  double sx = volume.getVoxelSize(0);
+  double sy = volume.getVoxelSize(1);
+  double sz = volume.getVoxelSize(2);
+  // Spatial weights of the 27 neighbors
+  float space_weights[27];
+  for (int i = 0; i < 27; i++) {
+    double dx = (i % 3 - 1) * sx;
+    double dy = (i / 3 % 3 - 1) * sy;
+    double dz = (i / 9 - 1) * sz;
+    double d2 = dx * dx + dy * dy + dz * dz;
+    space_weights[i] = std::exp(-d2 / (2 * sigma_space * sigma_space));
+  }
+  // Range weights indexed by the absolute difference of values
+  std::vector<float> range_weights(VolumeHistogram::nb_bins);
+  for (int diff = 0; diff < VolumeHistogram::nb_bins; diff++)
+    range_weights[diff] =
+        std::exp(-(double)diff * diff / (2 * sigma_range * sigma_range));
+
+  std::unique_ptr<VolumicData> result = volume.createEmptyCopy();
+  filterLayers(volume, *result, 1,
+               [&](const uint16_t *const *layers, uint16_t *output) {
+    std::vector<uint16_t> buffer;
+    const uint16_t *rows[9];
+    std::vector<float> sum(W), weights(W);
+    for (int y = 0; y < H; y++) {
+      getPaddedNeighborhood(layers, W, H, y, buffer, rows);
+      const uint16_t *center = rows[4] + 1;
+      std::fill(sum.begin(), sum.end(), 0.0f);
+      std::fill(weights.begin(), weights.end(), 0.0f);
+      for (int i = 0; i < 27; i++) {
+        const uint16_t *src = rows[i / 3] + i % 3;
+        float space_weight = space_weights[i];
+        for (int x = 0; x < W; x++) {
+          float w = space_weight * range_weights[std::abs(src[x] - center[x])];
+          sum[x] += w * src[x];
+          weights[x] += w;
+        }
+      }
+      for (int x = 0; x < W; x++)
+        sum[x] /= weights[x];
+      roundValues(sum.data(), W, output + y * W);
+    }
+  });
+  return result;
+}
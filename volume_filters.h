@@ -0,0 +1,31 @@
+#ifndef VOLUME_FILTERS_H
+#define VOLUME_FILTERS_H
+
+#include <memory>
+
+#include "volumic_data.h"
+
+/// The preprocessing filters which can be applied to a VolumicData before
+/// extracting display points and contours
+enum class VolumeFilter { NONE, GAUSSIAN, MEDIAN, BILATERAL };
+
+/// Apply the given filter with its default parameters
+/// return nullptr for VolumeFilter::NONE
+std::unique_ptr<VolumicData> applyFilter(VolumicData &volume,
+                                         VolumeFilter filter);
+
+/// Separable gaussian smoothing, 'sigma' is expressed in mm and converted to
+/// voxels along each axis according to the spacing of the volume
+std::unique_ptr<VolumicData> gaussianFilter(VolumicData &volume, double sigma);
+
+/// Median of the 3x3x3 neighborhood of each voxel
+std::unique_ptr<VolumicData> medianFilter(VolumicData &volume);
+
+/// Edge-preserving smoothing over the 3x3x3 neighborhood: neighbors are
+/// weighted by their distance ('sigma_space' in mm) and by their difference
+/// of value with the voxel ('sigma_range' in stored values)
+std::unique_ptr<VolumicData> bilateralFilter(VolumicData &volume,
+                                             double sigma_space,
+                                             double sigma_range);
+
+#endif // VOLUME_FILTERS_H
@@ -0,0 +1,154 @@
+#include "volume_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+VolumeHistogram::VolumeHistogram(int depth)
+    : bins(nb_bins, 0), layers(depth), min(UINT16_MAX), max(0), total(0) {}
+
+void VolumeHistogram::addLayer(const uint16_t *layer_data, int size,
+                               int layer) {
+  if (size <= 0)
+    return;
+  if (layer >= (int)layers.size())
+    layers.resize(layer + 1);
+  LayerHistogram &layer_histogram = layers[layer];
+  getMinMax16(layer_data, size, &layer_histogram.min, &layer_histogram.max);
+  // Bins are only allocated for the values used in the layer
+  layer_histogram.bins.assign(layer_histogram.max - layer_histogram.min + 1,
+                              0);
+  uint32_t *layer_bins = layer_histogram.bins.data();
+  int offset = layer_histogram.min;
+  for (int i = 0; i < size; i++)
+    layer_bins[layer_data[i] - offset]++;
+  for (size_t i = 0; i < layer_histogram.bins.size(); i++)
+    bins[offset + i] += layer_bins[i];
+  min = std::min(min, layer_histogram.min);
+  max = std::max(max, layer_histogram.max);
+  total += size;
+}
+
+void VolumeHistogram::merge(VolumeHistogram &other) {
+  if (other.empty())
+    return;
+  for (int value = other.min; value <= other.max; value++)
+    bins[value] += other.bins[value];
+  if (other.layers.size() > layers.size())
+    layers.resize(other.layers.size());
+  for (size_t layer = 0; layer < other.layers.size(); layer++) {
+    if (!other.layers[layer].bins.empty())
+      layers[layer] = std::move(other.layers[layer]);
+  }
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+  total += other.total;
+}
+
+bool VolumeHistogram::empty() const { return total == 0; }
+
+uint16_t VolumeHistogram::getMin() const { return min; }
+
+uint16_t VolumeHistogram::getMax() const { return max; }
+
+uint64_t VolumeHistogram::getCount() const { return total; }
+
+uint64_t VolumeHistogram::getBin(int value) const {
+  if (value < 0 || value >= nb_bins)
+    return 0;
+  return bins[value];
+}
+
+const VolumeHistogram::LayerHistogram *
+VolumeHistogram::getLayer(int layer) const {
+  if (layer < 0 || layer >= (int)layers.size() || layers[layer].bins.empty())
+    return nullptr;
+  return &layers[layer];
+}
+
+double VolumeHistogram::getPercentile(double ratio) const {
+  if (empty())
+    return 0;
+  uint64_t target = std::ceil(std::max(0.0, std::min(1.0, ratio)) * total);
+  uint64_t cumulated = 0;
+  for (int value = min; value <= max; value++) {
+    cumulated += bins[value];
+    if (cumulated >= target && cumulated > 0)
+      return value;
+  }
+  return max;
+}
+
+void VolumeHistogram::getAutoWindow(double low, double high, double *center,
+                                    double *width) const {
+  double win_min = getPercentile(low);
+  double win_max = getPercentile(high);
+  if (center)
+    *center = (win_min + win_max) / 2;
+  if (width)
+    *width = std::max(1.0, win_max - win_min);
+}
+
+uint64_t VolumeHistogram::count(const std::function<bool(uint16_t)> &accepted,
+                                int layer_start, int layer_end) const {
+  if (empty())
+    return 0;
+  // Evaluating 'accepted' once per value used in the volume
+  std::vector<char> mask(max - min + 1);
+  for (int value = min; value <= max; value++)
+    mask[value - min] = accepted(value);
+  layer_start = std::max(layer_start, 0);
+  layer_end = std::min(layer_end, (int)layers.size());
+  bool whole_volume = layer_start == 0 && layer_end == (int)layers.size();
+  uint64_t result = 0;
+  if (whole_volume) {
+    for (int value = min; value <= max; value++)
+      if (mask[value - min])
+        result += bins[value];
+    return result;
+  }
+  for (int layer = layer_start; layer < layer_end; layer++) {
+    const LayerHistogram &layer_histogram = layers[layer];
+    const char *layer_mask = mask.data() + (layer_histogram.min - min);
+    for (size_t i = 0; i < layer_histogram.bins.size(); i++)
+      if (layer_mask[i])
+        result += layer_histogram.bins[i];
+  }
+  return result;
+}
+
+void getMinMax16(const uint16_t *data, int size, uint16_t *min,
+                 uint16_t *max) {
+  uint16_t result_min = UINT16_MAX;
+  uint16_t result_max = 0;
+  int i = 0;
+#ifdef __SSE2__
+  // SSE2 only provides signed 16-bit min/max: flipping the sign bit maps the
+  // unsigned order onto the signed one
+  const __m128i sign = _mm_set1_epi16((short)0x8000);
+  __m128i vec_min = _mm_set1_epi16(0x7FFF);
+  __m128i vec_max = _mm_set1_epi16((short)0x8000);
+  for (; i + 8 <= size; i += 8) {
+    __m128i values =
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i)), sign);
+    vec_min = _mm_min_epi16(vec_min, values);
+    vec_max = _mm_max_epi16(vec_max, values);
+  }
+  uint16_t lanes_min[8], lanes_max[8];
+  _mm_storeu_si128((__m128i *)lanes_min, _mm_xor_si128(vec_min, sign));
+  _mm_storeu_si128((__m128i *)lanes_max, _mm_xor_si128(vec_max, sign));
+  for (int lane = 0; lane < 8 && size >= 8; lane++) {
+    result_min = std::min(result_min, lanes_min[lane]);
+    result_max = std::max(result_max, lanes_max[lane]);
+  }
+#endif
+  for (; i < size; i++) {
+    result_min = std::min(result_min, data[i]);
+    result_max = std::max(result_max, data[i]);
+  }
+  *min = result_min;
+  *max = result_max;
+}
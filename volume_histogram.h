@@ -0,0 +1,75 @@
+#ifndef VOLUME_HISTOGRAM_H
+#define VOLUME_HISTOGRAM_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/// A 16-bit histogram of the values stored in a VolumicData, kept both for the
+/// whole volume and for each layer.
+///
+/// It is designed to be filled by several threads: each thread fills its own
+/// VolumeHistogram with the layers it handles, then all the partial
+/// histograms are merged.
+class VolumeHistogram {
+public:
+  static const int nb_bins = 65536;
+
+  /// The histogram of a single layer, restricted to the values used
+  struct LayerHistogram {
+    uint16_t min;
+    uint16_t max;
+    /// bins[i] is the number of voxels with value 'min + i'
+    std::vector<uint32_t> bins;
+  };
+
+  VolumeHistogram(int depth = 0);
+
+  /// Add the 'size' values of 'layer_data' to the histogram of the volume and
+  /// to the histogram of the given layer
+  void addLayer(const uint16_t *layer_data, int size, int layer);
+
+  /// Add the content of 'other' to this histogram. The layers filled in
+  /// 'other' are moved to this histogram.
+  void merge(VolumeHistogram &other);
+
+  /// Return true if no value has been added to the histogram
+  bool empty() const;
+
+  uint16_t getMin() const;
+  uint16_t getMax() const;
+  uint64_t getCount() const;
+
+  /// The number of voxels with the given value in the whole volume
+  uint64_t getBin(int value) const;
+
+  /// Return the histogram of a layer, nullptr if it has not been filled
+  const LayerHistogram *getLayer(int layer) const;
+
+  /// Return the smallest value v such that at least 'ratio' of the voxels are
+  /// lower or equal to v, ratio in [0;1]
+  double getPercentile(double ratio) const;
+
+  /// Suggest a window covering the values between the 'low' and 'high'
+  /// percentiles (ratios in [0;1])
+  void getAutoWindow(double low, double high, double *center,
+                     double *width) const;
+
+  /// Number of voxels of layers [layer_start, layer_end) whose value is
+  /// accepted by 'accepted'
+  uint64_t count(const std::function<bool(uint16_t)> &accepted,
+                 int layer_start, int layer_end) const;
+
+private:
+  std::vector<uint64_t> bins;
+  std::vector<LayerHistogram> layers;
+  uint16_t min;
+  uint16_t max;
+  uint64_t total;
+};
+
+/// Fill min and max with the extremum values of 'data', using SIMD
+/// instructions when available
+void getMinMax16(const uint16_t *data, int size, uint16_t *min, uint16_t *max);
+
+#endif // VOLUME_HISTOGRAM_H
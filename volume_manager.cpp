@@ -0,0 +1,89 @@
+#include "volume_manager.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include "verbose.h"
+
+std::string DicomSeries::getLabel() const {
+  std::string name = description.empty() ? uid : description;
+  return name + " (" + patient_name + ", " + std::to_string(slices.size()) +
+         " slices)";
+}
+
+VolumeManager::VolumeManager(size_t memory_budget)
+    : memory_budget(memory_budget), next_id(0) {}
+
+int VolumeManager::addSeries(std::unique_ptr<DicomSeries> new_series) {
+  int id = next_id++;
+  series[id] = std::move(new_series);
+  return id;
+}
+
+void VolumeManager::removeSeries(int id) {
+  series.erase(id);
+  volumes.erase(id);
+  lru.remove(id);
+}
+
+DicomSeries *VolumeManager::getSeries(int id) {
+  auto it = series.find(id);
+  if (it == series.end())
+    return nullptr;
+  return it->second.get();
+}
+
+std::vector<int> VolumeManager::getSeriesIds() const {
+  std::vector<int> result;
+  for (const auto &entry : series)
+    result.push_back(entry.first);
+  return result;
+}
+
+std::shared_ptr<const VolumicData> VolumeManager::getVolume(int id) {
+  auto it = volumes.find(id);
+  if (it == volumes.end())
+    return nullptr;
+  lru.remove(id);
+  lru.push_front(id);
+  return it->second;
+}
+
+void VolumeManager::setVolume(int id,
+                              std::shared_ptr<const VolumicData> volume) {
+  if (series.count(id) == 0)
+    throw std::out_of_range("No series with id " + std::to_string(id));
+  lru.remove(id);
+  if (!volume) {
+    volumes.erase(id);
+    return;
+  }
+  volumes[id] = volume;
+  lru.push_front(id);
+  evict(id);
+}
+
+size_t VolumeManager::getMemoryUsed() const {
+  size_t result = 0;
+  for (const auto &entry : volumes)
+    result += entry.second->getMemoryUsed();
+  return result;
+}
+
+size_t VolumeManager::getMemoryBudget() const { return memory_budget; }
+
+void VolumeManager::evict(int kept_id) {
+  size_t used = getMemoryUsed();
+  auto it = lru.end();
+  while (used > memory_budget && it != lru.begin()) {
+    --it;
+    if (*it == kept_id)
+      continue;
+    used -= volumes[*it]->getMemoryUsed();
+    if (isVerbose())
+      std::cout << "Evicting volume of series '" << series[*it]->getLabel()
+                << "'" << std::endl;
+    volumes.erase(*it);
+    it = lru.erase(it);
+  }
+}
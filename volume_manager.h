@@ -0,0 +1,87 @@
+#ifndef VOLUME_MANAGER_H
+#define VOLUME_MANAGER_H
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dicom_slice_info.h"
+#include "volumic_data.h"
+
+/// The properties of a series of slices opened in the viewer
+struct DicomSeries {
+  /// The SeriesInstanceUID shared by all the slices
+  std::string uid;
+  std::string description;
+  std::string patient_name;
+
+  /// The properties of the slices, indexed by instance number
+  std::map<int, DicomSliceInfo> slices;
+
+  /// Minimal value used among the whole series
+  double collection_min;
+  /// Maximal value used among the whole series
+  double collection_max;
+
+  /// The size of a pixel [mm]
+  double pixel_width;
+  double pixel_height;
+  /// The space between two consecutive slices [mm], 0 for a single slice
+  double slice_spacing;
+
+  /// The name shown to the user to choose the series
+  std::string getLabel() const;
+};
+
+/// Holds the series opened in the viewer along with their volumes.
+///
+/// Volumes are shared with the views using them: views receive copies of the
+/// VolumicData which share their storage, so that switching between series
+/// neither reloads nor decodes any file. When the volumes exceed the memory
+/// budget, the least recently used ones are evicted, their series are kept
+/// and their volumes have to be built again before being used.
+class VolumeManager {
+public:
+  VolumeManager(size_t memory_budget);
+
+  /// Add a series to the manager and return its identifier
+  int addSeries(std::unique_ptr<DicomSeries> series);
+
+  /// Remove the series and its volume
+  void removeSeries(int id);
+
+  /// Return the series with the given identifier, nullptr if there is none
+  DicomSeries *getSeries(int id);
+
+  /// Identifiers of the series, in the order they have been added
+  std::vector<int> getSeriesIds() const;
+
+  /// Return the volume of the series, nullptr if it has not been built or if
+  /// it has been evicted. The volume is marked as the most recently used.
+  std::shared_ptr<const VolumicData> getVolume(int id);
+
+  /// Set the volume of a series and evict the volumes of other series if
+  /// the memory budget is exceeded
+  void setVolume(int id, std::shared_ptr<const VolumicData> volume);
+
+  /// Memory used by the volumes held [bytes]
+  size_t getMemoryUsed() const;
+
+  size_t getMemoryBudget() const;
+
+private:
+  /// Evict the least recently used volumes except the one of 'kept_id'
+  /// until the memory budget is respected
+  void evict(int kept_id);
+
+  size_t memory_budget;
+  int next_id;
+  std::map<int, std::unique_ptr<DicomSeries>> series;
+  std::map<int, std::shared_ptr<const VolumicData>> volumes;
+  /// Identifiers of the series having a volume, most recently used first
+  std::list<int> lru;
+};
+
+#endif // VOLUME_MANAGER_H
@@ -0,0 +1,182 @@
+#include "volume_resampling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "parallel.h"
+
+/// The input samples used to interpolate each output sample along one axis.
+/// Indices and weights are stored tap by tap so that the loops over the
+/// output samples access contiguous memory.
+struct AxisTaps {
+  int nb_taps;
+  int out_size;
+  /// indices[tap * out_size + out_idx], already clamped to the input
+  std::vector<int> indices;
+  /// weights[tap * out_size + out_idx]
+  std::vector<float> weights;
+
+  int getIndex(int tap, int out_idx) const {
+    return indices[tap * out_size + out_idx];
+  }
+  float getWeight(int tap, int out_idx) const {
+    return weights[tap * out_size + out_idx];
+  }
+};
+
+/// Number of output samples covering 'in_size' input samples
+static int getResampledSize(int in_size, double in_spacing,
+                            double out_spacing) {
+  // Tolerance avoids losing the last sample to rounding errors
+  return std::floor((in_size - 1) * in_spacing / out_spacing + 1e-6) + 1;
+}
+
+static AxisTaps getAxisTaps(int in_size, double in_spacing, int out_size,
+                            double out_spacing, Interpolation interpolation) {
+  AxisTaps result;
+  result.nb_taps = interpolation == Interpolation::CUBIC ? 4 : 2;
+  result.out_size = out_size;
+  result.indices.resize(result.nb_taps * out_size);
+  result.weights.resize(result.nb_taps * out_size);
+  // Offset of the first tap relatively to the sample before the position
+  int first_tap = interpolation == Interpolation::CUBIC ? -1 : 0;
+  for (int out_idx = 0; out_idx < out_size; out_idx++) {
+    double pos = out_idx * out_spacing / in_spacing;
+    int before = std::floor(pos);
+    float t = pos - before;
+    float w[4];
+    if (interpolation == Interpolation::CUBIC) {
+      // Catmull-Rom
+      float t2 = t * t;
+      float t3 = t2 * t;
+      w[0] = (-t3 + 2 * t2 - t) / 2;
+      w[1] = (3 * t3 - 5 * t2 + 2) / 2;
+      w[2] = (-3 * t3 + 4 * t2 + t) / 2;
+      w[3] = (t3 - t2) / 2;
+    } else {
+      w[0] = 1 - t;
+      w[1] = t;
+    }
+    for (int tap = 0; tap < result.nb_taps; tap++) {
+      int idx = std::min(std::max(before + first_tap + tap, 0), in_size - 1);
+      result.indices[tap * out_size + out_idx] = idx;
+      result.weights[tap * out_size + out_idx] = w[tap];
+    }
+  }
+  return result;
+}
+
+double getIsotropicSpacing(const VolumicData &volume) {
+  double result = volume.getVoxelSize(0);
+  result = std::min(result, volume.getVoxelSize(1));
+  if (volume.depth > 1)
+    result = std::min(result, volume.getVoxelSize(2));
+  return result;
+}
+
+/// Create the volume receiving the result of resampleVolume
+static std::unique_ptr<VolumicData>
+createResampledVolume(const VolumicData &volume, int W, int H, int D,
+                      size_t memory_budget) {
+  size_t layer_size = (size_t)W * H;
+  size_t bytes = layer_size * D * sizeof(uint16_t);
+  std::unique_ptr<VolumicData> result;
+  if (volume.isCompressed() && bytes <= 2 * memory_budget) {
+    std::shared_ptr<CompressedVolume> storage = std::make_shared<CompressedVolume>(
+        W, H, D, volume.compressed->getCacheBudget());
+    result.reset(new VolumicData(W, H, D, volume.win_min, volume.win_max,
+                                 volume.intercept, storage));
+  } else if (bytes > memory_budget) {
+    std::shared_ptr<SlabCache> cache =
+        SlabCache::createTemporary(layer_size, D, memory_budget);
+    result.reset(new VolumicData(W, H, D, volume.win_min, volume.win_max,
+                                 volume.intercept, cache));
+  } else {
+    result.reset(new VolumicData(W, H, D, volume.win_min, volume.win_max,
+                                 volume.intercept));
+  }
+  return result;
+}
+
+std::unique_ptr<VolumicData> resampleVolume(VolumicData &volume,
+                                            double spacing,
+                                            Interpolation interpolation,
+                                            size_t memory_budget) {
+  if (volume.width <= 0 || volume.height <= 0 || volume.depth <= 0)
+    throw std::logic_error("Can't resample an empty volume");
+  if (!(spacing > 0))
+    spacing = getIsotropicSpacing(volume);
+  int W = volume.width;
+  int H = volume.height;
+  int D = volume.depth;
+  double sx = volume.getVoxelSize(0);
+  double sy = volume.getVoxelSize(1);
+  double sz = volume.getVoxelSize(2);
+  int out_W = getResampledSize(W, sx, spacing);
+  int out_H = getResampledSize(H, sy, spacing);
+  int out_D = getResampledSize(D, sz, spacing);
+  AxisTaps x_taps = getAxisTaps(W, sx, out_W, spacing, interpolation);
+  AxisTaps y_taps = getAxisTaps(H, sy, out_H, spacing, interpolation);
+  AxisTaps z_taps = getAxisTaps(D, sz, out_D, spacing, interpolation);
+  int nb_taps = x_taps.nb_taps;
+
+  std::unique_ptr<VolumicData> result =
+      createResampledVolume(volume, out_W, out_H, out_D, memory_budget);
+  result->pixel_width = spacing;
+  result->pixel_height = spacing;
+  result->slice_spacing = volume.slice_spacing < 0 ? -spacing : spacing;
+
+  // Each output layer is interpolated separately: first along z into a
+  // buffer with the size of an input layer, then along y row by row and
+  // finally along x.
+  int nb_threads = getNbThreads();
+  std::vector<VolumeHistogram> histograms(nb_threads, VolumeHistogram(out_D));
+  parallelFor(0, out_D, [&](int thread_idx, int begin, int end) {
+    std::vector<std::shared_ptr<const VolumeSlab>> slabs(nb_taps);
+    std::vector<float> plane(W * H);
+    std::vector<float> row(W);
+    std::vector<float> acc(out_W);
+    std::vector<uint16_t> output(out_W * out_H);
+    for (int layer = begin; layer < end; layer++) {
+      std::fill(plane.begin(), plane.end(), 0.0f);
+      for (int tap = 0; tap < nb_taps; tap++) {
+        int src_layer = z_taps.getIndex(tap, layer);
+        float w = z_taps.getWeight(tap, layer);
+        if (w == 0)
+          continue;
+        std::shared_ptr<const VolumeSlab> &slab = slabs[tap];
+        if (!slab || !slab->contains(src_layer))
+          slab = volume.getSlab(src_layer);
+        const uint16_t *src = slab->getLayer(src_layer);
+        for (int i = 0; i < W * H; i++)
+          plane[i] += w * src[i];
+      }
+      for (int y = 0; y < out_H; y++) {
+        std::fill(row.begin(), row.end(), 0.0f);
+        for (int tap = 0; tap < nb_taps; tap++) {
+          const float *src = plane.data() + y_taps.getIndex(tap, y) * W;
+          float w = y_taps.getWeight(tap, y);
+          for (int x = 0; x < W; x++)
+            row[x] += w * src[x];
+        }
+        std::fill(acc.begin(), acc.end(), 0.0f);
+        for (int tap = 0; tap < nb_taps; tap++) {
+          const int *indices = x_taps.indices.data() + tap * out_W;
+          const float *weights = x_taps.weights.data() + tap * out_W;
+          for (int x = 0; x < out_W; x++)
+            acc[x] += weights[x] * row[indices[x]];
+        }
+        uint16_t *dst = output.data() + y * out_W;
+        for (int x = 0; x < out_W; x++)
+          dst[x] = std::min(std::max(acc[x] + 0.5f, 0.0f), 65535.0f);
+      }
+      result->setStoredLayer(output.data(), layer, &histograms[thread_idx]);
+    }
+  }, nb_threads);
+  for (int thread_idx = 1; thread_idx < nb_threads; thread_idx++)
+    histograms[0].merge(histograms[thread_idx]);
+  result->histogram =
+      std::make_shared<const VolumeHistogram>(std::move(histograms[0]));
+  return result;
+}
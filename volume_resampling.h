@@ -0,0 +1,33 @@
+#ifndef VOLUME_RESAMPLING_H
+#define VOLUME_RESAMPLING_H
+
+#include <memory>
+
+#include "volumic_data.h"
+
+/// The kernels available to interpolate values between voxels
+enum class Interpolation { TRILINEAR, CUBIC };
+
+/// Resample the volume on a grid of cubic voxels of size 'spacing' [mm], the
+/// first voxel of the result is at the position of the first voxel of
+/// 'volume'. If 'spacing' is not positive, the smallest spacing of the volume
+/// is used so that no resolution is lost.
+///
+/// The storage of the result is chosen from its own size, like for the
+/// volumes loaded: it is stored in memory if it fits in 'memory_budget'
+/// [bytes], otherwise out-of-core with a cache of 'memory_budget', or
+/// compressed if 'volume' is compressed and the result is less than twice
+/// the budget. The slice spacing of the result has the sign of the one of
+/// 'volume', so that the layers keep their order.
+///
+/// Cubic interpolation uses a Catmull-Rom kernel, values overshooting the
+/// range of uint16_t are clamped.
+std::unique_ptr<VolumicData> resampleVolume(VolumicData &volume,
+                                            double spacing,
+                                            Interpolation interpolation,
+                                            size_t memory_budget);
+
+/// The spacing used by resampleVolume when 'spacing' is not positive [mm]
+double getIsotropicSpacing(const VolumicData &volume);
+
+#endif // VOLUME_RESAMPLING_H
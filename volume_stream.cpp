@@ -0,0 +1,402 @@
+#include "volume_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "volumic_data.h"
+
+using namespace volume_stream;
+
+const size_t VolumeStreamPublisher::default_capacity;
+
+/// Frames start on multiples of this size [bytes]
+static const uint64_t frame_alignment = 64;
+
+static uint64_t alignFrame(uint64_t bytes) {
+  return (bytes + frame_alignment - 1) / frame_alignment * frame_alignment;
+}
+
+static std::runtime_error systemError(const std::string &what) {
+  return std::runtime_error(what + ": " + strerror(errno));
+}
+
+static sockaddr_un getSocketAddress(const std::string &socket_path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path))
+    throw std::runtime_error("Socket path too long: " + socket_path);
+  strcpy(address.sun_path, socket_path.c_str());
+  return address;
+}
+
+/// Bind 'fd' to 'address', replacing the socket file left by a publisher
+/// which no longer runs. Throws std::runtime_error if another publisher
+/// listens on it or if the path is not a socket.
+static void bindSocket(int fd, const sockaddr_un &address) {
+  const std::string path = address.sun_path;
+  if (bind(fd, (const sockaddr *)&address, sizeof(address)) == 0)
+    return;
+  if (errno != EADDRINUSE)
+    throw systemError("Can't bind " + path);
+  struct stat status;
+  if (lstat(path.c_str(), &status) != 0 || !S_ISSOCK(status.st_mode))
+    throw std::runtime_error(path + " exists and is not a socket");
+  // Only a socket nobody listens on refuses the connection
+  int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (probe < 0)
+    throw systemError("Can't check " + path);
+  int result = connect(probe, (const sockaddr *)&address, sizeof(address));
+  int connect_error = errno;
+  close(probe);
+  if (result == 0)
+    throw std::runtime_error(path + " is used by another publisher");
+  if (connect_error != ECONNREFUSED) {
+    errno = connect_error;
+    throw systemError("Can't check " + path);
+  }
+  if (unlink(path.c_str()) != 0 ||
+      bind(fd, (const sockaddr *)&address, sizeof(address)) != 0)
+    throw systemError("Can't bind " + path);
+}
+
+std::string volume_stream::getDefaultSocketPath() {
+  const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir != nullptr && runtime_dir[0] != 0)
+    return std::string(runtime_dir) + "/dicom_viewer.sock";
+  return "/tmp/dicom_viewer-" + std::to_string(getuid()) + ".sock";
+}
+
+std::string volume_stream::getDefaultShmName() {
+  return "/dicom_viewer_stream-" + std::to_string(getuid());
+}
+
+VolumeStreamPublisher::VolumeStreamPublisher(const std::string &socket_path,
+                                             const std::string &shm_prefix,
+                                             size_t capacity)
+    : socket_path(socket_path),
+      shm_name(shm_prefix + "." + std::to_string(getpid())), shm_size(0),
+      shm(nullptr), header(nullptr), ring(nullptr), listen_fd(-1),
+      stop_pipe{-1, -1}, frame_position(0), frame_bytes(0), next_position(0),
+      next_sequence(1) {
+  memset(&last_message, 0, sizeof(last_message));
+  if (shm_name.size() >= sizeof(HelloMessage::shm_name))
+    throw std::runtime_error("Shared memory name too long: " + shm_name);
+  sockaddr_un address = getSocketAddress(socket_path);
+  capacity = alignFrame(std::max<size_t>(capacity, frame_alignment));
+
+  // The socket is taken first, a publisher already listening on it is kept
+  // and the construction fails. Message boundaries are kept by sequenced
+  // packets.
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0 || pipe(stop_pipe) != 0) {
+    std::runtime_error error = systemError("Can't listen on " + socket_path);
+    if (listen_fd >= 0)
+      close(listen_fd);
+    throw error;
+  }
+  try {
+    bindSocket(listen_fd, address);
+    if (listen(listen_fd, 8) != 0) {
+      std::runtime_error error = systemError("Can't listen on " + socket_path);
+      unlink(socket_path.c_str());
+      throw error;
+    }
+  } catch (const std::runtime_error &) {
+    close(listen_fd);
+    for (int fd : stop_pipe)
+      close(fd);
+    throw;
+  }
+
+  // The name of the shared memory is unique to the process, an existing one
+  // is never replaced. The pages of the ring are only allocated once
+  // written.
+  uint64_t ring_offset = alignFrame(sizeof(StreamHeader));
+  shm_size = ring_offset + capacity;
+  int shm_fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  void *mapping = MAP_FAILED;
+  if (shm_fd >= 0 && ftruncate(shm_fd, shm_size) == 0)
+    mapping =
+        mmap(nullptr, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  if (mapping == MAP_FAILED) {
+    std::runtime_error error =
+        systemError("Can't create the shared memory " + shm_name);
+    if (shm_fd >= 0) {
+      close(shm_fd);
+      shm_unlink(shm_name.c_str());
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    for (int fd : stop_pipe)
+      close(fd);
+    throw error;
+  }
+  close(shm_fd);
+  shm = (uint8_t *)mapping;
+  header = new (shm) StreamHeader();
+  header->magic = magic;
+  header->version = version;
+  header->ring_offset = ring_offset;
+  header->capacity = capacity;
+  header->write_end = 0;
+  ring = shm + ring_offset;
+  accept_thread = std::thread(&VolumeStreamPublisher::acceptConsumers, this);
+}
+
+VolumeStreamPublisher::~VolumeStreamPublisher() {
+  char stop = 0;
+  if (write(stop_pipe[1], &stop, 1) != 1)
+    shutdown(listen_fd, SHUT_RDWR);
+  accept_thread.join();
+  close(stop_pipe[0]);
+  close(stop_pipe[1]);
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  for (int fd : consumers)
+    close(fd);
+  // Consumers keep their mapping until they unmap it
+  munmap(shm, shm_size);
+  shm_unlink(shm_name.c_str());
+}
+
+FrameHeader *VolumeStreamPublisher::beginFrame(FrameKind kind,
+                                               size_t payload_bytes) {
+  uint64_t capacity = header->capacity;
+  frame_bytes = alignFrame(sizeof(FrameHeader) + payload_bytes);
+  if (frame_bytes > capacity)
+    throw std::length_error("Frame of " + std::to_string(frame_bytes) +
+                            " bytes larger than the ring (" +
+                            std::to_string(capacity) + " bytes)");
+  // Frames are contiguous, a frame which does not fit before the end of the
+  // ring starts again at its beginning
+  frame_position = next_position;
+  uint64_t offset = frame_position % capacity;
+  if (offset + frame_bytes > capacity)
+    frame_position += capacity - offset;
+  // Consumers of the frames about to be overwritten see them as invalid
+  // before they are modified
+  header->write_end.store(frame_position + frame_bytes,
+                          std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  FrameHeader *frame =
+      (FrameHeader *)(ring + frame_position % capacity);
+  memset(frame, 0, sizeof(FrameHeader));
+  frame->sequence = next_sequence;
+  frame->kind = kind;
+  frame->payload_bytes = payload_bytes;
+  return frame;
+}
+
+void VolumeStreamPublisher::endFrame() {
+  const FrameHeader *frame =
+      (const FrameHeader *)(ring + frame_position % header->capacity);
+  FrameMessage message;
+  memset(&message, 0, sizeof(message));
+  message.sequence = next_sequence++;
+  message.kind = frame->kind;
+  message.position = frame_position;
+  message.frame_bytes = frame_bytes;
+  next_position = frame_position + frame_bytes;
+  // The frame is complete before it is announced
+  std::atomic_thread_fence(std::memory_order_release);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (message.kind != VOLUME) {
+    last_message = message;
+  } else {
+    if (frame->first_layer == 0)
+      last_volume_messages.clear();
+    last_volume_messages.push_back(message);
+  }
+  auto it = std::remove_if(consumers.begin(), consumers.end(), [&](int fd) {
+    if (sendMessage(fd, &message, sizeof(message)))
+      return false;
+    close(fd);
+    return true;
+  });
+  consumers.erase(it, consumers.end());
+}
+
+void VolumeStreamPublisher::publishVolume(const VolumicData &volume) {
+  size_t layer_size = (size_t)volume.width * volume.height;
+  size_t layer_bytes = std::max<size_t>(layer_size * sizeof(uint16_t), 1);
+  uint64_t max_frame_bytes = header->capacity / 8;
+  if (sizeof(FrameHeader) + layer_bytes > max_frame_bytes)
+    throw std::length_error("Layers of " + std::to_string(layer_bytes) +
+                            " bytes larger than an eighth of the ring (" +
+                            std::to_string(header->capacity) + " bytes)");
+  int frame_layers = (max_frame_bytes - sizeof(FrameHeader)) / layer_bytes;
+  // Layers are read from the storage of the volume, whatever it is, and
+  // written once in the ring
+  std::shared_ptr<const VolumeSlab> slab;
+  for (int first_layer = 0; first_layer < volume.depth;
+       first_layer += frame_layers) {
+    int nb_layers = std::min(frame_layers, volume.depth - first_layer);
+    size_t nb_values = layer_size * nb_layers;
+    FrameHeader *frame = beginFrame(VOLUME, nb_values * sizeof(uint16_t));
+    frame->first_layer = first_layer;
+    frame->count = nb_values;
+    frame->sizes[0] = volume.width;
+    frame->sizes[1] = volume.height;
+    frame->sizes[2] = volume.depth;
+    frame->spacing[0] = volume.pixel_width;
+    frame->spacing[1] = volume.pixel_height;
+    frame->spacing[2] = volume.slice_spacing;
+    frame->win_min = volume.win_min;
+    frame->win_max = volume.win_max;
+    frame->intercept = volume.intercept;
+    uint16_t *values = (uint16_t *)(frame + 1);
+    for (int layer = 0; layer < nb_layers; layer++) {
+      if (!slab || !slab->contains(first_layer + layer))
+        slab = volume.getSlab(first_layer + layer);
+      memcpy(values + layer * layer_size, slab->getLayer(first_layer + layer),
+             layer_size * sizeof(uint16_t));
+    }
+    endFrame();
+  }
+}
+
+const std::string &VolumeStreamPublisher::getSocketPath() const {
+  return socket_path;
+}
+
+int VolumeStreamPublisher::getNbConsumers() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return consumers.size();
+}
+
+void VolumeStreamPublisher::acceptConsumers() {
+  while (true) {
+    pollfd fds[2] = {{listen_fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    if (fds[1].revents != 0)
+      return;
+    if ((fds[0].revents & POLLIN) == 0)
+      return;
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      continue;
+    HelloMessage hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = magic;
+    hello.version = version;
+    hello.shm_size = shm_size;
+    strcpy(hello.shm_name, shm_name.c_str());
+    std::lock_guard<std::mutex> lock(mutex);
+    // The consumer receives the current state without waiting for the next
+    // frames, the frames already overwritten are skipped
+    std::vector<FrameMessage> messages;
+    uint64_t write_end = header->write_end.load(std::memory_order_relaxed);
+    for (const FrameMessage &message : last_volume_messages)
+      if (write_end <= message.position + header->capacity)
+        messages.push_back(message);
+    if (last_message.sequence != 0 &&
+        write_end <= last_message.position + header->capacity)
+      messages.push_back(last_message);
+    std::sort(messages.begin(), messages.end(),
+              [](const FrameMessage &a, const FrameMessage &b) {
+                return a.sequence < b.sequence;
+              });
+    bool connected = sendMessage(fd, &hello, sizeof(hello));
+    for (const FrameMessage &message : messages)
+      connected = connected && sendMessage(fd, &message, sizeof(message));
+    if (!connected) {
+      close(fd);
+      continue;
+    }
+    consumers.push_back(fd);
+  }
+}
+
+bool VolumeStreamPublisher::sendMessage(int fd, const void *message,
+                                        size_t size) {
+  // Consumers are never waited for, a full socket drops the message
+  if (send(fd, message, size, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)size)
+    return true;
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+VolumeStreamConsumer::VolumeStreamConsumer(const std::string &socket_path)
+    : fd(-1), shm_size(0), shm(nullptr), header(nullptr) {
+  sockaddr_un address = getSocketAddress(socket_path);
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0 || connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+    std::runtime_error error = systemError("Can't connect to " + socket_path);
+    if (fd >= 0)
+      close(fd);
+    throw error;
+  }
+  HelloMessage hello;
+  if (recv(fd, &hello, sizeof(hello), 0) != (ssize_t)sizeof(hello) ||
+      hello.magic != magic || hello.version != version) {
+    close(fd);
+    throw std::runtime_error("Unexpected hello message from " + socket_path);
+  }
+  hello.shm_name[sizeof(hello.shm_name) - 1] = 0;
+  int shm_fd = shm_open(hello.shm_name, O_RDONLY, 0);
+  void *mapping = MAP_FAILED;
+  if (shm_fd >= 0) {
+    mapping = mmap(nullptr, hello.shm_size, PROT_READ, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+  }
+  if (mapping == MAP_FAILED) {
+    std::runtime_error error = systemError(
+        std::string("Can't map the shared memory ") + hello.shm_name);
+    close(fd);
+    throw error;
+  }
+  shm_size = hello.shm_size;
+  shm = (const uint8_t *)mapping;
+  header = (const StreamHeader *)shm;
+}
+
+VolumeStreamConsumer::~VolumeStreamConsumer() {
+  munmap((void *)shm, shm_size);
+  close(fd);
+}
+
+bool VolumeStreamConsumer::waitFrame(int timeout_ms, Frame *frame) {
+  pollfd poll_fd = {fd, POLLIN, 0};
+  int result = poll(&poll_fd, 1, timeout_ms);
+  if (result < 0 && errno != EINTR)
+    throw systemError("Can't wait for the publisher");
+  if (result <= 0)
+    return false;
+  FrameMessage message;
+  if (recv(fd, &message, sizeof(message), 0) != (ssize_t)sizeof(message))
+    throw std::runtime_error("The publisher disconnected");
+  std::atomic_thread_fence(std::memory_order_acquire);
+  uint64_t offset = message.position % header->capacity;
+  frame->position = message.position;
+  frame->frame_bytes = std::min<uint64_t>(
+      std::max<uint64_t>(message.frame_bytes, sizeof(FrameHeader)),
+      header->capacity - offset);
+  frame->header = (const FrameHeader *)(shm + header->ring_offset + offset);
+  frame->payload = frame->header + 1;
+  return true;
+}
+
+bool VolumeStreamConsumer::isValid(const Frame &frame) const {
+  // What has been read is ordered before the test, like with a sequence lock
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return header->write_end.load(std::memory_order_relaxed) <=
+         frame.position + header->capacity;
+}
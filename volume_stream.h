@@ -0,0 +1,249 @@
+#ifndef VOLUME_STREAM_H
+#define VOLUME_STREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class VolumicData;
+
+/// Binary layout shared by VolumeStreamPublisher and its consumers. All the
+/// integers are in the byte order of the machine, the structures have no
+/// implicit padding.
+namespace volume_stream {
+
+const uint32_t magic = 0x53505644; // "DVPS"
+const uint32_t version = 2;
+
+/// Socket used by the viewer and the stand-in consumer when none is given:
+/// in $XDG_RUNTIME_DIR if set, otherwise in /tmp, named after the user so
+/// that the viewers of different users don't take over each other's stream
+std::string getDefaultSocketPath();
+/// Prefix of the shared memory of the viewer, named after the user
+std::string getDefaultShmName();
+
+enum FrameKind : uint32_t {
+  /// The payload is 'count' StreamPoint
+  POINTS = 1,
+  /// The payload is the 'count' stored values of consecutive layers of a
+  /// volume starting at 'first_layer', uint16_t column by column, row by
+  /// row, then layer by layer. A volume is published as frames of
+  /// increasing 'first_layer', see VolumeStreamPublisher::publishVolume.
+  VOLUME = 2
+};
+
+/// At the start of the shared memory, the ring starts at 'ring_offset'
+struct StreamHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t ring_offset;
+  /// Size of the ring [bytes]
+  uint64_t capacity;
+  /// Absolute position up to which the ring has been written or is being
+  /// written. The bytes of a frame starting at 'position' are valid as long
+  /// as write_end <= position + capacity.
+  std::atomic<uint64_t> write_end;
+};
+
+/// At the start of each frame in the ring, followed by the payload
+struct FrameHeader {
+  uint64_t sequence;
+  uint32_t kind;
+  /// First layer of the values of a VOLUME frame, 0 for other frames
+  uint32_t first_layer;
+  /// Number of points or of values of the payload
+  uint64_t count;
+  uint64_t payload_bytes;
+  /// Number of voxels along x, y and z of the volume, or of the grid the
+  /// points are extracted from
+  uint32_t sizes[3];
+  /// Size of a voxel along x, y and z, in mm for volumes and in the
+  /// coordinates of the points for points
+  float spacing[3];
+  /// Window applied to the stored values
+  double win_min;
+  double win_max;
+  /// Offset from the stored values to the values of the series
+  double intercept;
+};
+
+/// A point of the display set, as drawn by the 3D view
+struct StreamPoint {
+  float position[3];
+  float color[3];
+  /// Opacity of the point, including the opacity of its segment
+  float opacity;
+  /// Code of the surface normal, see NormalVolume
+  uint16_t normal;
+  /// Segment of the point, see TransferFunction
+  uint8_t segment;
+  uint8_t reserved;
+};
+
+/// Sent to a consumer when it connects
+struct HelloMessage {
+  uint32_t magic;
+  uint32_t version;
+  /// Size of the shared memory [bytes]
+  uint64_t shm_size;
+  /// Name of the shared memory, for shm_open, null-terminated
+  char shm_name[64];
+};
+
+/// Sent to the consumers when a frame is published, and to a consumer
+/// connecting after the last frame has been published
+struct FrameMessage {
+  uint64_t sequence;
+  uint32_t kind;
+  uint32_t reserved;
+  /// Absolute position of the frame, its header is at
+  /// ring_offset + position % capacity
+  uint64_t position;
+  /// Size of the frame, header included [bytes]
+  uint64_t frame_bytes;
+};
+
+static_assert(sizeof(StreamPoint) == 32, "StreamPoint must not be padded");
+static_assert(sizeof(FrameHeader) % 16 == 0,
+              "The payload must stay aligned after the header");
+
+} // namespace volume_stream
+
+/// Publishes volumes and point sets to other processes of the machine.
+///
+/// Frames are written in a ring in POSIX shared memory, and a message
+/// announcing each frame is sent to the consumers connected to a Unix
+/// socket. Consumers map the shared memory and read the frames in place, so
+/// the data is never copied through the socket or through files. Frames
+/// are placed contiguously in the ring, the oldest ones being overwritten:
+/// a consumer checks after reading a frame that it has not been overwritten
+/// meanwhile, see VolumeStreamConsumer::isValid.
+///
+/// A frame stays valid until the frames published after it fill the rest of
+/// the ring: a consumer has the time the publisher takes to write
+/// 'capacity' minus the size of the frame to read it, or to copy what it
+/// needs. The viewer publishes the points each time the display changes and
+/// the volume each time it is loaded. Volumes are split in frames of at most
+/// an eighth of the ring, so that a frame of a volume outlives at least 7
+/// other frames of that volume whatever its size, and a consumer keeping up
+/// with the frames as they are announced receives all the layers.
+///
+/// The publisher never waits for the consumers: a message which can't be
+/// sent right away is dropped, the consumer receives the next one.
+/// Publishing is done from a single thread, consumers are accepted from a
+/// thread of the publisher.
+class VolumeStreamPublisher {
+public:
+  static const size_t default_capacity = (size_t)256 << 20;
+
+  /// Listen on 'socket_path' and create a shared memory with a ring of
+  /// 'capacity' bytes, named 'shm_prefix' followed by the process id. A
+  /// socket file left by a publisher which no longer runs is replaced.
+  /// Throws std::runtime_error on failure, in particular if another
+  /// publisher listens on 'socket_path'.
+  VolumeStreamPublisher(const std::string &socket_path,
+                        const std::string &shm_prefix,
+                        size_t capacity = default_capacity);
+  /// Disconnect the consumers and remove the socket and the shared memory
+  ~VolumeStreamPublisher();
+
+  VolumeStreamPublisher(const VolumeStreamPublisher &other) = delete;
+  VolumeStreamPublisher &operator=(const VolumeStreamPublisher &other) = delete;
+
+  /// Reserve a frame with a payload of 'payload_bytes' in the ring and
+  /// return its header, whose fields other than 'sequence', 'kind' and
+  /// 'payload_bytes' are to be filled by the caller along with the payload,
+  /// which follows the header. The frame is published by endFrame.
+  /// Throws std::length_error if the frame is larger than the ring.
+  volume_stream::FrameHeader *beginFrame(volume_stream::FrameKind kind,
+                                         size_t payload_bytes);
+  /// Announce the frame started by beginFrame to the consumers
+  void endFrame();
+
+  /// Publish the stored values of a volume in frames of consecutive layers
+  /// of at most an eighth of the ring. Throws std::length_error if a layer
+  /// does not fit in such a frame.
+  void publishVolume(const VolumicData &volume);
+
+  const std::string &getSocketPath() const;
+  int getNbConsumers() const;
+
+private:
+  void acceptConsumers();
+  /// Send a message to a consumer, return false if it disconnected
+  static bool sendMessage(int fd, const void *message, size_t size);
+
+  std::string socket_path;
+  std::string shm_name;
+  size_t shm_size;
+  uint8_t *shm;
+  volume_stream::StreamHeader *header;
+  uint8_t *ring;
+
+  int listen_fd;
+  /// Written to stop the accepting thread
+  int stop_pipe[2];
+  std::thread accept_thread;
+
+  /// Position and size of the frame started by beginFrame
+  uint64_t frame_position;
+  uint64_t frame_bytes;
+  /// Position of the next frame
+  uint64_t next_position;
+  uint64_t next_sequence;
+
+  /// Protects 'consumers' and the last messages
+  mutable std::mutex mutex;
+  std::vector<int> consumers;
+  /// The messages of the frames of the last volume and of the last other
+  /// frame (sequence 0 if none), sent to the consumers when they connect
+  std::vector<volume_stream::FrameMessage> last_volume_messages;
+  volume_stream::FrameMessage last_message;
+};
+
+/// Receives the frames of a VolumeStreamPublisher, used to check the stream
+/// and as an example for external consumers
+class VolumeStreamConsumer {
+public:
+  /// A frame read in place in the shared memory
+  struct Frame {
+    uint64_t position;
+    /// Size of the frame, header included [bytes], as announced by the
+    /// publisher and bounded by the end of the ring. The header may be
+    /// overwritten while it is read, the payload must not be read past
+    /// 'frame_bytes' whatever the header says.
+    uint64_t frame_bytes;
+    const volume_stream::FrameHeader *header;
+    const void *payload;
+  };
+
+  /// Connect to the publisher listening on 'socket_path' and map its
+  /// shared memory. Throws std::runtime_error on failure.
+  explicit VolumeStreamConsumer(const std::string &socket_path);
+  ~VolumeStreamConsumer();
+
+  VolumeStreamConsumer(const VolumeStreamConsumer &other) = delete;
+  VolumeStreamConsumer &operator=(const VolumeStreamConsumer &other) = delete;
+
+  /// Wait at most 'timeout_ms' for the next frame, a negative timeout waits
+  /// forever. Return false on timeout. Throws std::runtime_error when the
+  /// publisher disconnects.
+  bool waitFrame(int timeout_ms, Frame *frame);
+
+  /// Return true if the frame has not been overwritten by the publisher,
+  /// to be called after reading the frame: what has been read is only
+  /// valid if it returns true
+  bool isValid(const Frame &frame) const;
+
+private:
+  int fd;
+  size_t shm_size;
+  const uint8_t *shm;
+  const volume_stream::StreamHeader *header;
+};
+
+#endif // VOLUME_STREAM_H
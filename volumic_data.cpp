@@ -1,25 +1,95 @@
 #include "volumic_data.h"
 
+#include <algorithm>
 #include <stdexcept>
 
-#define range(value, min, max) value >= min && value < max 
-
 VolumicData::VolumicData()
     : width(-1), height(-1), depth(-1), pixel_width(-1), pixel_height(-1),
       slice_spacing(0) {}
 
 VolumicData::VolumicData(int W, int H, int D, double min, double max, double I)
-    : data(W * H * D), width(W), height(H), depth(D), win_min(min), win_max(max), intercept(I) {}
+    : data(std::make_shared<std::vector<uint16_t>>((size_t)W * H * D)), width(W), height(H), depth(D), win_min(min), win_max(max), intercept(I) {}
+
+VolumicData::VolumicData(int W, int H, int D, double min, double max, double I,
+                         std::shared_ptr<SlabCache> cache)
+    : slab_cache(cache), width(W), height(H), depth(D), win_min(min),
+      win_max(max), intercept(I) {}
+
+VolumicData::VolumicData(int W, int H, int D, double min, double max, double I,
+                         std::shared_ptr<CompressedVolume> compressed)
+    : compressed(compressed), width(W), height(H), depth(D), win_min(min),
+      win_max(max), intercept(I) {}
 
 VolumicData::VolumicData(const VolumicData &other)
-    : data(other.data), width(other.width), height(other.height),
+    : data(other.data), slab_cache(other.slab_cache), compressed(other.compressed),
+      width(other.width), height(other.height),
       depth(other.depth), pixel_width(other.pixel_width),
-      pixel_height(other.pixel_height), slice_spacing(other.slice_spacing) {}
+      pixel_height(other.pixel_height), slice_spacing(other.slice_spacing),
+      win_min(other.win_min), win_max(other.win_max), intercept(other.intercept),
+      histogram(other.histogram) {}
 
 VolumicData::~VolumicData() {}
 
-unsigned char VolumicData::getValue(int col, int row, int layer) {
-  return data[col + row * width + layer * width * height];
+uint16_t VolumicData::getValue(int col, int row, int layer) {
+  if (slab_cache)
+    return getSlab(layer)->getLayer(layer)[col + row * width];
+  if (compressed)
+    return compressed->getValue(col, row, layer);
+  return (*data)[col + row * width + (size_t)layer * width * height];
+}
+
+bool VolumicData::isOutOfCore() const { return slab_cache != nullptr; }
+
+bool VolumicData::isCompressed() const { return compressed != nullptr; }
+
+void VolumicData::detach() {
+  // The storage of a partial view has no owner, writing to it would modify
+  // the layers of the volume being built
+  if ((data && data.use_count() == 0) ||
+      (slab_cache && slab_cache.use_count() == 0) ||
+      (compressed && compressed.use_count() == 0))
+    throw std::logic_error("Partial views of a volume are read-only");
+  if (data && data.use_count() > 1)
+    data = std::make_shared<std::vector<uint16_t>>(*data);
+  if (slab_cache && slab_cache.use_count() > 1) {
+    std::shared_ptr<SlabCache> copy = SlabCache::createTemporary(
+        width * height, depth, slab_cache->getMemoryBudget());
+    for (int layer = 0; layer < depth; layer++) {
+      std::shared_ptr<const VolumeSlab> slab = slab_cache->getSlab(layer);
+      copy->writeLayer(slab->getLayer(layer), layer);
+    }
+    slab_cache = copy;
+  }
+  if (compressed && compressed.use_count() > 1)
+    compressed = compressed->clone();
+}
+
+size_t VolumicData::getMemoryUsed() const {
+  if (slab_cache)
+    return slab_cache->getMemoryBudget();
+  if (compressed)
+    return compressed->getCompressedSize() + compressed->getCacheBudget();
+  return data ? data->size() * sizeof(uint16_t) : 0;
+}
+
+double VolumicData::getVoxelSize(int axis) const {
+  double spacing = axis == 0 ? pixel_width
+                             : axis == 1 ? pixel_height : slice_spacing;
+  spacing = std::fabs(spacing);
+  return spacing > 0 ? spacing : 1;
+}
+
+std::shared_ptr<const VolumeSlab> VolumicData::getSlab(int layer) const {
+  if (slab_cache)
+    return slab_cache->getSlab(layer);
+  if (compressed)
+    return compressed->getSlab(layer);
+  std::shared_ptr<VolumeSlab> slab = std::make_shared<VolumeSlab>();
+  slab->first_layer = 0;
+  slab->nb_layers = depth;
+  slab->layer_size = width * height;
+  slab->values = data->data();
+  return slab;
 }
 
 QVector3D VolumicData::getCoordinate(int idx) {
@@ -29,16 +99,74 @@ QVector3D VolumicData::getCoordinate(int idx) {
   return QVector3D(x, y, z); 
 }
 
-void VolumicData::setLayer(uint16_t *layer_data, int layer) {
+void VolumicData::setLayer(uint16_t *layer_data, int layer,
+                           VolumeHistogram *histogram) {
+  int layer_size = width * height;
+  std::vector<uint16_t> buffer(layer_size);
+  double offset_ = pow(2, 15) - intercept;
+  for (int i = 0; i < layer_size; i++) {
+    buffer[i] = layer_data[i] - offset_;
+  }
+  setStoredLayer(buffer.data(), layer, histogram);
+}
+
+void VolumicData::setStoredLayer(const uint16_t *values, int layer,
+                                 VolumeHistogram *histogram) {
   if (layer >= depth)
     throw std::out_of_range(
         "Layer " + std::to_string(layer) +
         " is outside of volume (depth=" + std::to_string(depth) + ")");
-  int offset = width * height * layer;
-  double offset_ = pow(2, 15) - intercept;
-  for (int i = 0; i < width * height; i++) {
-    data[i + offset] = layer_data[i] - offset_;
+  int layer_size = width * height;
+  detach();
+  if (slab_cache)
+    slab_cache->writeLayer(values, layer);
+  else if (compressed)
+    compressed->writeLayer(values, layer);
+  else
+    std::copy(values, values + layer_size,
+              data->begin() + (size_t)layer_size * layer);
+  if (histogram)
+    histogram->addLayer(values, layer_size, layer);
+}
+
+std::unique_ptr<VolumicData> VolumicData::createEmptyCopy() const {
+  std::unique_ptr<VolumicData> result = createEmptyCopy(width, height, depth);
+  result->pixel_width = pixel_width;
+  result->pixel_height = pixel_height;
+  result->slice_spacing = slice_spacing;
+  return result;
+}
+
+std::unique_ptr<VolumicData> VolumicData::createEmptyCopy(int W, int H,
+                                                          int D) const {
+  std::unique_ptr<VolumicData> result;
+  if (slab_cache) {
+    std::shared_ptr<SlabCache> cache = SlabCache::createTemporary(
+        W * H, D, slab_cache->getMemoryBudget());
+    result.reset(new VolumicData(W, H, D, win_min, win_max, intercept, cache));
+  } else if (compressed) {
+    std::shared_ptr<CompressedVolume> storage = std::make_shared<CompressedVolume>(
+        W, H, D, compressed->getCacheBudget());
+    result.reset(new VolumicData(W, H, D, win_min, win_max, intercept, storage));
+  } else {
+    result.reset(new VolumicData(W, H, D, win_min, win_max, intercept));
   }
+  return result;
+}
+
+// Pointers aliasing an empty owner do not count as users of the storage
+VolumicData::VolumicData(const VolumicData &other, int nb_layers)
+    : data(std::shared_ptr<std::vector<uint16_t>>(), other.data.get()),
+      slab_cache(std::shared_ptr<SlabCache>(), other.slab_cache.get()),
+      compressed(std::shared_ptr<CompressedVolume>(), other.compressed.get()),
+      width(other.width), height(other.height),
+      depth(std::min(std::max(nb_layers, 0), other.depth)),
+      pixel_width(other.pixel_width), pixel_height(other.pixel_height),
+      slice_spacing(other.slice_spacing), win_min(other.win_min),
+      win_max(other.win_max), intercept(other.intercept) {}
+
+std::unique_ptr<VolumicData> VolumicData::createPartialView(int nb_layers) const {
+  return std::unique_ptr<VolumicData>(new VolumicData(*this, nb_layers));
 }
 
 double VolumicData::manualWindowHandling(double value) {
@@ -47,38 +175,3 @@ double VolumicData::manualWindowHandling(double value) {
 
   return (value - win_min) / (win_max - win_min);
 }
-
-int VolumicData::threshold(double value, double min, double max, bool colorMode) {
-  
-  if (!colorMode) 
-  {
-    if(value <= max && value >= min)
-      return 1;
-  }
-  else 
-  {
-    if(range(value, 200, 1024))         return 2; // Bone
-    else if(range(value, 100, 200))     return 3; // Structures faiblement calcifiées
-    else if(range(value, 37, 45))       return 4; // Matière grise
-    else if(range(value, 20, 30))       return 5; // Matière blanche
-    else if(range(value, -5, 15))       return 6; // Eau et liquides cérébro
-    else if(range(value, -1024, -10))   return 7; // Graisses, poumons, air
-  }
-  return 0;
-}
-
-QVector3D VolumicData::getColorSegment(int segment, double c) {
-  QVector3D color;
-  switch (segment)
-  {
-    case 1: color = QVector3D(c, c, c); break;        // blanc
-    case 2: color = QVector3D(1, 1, 1); break;       // blanc
-    case 3: color = QVector3D(0.5, 0.5, 0.5); break;  // gris
-    case 4: color = QVector3D(0, 1, 0); break;       // vert
-    case 5: color = QVector3D(1, 0.7, 0); break;       // jaune
-    case 6: color = QVector3D(0.2, 0.2, 1); break;   // bleu
-    case 7: color = QVector3D(1, 0, 0); break;       // rouge
-    default: color = QVector3D(0, 0, 0); break;
-  }
-  return color;
-}
\ No newline at end of file
@@ -9,13 +9,27 @@
 
 #include <QVector3D>
 
+#include "compressed_volume.h"
+#include "slab_cache.h"
+#include "volume_histogram.h"
+
 class VolumicData {
 public:
   // The data from the volume stored:
   // - column by column
   // - line by line
   // - slice by slice
-  std::vector<uint16_t> data;
+  // It is nullptr when the volume is stored out-of-core or compressed
+  // Copies of a volume share the same storage until one of them is modified
+  std::shared_ptr<std::vector<uint16_t>> data;
+
+  /// The cache holding the volume when it is stored out-of-core, nullptr
+  /// when the volume is stored in 'data'. Shared between copies like 'data'.
+  std::shared_ptr<SlabCache> slab_cache;
+
+  /// The compressed layers when the volume is stored compressed in memory,
+  /// nullptr otherwise. Shared between copies like 'data'.
+  std::shared_ptr<CompressedVolume> compressed;
 
   int width;
   int height;
@@ -29,20 +43,80 @@ public:
   double win_max;
   double intercept;
 
+  /// The histogram of the stored values, nullptr if it has not been computed
+  std::shared_ptr<const VolumeHistogram> histogram;
+
   // The data provided
   VolumicData();
   VolumicData(int width, int height, int depth, double win_min, double win_max, double intercept);
+  /// Build an out-of-core volume whose layers are stored in 'slab_cache'
+  VolumicData(int width, int height, int depth, double win_min, double win_max,
+              double intercept, std::shared_ptr<SlabCache> slab_cache);
+  /// Build a volume whose layers are stored compressed in 'compressed'
+  VolumicData(int width, int height, int depth, double win_min, double win_max,
+              double intercept, std::shared_ptr<CompressedVolume> compressed);
+  /// The copy shares the storage of 'other' until one of them is modified
   VolumicData(const VolumicData &other);
   ~VolumicData();
 
-  unsigned char getValue(int col, int row, int layer);
+  uint16_t getValue(int col, int row, int layer);
+
+  bool isOutOfCore() const;
+
+  bool isCompressed() const;
+
+  /// Give the volume its own copy of the storage if it is shared with other
+  /// volumes. Layers can only be written from several threads at once once
+  /// the storage is not shared anymore. Throws std::logic_error for partial
+  /// views, which are read-only.
+  void detach();
+
+  /// Memory used to store the voxels [bytes], for out-of-core volumes the
+  /// memory budget of the cache, for compressed volumes the size of the
+  /// compressed layers and the memory budget of their cache
+  size_t getMemoryUsed() const;
+
+  /// Size of a voxel along the given axis (0: x, 1: y, 2: z) [mm], 1 if the
+  /// spacing is unknown. It is the absolute value of the spacing: the slice
+  /// spacing is negative when the instance numbers decrease along z.
+  double getVoxelSize(int axis) const;
+
+  /// Return a slab containing the given layer. When the volume is in memory
+  /// and not compressed, the slab contains the whole volume.
+  std::shared_ptr<const VolumeSlab> getSlab(int layer) const;
+
+  /// Store the values of a layer, if 'histogram' is provided, the stored
+  /// values are added to it. The storage is detached first if it is shared.
+  void setLayer(uint16_t *layer_data, int layer,
+                VolumeHistogram *histogram = nullptr);
+
+  /// Same as setLayer for values which have already been converted to the
+  /// stored representation, e.g. computed from another volume
+  void setStoredLayer(const uint16_t *values, int layer,
+                      VolumeHistogram *histogram = nullptr);
+
+  /// Build a volume with the same dimensions and properties, stored the same
+  /// way (in memory, out-of-core or compressed), whose values are all 0
+  std::unique_ptr<VolumicData> createEmptyCopy() const;
+  /// Same as createEmptyCopy with other dimensions, the spacing of the voxels
+  /// has to be updated by the caller
+  std::unique_ptr<VolumicData> createEmptyCopy(int width, int height,
+                                               int depth) const;
 
-  void setLayer(uint16_t *layer_data, int layer);
+  /// Return a volume made of the first 'nb_layers' layers, reading them from
+  /// the storage of this volume without sharing it: the layers which follow
+  /// can still be written from several threads while the view is used. The
+  /// view is read-only and must not outlive this volume. Used to show a
+  /// volume being built.
+  std::unique_ptr<VolumicData> createPartialView(int nb_layers) const;
   double manualWindowHandling(double value);
-  int threshold(double value, double min, double max, bool colorMode);
-  QVector3D getColorSegment(int segment, double c);
   QVector3D getCoordinate(int idx);
 
+private:
+  /// Build the view returned by createPartialView. The storage of 'other' is
+  /// only aliased: its owners are never copied, so that threads writing to
+  /// 'other' never see it shared and never detach it.
+  VolumicData(const VolumicData &other, int nb_layers);
 };
 
 #endif // VOLUMIC_DATA_H